@@ -3,78 +3,70 @@
 #include <string>
 #include "CompileState.hpp"
 
-std::string toStr(Register res, std::string regPrefix) {
-    return regPrefix + std::to_string((int)res);
-}
-
 std::string toStr(long l) {
     return std::to_string(l);
 }
 
-std::ostream &operator<<(std::ostream &os, Register &reg) {
-    return os << 'x' << (int)reg;
-}
-
-CompileState::CompileState(std::ostream &os)
-        : os(os),
-          varTypes(new std::unordered_map<std::string, TypeNode *>()) {
+CompileState::CompileState()
+        : types(arena),
+          symbols(arena) {
 
     // Add builtin function signatures
-    addFnDecl(new FnDeclNode(
-        new TypeNode(BuiltinType::Void),
+    addFnDecl(arena.create<FnDeclNode>(
+        types.get(BuiltinType::Void),
         "printi",
         std::vector<ParamNode *>{
-            new ParamNode(new TypeNode(BuiltinType::Int), "i")
+            arena.create<ParamNode>(types.get(BuiltinType::Int),
+                                    symbols.intern("i"), 0)
         })
     );
 
     // Not a technically function, but still has a signature
-    addFnDecl(new FnDeclNode(
-        new TypeNode(BuiltinType::Int),
+    addFnDecl(arena.create<FnDeclNode>(
+        types.get(BuiltinType::Int),
         "svc",
         std::vector<ParamNode *>{
-            new ParamNode(new TypeNode(BuiltinType::Int), "syscall")
+            arena.create<ParamNode>(types.get(BuiltinType::Int),
+                                    symbols.intern("syscall"), 0)
         })
     );
 }
 
-void CompileState::pushFrame(FnDefNode *fnDef) {
-    frames.emplace_back(this, fnDef);
-}
-
-StackFrame *CompileState::getTopFrame() {
-    return &frames.back();
-}
-
-void CompileState::popFrame() {
-    frames.pop_back();
-}
-
 StaticData *CompileState::addStaticData(std::string string) {
-    StaticData *dataPtr = new StaticData(staticData.size(), string);
+    StaticData *dataPtr = arena.create<StaticData>(this, staticData.size(),
+                                                   string);
     staticData.push_back(dataPtr);
     return staticData.back();
 }
 
-StaticData *CompileState::getStaticData(unsigned long id) {
-    return staticData[id];
-}
-
-TypeNode *CompileState::getVarType(std::string identifier) {
-    if (varTypes->find(identifier) == varTypes->end()) {
-        std::cerr << "ERROR: Couldn't find the type of " << identifier << '\n';
+unsigned CompileState::declareVar(Symbol *identifier, TypeNode *type) {
+    if (identifier->scope == varScope) {
+        std::cerr << "ERROR: Tried to set type of alread-defined variable "
+                  << identifier->name << '\n';
         exit(EXIT_FAILURE);
     }
-    return (*varTypes)[identifier];
+    identifier->scope = varScope;
+    identifier->slot = varTypes.size();
+    varTypes.push_back(type);
+    return identifier->slot;
 }
 
-void CompileState::setVarType(std::string identifier, TypeNode *type) {
-    if (varTypes->find(identifier) != varTypes->end()) {
-        std::cerr << "ERROR: Tried to set type of alread-defined variable "
-                  << identifier << '\n';
+unsigned CompileState::getVarSlot(Symbol *identifier) {
+    if (identifier->scope != varScope) {
+        std::cerr << "ERROR: Couldn't find the type of "
+                  << identifier->name << '\n';
         exit(EXIT_FAILURE);
     }
-    (*varTypes)[identifier] = type;
+    return identifier->slot;
+}
+
+TypeNode *CompileState::getVarType(unsigned slot) {
+    return varTypes[slot];
+}
+
+void CompileState::clearVars() {
+    varTypes.clear();
+    varScope++;
 }
 
 FnDeclNode *CompileState::getFnDecl(std::string identifier) {
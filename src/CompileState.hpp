@@ -1,15 +1,21 @@
 #pragma once
 
 #include <iostream>
+#include <set>
 #include <string>
 #include <unordered_map>
-#include <unordered_set>
 #include <vector>
 #include "builtins.hpp"
+#include "FnStats.hpp"
+#include "TimeTrace.hpp"
+#include "mir/mir.hpp"
+#include "util.hpp"
 
 class StackFrame;
 class StaticData;
 class CompileState;
+struct FnOutput;
+struct Symbol;
 
 // Declarations
 class FnDeclNode;
@@ -44,10 +50,23 @@ public:
 class FnDefNode : public FnDeclNode {
 public:
     std::vector<StatementNode *> block;
-    FnDefNode(FnDeclNode fnDeclNode, std::vector<StatementNode *> block);
-    void emit(CompileState &cs);
+    unsigned numVars;  // Parameters and locals, each has one slot
+    std::vector<StaticData *> staticData;  // Referenced only by this function
+    bool isInline = false;  // Declared inline, a hint to inline it more
+    FnDefNode(FnDeclNode fnDeclNode,
+              std::vector<StatementNode *> block,
+              unsigned numVars,
+              std::vector<StaticData *> staticData);
+    void emit(CompileState &cs, FnOutput &output);
+
+private:
+    // Generates code straight from the AST, at -O0
+    void emitFromAST(CompileState &cs, FnOutput &output, MachineFunction &mf,
+                     unsigned returnLabel);
 };
 
+// Types are interned by TypeTable, so two types are equal exactly when their
+// TypeNode pointers are equal.
 class TypeNode {
 public:
     enum TypeKind {
@@ -57,21 +76,26 @@ public:
     std::string customType;
     TypeNode *pointerType;
     TypeNode(BuiltinType builtinType);
-    TypeNode(LiteralType literalType);
     TypeNode(std::string customType);
     TypeNode(TypeNode *pointerType);
     unsigned size();
+    bool isVoid();
     bool validOp(BuiltinOperator op, TypeNode *otherType);
     bool validOp(BuiltinOperator op);
-    bool operator==(const TypeNode &other) const;
-    bool operator!=(const TypeNode &other) const;
+
+private:
+    friend class TypeTable;
+    unsigned cachedSize;
+    TypeNode *pointerToThis = nullptr;  // Canonical pointer to this type
+    unsigned computeSize();
 };
 
 class ParamNode {
 public:
     TypeNode *type;
-    std::string identifier;
-    ParamNode(TypeNode *type, std::string identifier);
+    Symbol *identifier;
+    unsigned slot;
+    ParamNode(TypeNode *type, Symbol *identifier, unsigned slot);
 };
 
 class StatementNode {
@@ -83,20 +107,22 @@ public:
     } kind;
 
     TypeNode *type;             // Declaration/Initialization
-    std::string identifier;     // Declaration/Initialization
+    Symbol *identifier;         // Declaration/Initialization
+    unsigned slot;              // Declaration/Initialization
     AccessorNode *accessor;     // Assignment
     ExprNode *expr;             // Initialization/Assignment/Return
     FnCallNode *fnCall;         // FnCall
     std::vector<ExprNode *> *array; // ArrayInitialization
 
-    StatementNode(TypeNode *type, std::string identifier);
-    StatementNode(TypeNode *type, std::string identifier, ExprNode *expr);
+    StatementNode(TypeNode *type, Symbol *identifier, unsigned slot);
+    StatementNode(TypeNode *type, Symbol *identifier, unsigned slot,
+                  ExprNode *expr);
     StatementNode(AccessorNode *accessor, ExprNode *rexpr);
     StatementNode(ExprNode *returnExpr);
     StatementNode(FnCallNode *fnCall);
     StatementNode(StatementKind derivedKind);
 
-    virtual std::string emit(StackFrame *sf);
+    virtual void emit(MachineFunction &mf, StackFrame *sf);
     virtual bool containsFnCalls();
     bool isDerived();
 };
@@ -110,7 +136,7 @@ public:
     IfNode(ExprNode *condition,
                    std::vector<StatementNode *> block,
                    std::vector<StatementNode *> elseBlock);
-    virtual std::string emit(StackFrame *sf) override;
+    virtual void emit(MachineFunction &mf, StackFrame *sf) override;
     virtual bool containsFnCalls() override;
 };
 
@@ -119,20 +145,20 @@ public:
     ExprNode *condition;
     std::vector<StatementNode *> block;
     WhileNode(ExprNode *condition, std::vector<StatementNode *> block);
-    virtual std::string emit(StackFrame *sf) override;
+    virtual void emit(MachineFunction &mf, StackFrame *sf) override;
     virtual bool containsFnCalls() override;
 };
 
 class BreakNode : public StatementNode {
 public:
     BreakNode();
-    virtual std::string emit(StackFrame *sf) override;
+    virtual void emit(MachineFunction &mf, StackFrame *sf) override;
 };
 
 class ContinueNode : public StatementNode {
 public:
     ContinueNode();
-    virtual std::string emit(StackFrame *sf) override;
+    virtual void emit(MachineFunction &mf, StackFrame *sf) override;
 };
 
 class FnCallNode {
@@ -162,14 +188,15 @@ public:
     StaticData *staticData;             // Static
     TypeNode *type;
 
-    ExprNode(LiteralNode *literal);
+    ExprNode(CompileState *cs, LiteralNode *literal);
     ExprNode(AccessorNode *accessor);
     ExprNode(FnCallNode *fnCall);
-    ExprNode(BuiltinOperator binaryOperator, ExprNode *opr1, ExprNode *opr2);
-    ExprNode(BuiltinOperator unaryOperator, ExprNode *opr);
-    ExprNode(std::vector<ExprNode *> *array);
+    ExprNode(CompileState *cs, BuiltinOperator binaryOperator,
+             ExprNode *opr1, ExprNode *opr2);
+    ExprNode(CompileState *cs, BuiltinOperator unaryOperator, ExprNode *opr);
+    ExprNode(CompileState *cs, std::vector<ExprNode *> *array);
     ExprNode(StaticData *staticData);
-    ExprNode();
+    ExprNode(CompileState *cs);
     bool containsFnCalls();
 };
 
@@ -181,6 +208,7 @@ public:
 
     LiteralNode(long i);
     LiteralNode(char c);
+    long value();
 };
 
 class AccessorNode {
@@ -188,11 +216,12 @@ public:
     enum AccessorKind {
         Identifier, Dereference
     } kind;
-    std::string identifier;  // Identifier
+    Symbol *identifier;      // Identifier
+    unsigned slot;           // Identifier
     ExprNode *expr;          // Dereference
     TypeNode *type;
 
-    AccessorNode(std::string identifier, TypeNode *type);
+    AccessorNode(Symbol *identifier, unsigned slot, TypeNode *type);
     AccessorNode(ExprNode *ptr);
 };
 
@@ -215,32 +244,7 @@ std::ostream &operator<<(std::ostream &os, ExprNode &node);
 std::ostream &operator<<(std::ostream &os, LiteralNode &node);
 std::ostream &operator<<(std::ostream &os, AccessorNode &node);
 
-/*
-  Register Conventions:
-    x0-x7    procedure arguments
-    x8       indirect return value address
-    x9-x15   caller-saved (local variables)
-    x16-x17  intra-procedure-call scratch register
-    x18      platform register (don't use)
-    x19-x28  callee-saved
-    x29      fp
-    x30      lr
-    x31      sp
-*/
-enum class Register {
-    x0 = 0, x1, x2, x3, x4, x5, x6, x7,
-    x8,
-    x9, x10, x11, x12, x13, x14, x15,
-    x16, ip0 = x16, x17, ip1 = x17,
-    x18, pr = x18,
-    x19, x20, x21, x22, x23, x24, x25, x26, x27, x28,
-    x29, fp = x29,
-    x30, lr = x30,
-    x31, sp = x31,
-};
-std::string toStr(Register res, std::string regPrefix = "x");
 std::string toStr(long l);
-std::ostream &operator<<(std::ostream &os, Register &reg);
 
 class StackFrame {
 public:
@@ -258,40 +262,151 @@ public:
         Reservation(TypeNode *type, Register reg);
         Reservation(TypeNode *type, long stackOffset);
         Reservation();
-        std::string emitCopyTo(Reservation other);
-        std::string emitPutValue(unsigned long val);
-        std::string emitFromExprNode(StackFrame *sf, ExprNode *expr);
+        void emitCopyTo(MachineFunction &mf, Reservation other);
+        void emitPutValue(MachineFunction &mf, unsigned long val);
+        void emitFromExprNode(MachineFunction &mf, StackFrame *sf, ExprNode *expr);
         bool operator==(const Reservation &other) const;
         bool operator!=(const Reservation &other) const;
     };
+    // The parts of an address, for [base], [base, #offset] or
+    // [base, index, LSL #shift]
+    struct Address {
+        Reservation base, index;
+        long offset = 0;
+        unsigned shift = 0;
+        unsigned numReserved = 0;  // Expression reservations it holds
+    };
     std::vector<Reservation> variableReservations;
     std::vector<Reservation> exprReservations;
-    std::unordered_map<std::string, Reservation> variables;
+    std::vector<Reservation> variables;  // Indexed by variable slot
+    // Register assigned to each variable slot, or RegisterAllocator::NoReg
+    std::vector<int> varRegs;
 
     CompileState *cs;
     FnDefNode *fnDef;
     std::vector<long> stackIncrementPadding;
     long stackPos = 0;
     long maxStackPos = 0;
-    std::vector<unsigned long> loopIds;
+    unsigned long numSpilledExprs = 0;
+    FnOutput *output;
+    unsigned returnLabel;
+    // Number of if/while statements in this function (for labeling)
+    unsigned long numIfs = 0;
+    unsigned long numWhiles = 0;
+    // Condition and exit labels of the enclosing while loops
+    std::vector<std::pair<unsigned, unsigned>> loopLabels;
 
-    StackFrame(CompileState *cs, FnDefNode *fnDef);
+    StackFrame(CompileState *cs, FnDefNode *fnDef, FnOutput *output);
     void incStackPos(long amt);
 
-    void addVariable(TypeNode *type, std::string identifier);
-    Reservation getVariable(std::string identifier);
+    void addVariable(TypeNode *type, unsigned slot);
+    Reservation getVariable(unsigned slot);
 
     Reservation reserveVariable(TypeNode *type);
     Reservation reserveExpr(TypeNode *type);
     void unreserveVariable();
     void unreserveExpr();
-    std::string emitBinaryOp(BuiltinOperator op, Reservation res,
-                             Reservation opr1, Reservation opr2);
-    std::string emitUnaryOp(BuiltinOperator op, Reservation res,
-                            Reservation opr);
-    std::string emitAddressOf(Reservation res, std::string identifier);
-    std::string emitSaveCaller();
-    std::string emitLoadCaller();
+    static bool isRelational(BuiltinOperator op, Condition &cond);
+    // The operator that gives the same result with its operands swapped
+    static bool reversed(BuiltinOperator op, BuiltinOperator &swapped);
+    // Whether imm can be the second operand of op without a register
+    static bool fitsImmediate(BuiltinOperator op, long imm);
+    // Whether op can take one of its operands as an immediate, which is then
+    // imm. A literal first operand is swapped to second place, reversing op
+    // (1 < x becomes x > 1).
+    static bool immediateOperand(BuiltinOperator &op, ExprNode *&opr1,
+                                 ExprNode *&opr2, long &imm);
+    // These only use the reservations given and the scratch registers x16
+    // and x17, so they serve the IR instruction selector too
+    static void emitBinaryOp(MachineFunction &mf, BuiltinOperator op,
+                             Reservation res, Reservation opr1,
+                             Reservation opr2);
+    static void emitBinaryOpImm(MachineFunction &mf, BuiltinOperator op,
+                                Reservation res, Reservation opr1, long imm);
+    static void emitUnaryOp(MachineFunction &mf, BuiltinOperator op,
+                            Reservation res, Reservation opr);
+    void emitAddressOf(MachineFunction &mf, Reservation res, unsigned slot);
+    // Branches to label if cond is nonzero (or zero, if branchIf is false),
+    // without materializing the condition as a boolean
+    void emitCondBranch(MachineFunction &mf, ExprNode *cond, bool branchIf,
+                        unsigned label);
+    bool inRegister(ExprNode *expr, Reservation &res);
+    // Evaluates the parts of the address addr, into base if it is valid
+    Address reserveAddress(MachineFunction &mf, ExprNode *addr,
+                           Reservation base);
+    static MOperand emitAddress(MachineFunction &mf, Address address);
+    void unreserveAddress(Address address);
+    void emitLoad(MachineFunction &mf, Reservation res, ExprNode *addr);
+    void emitStore(MachineFunction &mf, ExprNode *addr, ExprNode *value);
+    void emitSaveCaller(MachineFunction &mf);
+    void emitLoadCaller(MachineFunction &mf);
+};
+
+// Keeps a function's variables in the callee-saved registers x19-x28 where
+// it can, by linear scan over their live ranges. Calls preserve these
+// registers, so the variables don't need saving around calls; the function
+// saves the ones it uses in its prologue instead.
+//
+// Live ranges are numbered by statement, and a variable used inside a loop
+// is live for the whole loop. Only int and pointer variables qualify: char
+// variables stay on the stack, where stores truncate them, and so do
+// variables whose address is taken.
+class RegisterAllocator {
+public:
+    static const int NoReg = -1;
+
+    RegisterAllocator(FnDefNode *fnDef);
+    // Register of each variable slot, or NoReg for the stack
+    std::vector<int> allocate();
+
+private:
+    struct LiveRange {
+        unsigned slot;
+        unsigned start, end;  // Inclusive
+    };
+
+    FnDefNode *fnDef;
+    unsigned pos = 0;
+    // Indexed by slot
+    std::vector<LiveRange> ranges;
+    std::vector<TypeNode *> types;
+    std::vector<bool> addressTaken;
+    std::vector<std::vector<unsigned>> loops;  // Slots used by open loops
+
+    void define(unsigned slot, TypeNode *type);
+    void use(unsigned slot);
+    void visitBlock(std::vector<StatementNode *> &block);
+    void visitStatement(StatementNode *statement);
+    void visitFnCall(FnCallNode *fnCall);
+    void visitAccessor(AccessorNode *accessor);
+    void visitExpr(ExprNode *expr);
+};
+
+// Folds constant subexpressions into literals, including the size
+// multiplications of pointer arithmetic, and simplifies identities such as
+// x + 0, x * 1, x - x and -(-x). An if statement with a constant condition
+// is replaced by the branch taken, and a while loop that never runs is
+// removed.
+//
+// Runs on each function as it is parsed, since folding allocates from the
+// arena, which code generation mustn't touch.
+class ConstantFolder {
+public:
+    ConstantFolder(CompileState *cs);
+    void foldBlock(std::vector<StatementNode *> &block);
+
+private:
+    CompileState *cs;
+    TypeNode *intType;
+
+    void foldStatement(StatementNode *statement,
+                       std::vector<StatementNode *> &out);
+    void foldFnCall(FnCallNode *fnCall);
+    void foldAccessor(AccessorNode *accessor);
+    ExprNode *fold(ExprNode *expr);
+    ExprNode *foldBinaryOp(ExprNode *expr);
+    ExprNode *foldUnaryOp(ExprNode *expr);
+    ExprNode *literal(ExprNode *expr, long value);
 };
 
 class StaticData {
@@ -302,40 +417,82 @@ public:
     std::string string;  // String
     unsigned long id;
     TypeNode *ptrType;
+    std::string labelName;
 
-    StaticData(unsigned long id, std::string string);
+    StaticData(CompileState *cs, unsigned long id, std::string string);
     StaticData();
-    std::string label();
-    void emit(CompileState &cs);
+    void setOwner(const std::string &fnName);
+    const std::string &label();
+    void emit(AsmWriter &out, unsigned indent);
 
 private:
     unsigned p2alignment();
 };
 
+// Interned identifier. Each distinct name has exactly one Symbol, which also
+// records the name's binding in the function currently being parsed.
+struct Symbol {
+    std::string name;
+    unsigned long scope = 0;  // Function the slot below belongs to
+    unsigned slot = 0;
+
+    Symbol(std::string name);
+};
+
+class SymbolTable {
+public:
+    SymbolTable(Arena &arena);
+    Symbol *intern(StringView name);
+
+private:
+    Arena &arena;
+    // Keys view the Symbol's own name, so lookups never copy the token text
+    std::unordered_map<StringView, Symbol *, StringViewHash> symbols;
+};
+
+class TypeTable {
+public:
+    TypeTable(Arena &arena);
+    TypeNode *get(BuiltinType builtinType);
+    TypeNode *get(LiteralType literalType);
+    TypeNode *get(std::string customType);
+    TypeNode *pointerTo(TypeNode *type);
+
+private:
+    Arena &arena;
+    TypeNode *voidType, *intType, *charType;
+    std::unordered_map<std::string, TypeNode *> customTypes;
+};
+
 class CompileState {
 public:
-    std::ostream &os;
-    unsigned indent = 8;
-    CompileState(std::ostream &os);
+    // Owns every node, type and parser temporary of this compilation.
+    // Declared first so that it is released last.
+    Arena arena;
 
-    // Stack frames
-    std::vector<StackFrame> frames;
-    void pushFrame(FnDefNode *fnDef);
-    StackFrame *getTopFrame();
-    void popFrame();
+    // Canonical types and identifiers
+    TypeTable types;
+    SymbolTable symbols;
 
-    // Static data
+    unsigned indent = 8;
+    unsigned peepholes = PeepholeOptimizer::AllPatterns;
+    unsigned optLevel = 1;  // -O<n>; 0 turns off constant folding and the IR
+    bool verifyIR = false;  // Check the IR after every pass
+    bool printIR = false;   // Keep each function's final IR in its FnOutput
+    TimeTrace *trace = nullptr;  // Shared by all files; null unless timing
+    CompileState();
+
+    // Static data of the function being parsed
     std::vector<StaticData *> staticData;
     StaticData *addStaticData(std::string string);
-    StaticData *getStaticData(unsigned long id);
-
-    // Keep track of which builtins to insert
-    std::unordered_set<BuiltinFn> usedBuiltinFns;
 
-    // Variable types
-    std::unordered_map<std::string, TypeNode *> *varTypes;
-    TypeNode *getVarType(std::string identifier);
-    void setVarType(std::string identifier, TypeNode *type);
+    // Variables of the function being parsed, indexed by slot
+    std::vector<TypeNode *> varTypes;
+    unsigned long varScope = 1;
+    unsigned declareVar(Symbol *identifier, TypeNode *type);
+    unsigned getVarSlot(Symbol *identifier);
+    TypeNode *getVarType(unsigned slot);
+    void clearVars();
 
     // Function declarations/definitions
     std::unordered_map<std::string, FnDeclNode *> fnDecls;
@@ -343,8 +500,17 @@ public:
     FnDeclNode *getFnDecl(std::string identifier);
     void addFnDecl(FnDeclNode *fnDecl);
     void addFnDef(FnDefNode *fnDef);
+    // Calls to each function in the file, for the inliner
+    std::unordered_map<std::string, unsigned> numCalls;
+};
 
-    // Number of if/while statements (for labeling)
-    unsigned long numIfs = 0;
-    unsigned long numWhiles = 0;
+// Everything generated for one function. Functions only read the shared
+// CompileState while generating code, so they can be generated concurrently
+// and merged in source order afterwards.
+struct FnOutput {
+    AsmWriter out{4 * 1024};
+    AsmWriter data{1024};  // Emitted after all functions and builtins
+    std::set<BuiltinFn> usedBuiltinFns;
+    FnStats stats;
+    std::string ir;  // With -print-ir; not cached
 };
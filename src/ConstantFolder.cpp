@@ -0,0 +1,283 @@
+#include <vector>
+#include "ast/ast.hpp"
+#include "CompileState.hpp"
+
+ConstantFolder::ConstantFolder(CompileState *cs)
+        : cs(cs),
+          intType(cs->types.get(BuiltinType::Int)) {}
+
+void ConstantFolder::foldBlock(std::vector<StatementNode *> &block) {
+    std::vector<StatementNode *> folded;
+    for (StatementNode *statement : block) {
+        foldStatement(statement, folded);
+    }
+    block = std::move(folded);
+}
+
+/* SECTION: Helpers */
+
+static bool isConst(ExprNode *expr, long &value) {
+    if (expr->kind != ExprNode::Literal) { return false; }
+    value = expr->literal->value();
+    return true;
+}
+
+static bool hasValue(ExprNode *expr, long value) {
+    long exprValue;
+    return isConst(expr, exprValue) && exprValue == value;
+}
+
+// Whether evaluating expr has no effect besides its value
+static bool isPure(ExprNode *expr) {
+    switch (expr->kind) {
+        case ExprNode::Literal:
+        case ExprNode::Static:
+            return true;
+        case ExprNode::Accessor:
+            return expr->accessor->kind == AccessorNode::Identifier
+                || isPure(expr->accessor->expr);
+        case ExprNode::BinaryOp:
+            return isPure(expr->opr1) && isPure(expr->opr2);
+        case ExprNode::UnaryOp:
+            return isPure(expr->opr);
+        default:
+            return false;
+    }
+}
+
+// Whether two pure expressions always have the same value
+static bool sameValue(ExprNode *a, ExprNode *b) {
+    if (a->kind != b->kind || a->type != b->type || !isPure(a)) {
+        return false;
+    }
+    switch (a->kind) {
+        case ExprNode::Literal:
+            return a->literal->value() == b->literal->value();
+        case ExprNode::Accessor:
+            if (a->accessor->kind != b->accessor->kind) { return false; }
+            if (a->accessor->kind == AccessorNode::Identifier) {
+                return a->accessor->slot == b->accessor->slot;
+            }
+            return sameValue(a->accessor->expr, b->accessor->expr);
+        case ExprNode::BinaryOp:
+            return a->builtinOperator == b->builtinOperator
+                && sameValue(a->opr1, b->opr1)
+                && sameValue(a->opr2, b->opr2);
+        case ExprNode::UnaryOp:
+            return a->builtinOperator == b->builtinOperator
+                && sameValue(a->opr, b->opr);
+        default:
+            return false;
+    }
+}
+
+// Computes like the generated code would, in 64 bits
+static bool evalBinaryOp(BuiltinOperator op, long a, long b, long &result) {
+    const unsigned long ua = a, ub = b;
+    switch (op) {
+        case BuiltinOperator::Plus: result = ua + ub; return true;
+        case BuiltinOperator::Minus: result = ua - ub; return true;
+        case BuiltinOperator::Star: result = ua * ub; return true;
+        case BuiltinOperator::Fslash:
+            // sdiv gives 0 for division by zero, and wraps on overflow
+            if (b == 0) { result = 0; }
+            else if (b == -1) { result = -ua; }
+            else { result = a / b; }
+            return true;
+        case BuiltinOperator::Percent:
+            // a - (a / b) * b, with the quotient as above
+            if (b == 0) { result = a; }
+            else if (b == -1) { result = 0; }
+            else { result = a % b; }
+            return true;
+        case BuiltinOperator::Eq: result = a == b; return true;
+        case BuiltinOperator::Ne: result = a != b; return true;
+        case BuiltinOperator::Lt: result = a < b; return true;
+        case BuiltinOperator::Gt: result = a > b; return true;
+        case BuiltinOperator::Le: result = a <= b; return true;
+        case BuiltinOperator::Ge: result = a >= b; return true;
+        case BuiltinOperator::BitAnd: result = ua & ub; return true;
+        case BuiltinOperator::BitOr: result = ua | ub; return true;
+        case BuiltinOperator::BitXor: result = ua ^ ub; return true;
+        default: return false;
+    }
+}
+
+static bool evalUnaryOp(BuiltinOperator op, long a, long &result) {
+    switch (op) {
+        case BuiltinOperator::Minus: result = -(unsigned long)a; return true;
+        case BuiltinOperator::Not: result = a == 0; return true;
+        case BuiltinOperator::BitNot: result = ~a; return true;
+        default: return false;
+    }
+}
+
+/* SECTION: Statements */
+
+void ConstantFolder::foldStatement(StatementNode *statement,
+                                   std::vector<StatementNode *> &out) {
+    switch (statement->kind) {
+        case StatementNode::Initialization:
+        case StatementNode::Return:
+            statement->expr = fold(statement->expr);
+            break;
+        case StatementNode::Assignment:
+            foldAccessor(statement->accessor);
+            statement->expr = fold(statement->expr);
+            break;
+        case StatementNode::FnCall:
+            foldFnCall(statement->fnCall);
+            break;
+        case StatementNode::If: {
+            IfNode *ifNode = static_cast<IfNode *>(statement);
+            ifNode->condition = fold(ifNode->condition);
+            foldBlock(ifNode->block);
+            foldBlock(ifNode->elseBlock);
+
+            // Variables are resolved to slots already, so the branch taken
+            // can join the enclosing block
+            long value;
+            if (isConst(ifNode->condition, value)) {
+                std::vector<StatementNode *> &taken =
+                    value != 0 ? ifNode->block : ifNode->elseBlock;
+                out.insert(out.end(), taken.begin(), taken.end());
+                return;
+            }
+            break;
+        }
+        case StatementNode::While: {
+            WhileNode *whileNode = static_cast<WhileNode *>(statement);
+            whileNode->condition = fold(whileNode->condition);
+            if (hasValue(whileNode->condition, 0)) { return; }
+            foldBlock(whileNode->block);
+            break;
+        }
+        case StatementNode::Declaration:
+        case StatementNode::Break:
+        case StatementNode::Continue:
+            break;
+    }
+    out.push_back(statement);
+}
+
+void ConstantFolder::foldFnCall(FnCallNode *fnCall) {
+    for (ExprNode *&arg : fnCall->argList) {
+        arg = fold(arg);
+    }
+}
+
+void ConstantFolder::foldAccessor(AccessorNode *accessor) {
+    if (accessor->kind == AccessorNode::Dereference) {
+        accessor->expr = fold(accessor->expr);
+    }
+}
+
+/* SECTION: Expressions */
+
+// Nodes are never changed in a way that would alter their value, only
+// replaced, so a subtree is safe to fold even if it were shared
+ExprNode *ConstantFolder::fold(ExprNode *expr) {
+    switch (expr->kind) {
+        case ExprNode::Accessor:
+            foldAccessor(expr->accessor);
+            return expr;
+        case ExprNode::FnCall:
+            foldFnCall(expr->fnCall);
+            return expr;
+        case ExprNode::BinaryOp:
+            expr->opr1 = fold(expr->opr1);
+            expr->opr2 = fold(expr->opr2);
+            return foldBinaryOp(expr);
+        case ExprNode::UnaryOp:
+            // The operand of & must stay a variable
+            if (expr->builtinOperator != BuiltinOperator::BitAnd) {
+                expr->opr = fold(expr->opr);
+            }
+            return foldUnaryOp(expr);
+        case ExprNode::Array:
+            for (ExprNode *&elem : *expr->array) {
+                elem = fold(elem);
+            }
+            return expr;
+        default:
+            return expr;
+    }
+}
+
+ExprNode *ConstantFolder::foldBinaryOp(ExprNode *expr) {
+    const BuiltinOperator op = expr->builtinOperator;
+    ExprNode *opr1 = expr->opr1, *opr2 = expr->opr2;
+
+    long a, b, result;
+    if (isConst(opr1, a) && isConst(opr2, b)
+            && evalBinaryOp(op, a, b, result)) {
+        return literal(expr, result);
+    }
+
+    // Identities, which may only drop operands that have no effects. Types
+    // must match, as the operand's type replaces the expression's.
+    switch (op) {
+        case BuiltinOperator::Plus:
+            if (hasValue(opr2, 0) && opr1->type == expr->type) { return opr1; }
+            if (hasValue(opr1, 0) && opr2->type == expr->type) { return opr2; }
+            break;
+        case BuiltinOperator::Minus:
+            if (hasValue(opr2, 0) && opr1->type == expr->type) { return opr1; }
+            if (sameValue(opr1, opr2)) { return literal(expr, 0); }
+            break;
+        case BuiltinOperator::Star:
+            if (hasValue(opr2, 1) && opr1->type == expr->type) { return opr1; }
+            if (hasValue(opr1, 1) && opr2->type == expr->type) { return opr2; }
+            if ((hasValue(opr2, 0) && isPure(opr1))
+                    || (hasValue(opr1, 0) && isPure(opr2))) {
+                return literal(expr, 0);
+            }
+            break;
+        case BuiltinOperator::Fslash:
+            if (hasValue(opr2, 1) && opr1->type == expr->type) { return opr1; }
+            break;
+        case BuiltinOperator::Percent:
+            if ((hasValue(opr2, 1) || hasValue(opr2, -1)) && isPure(opr1)) {
+                return literal(expr, 0);
+            }
+            break;
+        default:
+            break;
+    }
+    return expr;
+}
+
+ExprNode *ConstantFolder::foldUnaryOp(ExprNode *expr) {
+    const BuiltinOperator op = expr->builtinOperator;
+    ExprNode *opr = expr->opr;
+
+    long a, result;
+    if (isConst(opr, a) && evalUnaryOp(op, a, result)) {
+        return literal(expr, result);
+    }
+
+    // -(-x) and ~(~x), but not !(!x), which makes x 0 or 1
+    if ((op == BuiltinOperator::Minus || op == BuiltinOperator::BitNot)
+            && opr->kind == ExprNode::UnaryOp
+            && opr->builtinOperator == op
+            && opr->opr->type == expr->type) {
+        return opr->opr;
+    }
+    return expr;
+}
+
+// A literal replacing expr, or expr itself if the value doesn't fit its type
+ExprNode *ConstantFolder::literal(ExprNode *expr, long value) {
+    if (expr->type == intType) {
+        return cs->arena.create<ExprNode>(
+            cs, cs->arena.create<LiteralNode>(value));
+    }
+    // Char arithmetic is only truncated when stored, and char literals are
+    // sign-extended on some hosts, so only 0-127 is the same either way
+    if (expr->type == cs->types.get(BuiltinType::Char)
+            && value >= 0 && value <= 127) {
+        return cs->arena.create<ExprNode>(
+            cs, cs->arena.create<LiteralNode>((char)value));
+    }
+    return expr;
+}
@@ -0,0 +1,432 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "ast/ast.hpp"
+#include "CompileState.hpp"
+#include "FnCache.hpp"
+#include "ir/ir.hpp"
+#include "util.hpp"
+
+#ifndef QCC_VERSION
+#define QCC_VERSION "unknown"
+#endif
+
+// Bump when the entry layout or the key encoding changes
+static const char *CACHE_FORMAT = "QCCCACHE3";
+// Bump when the code generated for a function changes, so that entries from
+// older compilers miss
+static const int CODEGEN_REVISION = 12;
+
+/* SECTION: Keys */
+
+static void putNum(std::string &key, long n) {
+    key += std::to_string(n);
+    key += ',';
+}
+
+static void putStr(std::string &key, const std::string &str) {
+    putNum(key, str.size());
+    key += str;
+}
+
+static void putType(std::string &key, TypeNode *type) {
+    switch (type->kind) {
+        case TypeNode::Builtin:
+            key += 'b';
+            putNum(key, (long)type->builtinType);
+            break;
+        case TypeNode::Custom:
+            key += 'c';
+            putStr(key, type->customType);
+            break;
+        case TypeNode::Pointer:
+            key += '*';
+            putType(key, type->pointerType);
+            break;
+    }
+}
+
+static void putExpr(std::string &key, ExprNode *expr);
+
+static void putFnCall(std::string &key, FnCallNode *fnCall) {
+    putStr(key, fnCall->identifier);
+    // The callee's signature decides how arguments and results are moved
+    if (fnCall->fnDecl) {
+        putType(key, fnCall->fnDecl->returnType);
+        putNum(key, fnCall->fnDecl->paramList.size());
+        for (ParamNode *param : fnCall->fnDecl->paramList) {
+            putType(key, param->type);
+        }
+    }
+    putNum(key, fnCall->argList.size());
+    for (ExprNode *arg : fnCall->argList) {
+        putExpr(key, arg);
+    }
+}
+
+static void putAccessor(std::string &key, AccessorNode *accessor) {
+    putNum(key, accessor->kind);
+    putType(key, accessor->type);
+    switch (accessor->kind) {
+        case AccessorNode::Identifier:
+            putNum(key, accessor->slot);
+            break;
+        case AccessorNode::Dereference:
+            putExpr(key, accessor->expr);
+            break;
+    }
+}
+
+static void putExpr(std::string &key, ExprNode *expr) {
+    key += 'e';
+    putNum(key, expr->kind);
+    putType(key, expr->type);
+    switch (expr->kind) {
+        case ExprNode::Literal:
+            putNum(key, (long)expr->literal->type);
+            putNum(key, expr->literal->type == LiteralType::Int
+                        ? expr->literal->i : expr->literal->c);
+            break;
+        case ExprNode::Accessor:
+            putAccessor(key, expr->accessor);
+            break;
+        case ExprNode::FnCall:
+            putFnCall(key, expr->fnCall);
+            break;
+        case ExprNode::BinaryOp:
+            putNum(key, (long)expr->builtinOperator);
+            putExpr(key, expr->opr1);
+            putExpr(key, expr->opr2);
+            break;
+        case ExprNode::UnaryOp:
+            putNum(key, (long)expr->builtinOperator);
+            putExpr(key, expr->opr);
+            break;
+        case ExprNode::Array:
+            putNum(key, expr->array->size());
+            for (ExprNode *elem : *expr->array) {
+                putExpr(key, elem);
+            }
+            break;
+        case ExprNode::Static:
+            putStr(key, expr->staticData->label());
+            break;
+        case ExprNode::Empty:
+            break;
+    }
+}
+
+static void putBlock(std::string &key, std::vector<StatementNode *> &block);
+
+static void putStatement(std::string &key, StatementNode *statement) {
+    key += 's';
+    putNum(key, statement->kind);
+    switch (statement->kind) {
+        case StatementNode::Declaration:
+            putType(key, statement->type);
+            putNum(key, statement->slot);
+            break;
+        case StatementNode::Initialization:
+            putType(key, statement->type);
+            putNum(key, statement->slot);
+            putExpr(key, statement->expr);
+            break;
+        case StatementNode::Assignment:
+            putAccessor(key, statement->accessor);
+            putExpr(key, statement->expr);
+            break;
+        case StatementNode::Return:
+            putExpr(key, statement->expr);
+            break;
+        case StatementNode::FnCall:
+            putFnCall(key, statement->fnCall);
+            break;
+        case StatementNode::If: {
+            IfNode *ifNode = static_cast<IfNode *>(statement);
+            putExpr(key, ifNode->condition);
+            putBlock(key, ifNode->block);
+            putBlock(key, ifNode->elseBlock);
+            break;
+        }
+        case StatementNode::While: {
+            WhileNode *whileNode = static_cast<WhileNode *>(statement);
+            putExpr(key, whileNode->condition);
+            putBlock(key, whileNode->block);
+            break;
+        }
+        case StatementNode::Break:
+        case StatementNode::Continue:
+            break;
+    }
+}
+
+static void putBlock(std::string &key, std::vector<StatementNode *> &block) {
+    putNum(key, block.size());
+    for (StatementNode *statement : block) {
+        putStatement(key, statement);
+    }
+}
+
+std::string FnCache::key(FnDefNode *fnDef, CompileState &cs) {
+    std::string key;
+    putStr(key, CACHE_FORMAT);
+    putStr(key, QCC_VERSION);
+    putNum(key, CODEGEN_REVISION);
+    putNum(key, cs.indent);
+    putNum(key, cs.peepholes);
+    putNum(key, cs.optLevel);
+
+    putStr(key, fnDef->identifier);
+    putType(key, fnDef->returnType);
+    putNum(key, fnDef->paramList.size());
+    for (ParamNode *param : fnDef->paramList) {
+        putType(key, param->type);
+        putNum(key, param->slot);
+    }
+    putNum(key, fnDef->numVars);
+
+    putNum(key, fnDef->staticData.size());
+    for (StaticData *data : fnDef->staticData) {
+        putStr(key, data->label());
+        putStr(key, data->string);
+    }
+
+    putBlock(key, fnDef->block);
+
+    // The bodies of the functions its calls may inline
+    if (cs.optLevel >= 1) {
+        std::vector<FnDefNode *> callees;
+        IRBuilder::inlineCandidates(&cs, fnDef, callees);
+        putNum(key, callees.size());
+        for (FnDefNode *callee : callees) {
+            putStr(key, callee->identifier);
+            putType(key, callee->returnType);
+            putNum(key, callee->paramList.size());
+            for (ParamNode *param : callee->paramList) {
+                putType(key, param->type);
+                putNum(key, param->slot);
+            }
+            putNum(key, callee->numVars);
+            putNum(key, callee->staticData.size());
+            for (StaticData *data : callee->staticData) {
+                putStr(key, data->label());
+            }
+            putBlock(key, callee->block);
+        }
+    }
+    return key;
+}
+
+/* SECTION: Entries */
+
+/*
+  Entry layout:
+    QCCCACHE3\n
+    <key size> <asm size> <data size> <stats> <number of builtins>
+        <builtin> ...\n
+    <key><asm><data>
+
+  where <stats> are the FnStats counters except the name, in declaration
+  order, with the rewrites of each peephole pattern last.
+*/
+
+FnCache::FnCache(std::string dir, std::uint64_t maxBytes)
+        : dir(dir),
+          maxBytes(maxBytes) {
+    if (::mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+        std::cerr << "ERROR: Couldn't create cache directory " << dir
+                  << ": " << strerror(errno) << '\n';
+        exit(EXIT_FAILURE);
+    }
+}
+
+std::string FnCache::pathFor(const std::string &key) {
+    char name[17];
+    std::snprintf(name, sizeof(name), "%016llx",
+                  (unsigned long long)StringViewHash()(key));
+    return dir + "/" + name;
+}
+
+bool FnCache::lookup(const std::string &key, FnOutput &output) {
+    const std::string path = pathFor(key);
+    SourceBuffer entry;
+    if (!entry.open(path)) {
+        misses++;
+        return false;
+    }
+
+    const char *pos = entry.data();
+    const char *end = entry.data() + entry.size() - 2;
+    const std::size_t formatLength = std::strlen(CACHE_FORMAT);
+    if ((std::size_t)(end - pos) <= formatLength
+            || std::memcmp(pos, CACHE_FORMAT, formatLength) != 0) {
+        misses++;
+        return false;
+    }
+    pos += formatLength;
+
+    // The buffer is NUL-terminated, so strtoul can't run off the end
+    char *next;
+    std::size_t keySize = std::strtoul(pos, &next, 10);
+    std::size_t asmSize = std::strtoul(next, &next, 10);
+    std::size_t dataSize = std::strtoul(next, &next, 10);
+    FnStats stats;
+    unsigned long *counters[] = {
+        &stats.instrs, &stats.stackLoads, &stats.stackStores, &stats.pairs,
+        &stats.frameSize, &stats.spills,
+    };
+    for (unsigned long *counter : counters) {
+        *counter = std::strtoul(next, &next, 10);
+    }
+    for (unsigned long &counter : stats.rewrites) {
+        counter = std::strtoul(next, &next, 10);
+    }
+    std::size_t numBuiltins = std::strtoul(next, &next, 10);
+    std::vector<BuiltinFn> builtins;
+    for (std::size_t i = 0; i < numBuiltins; i++) {
+        builtins.push_back((BuiltinFn)std::strtoul(next, &next, 10));
+    }
+    while (*next == ' ') { next++; }
+    if (next >= end || *next != '\n') {
+        misses++;
+        return false;
+    }
+    pos = next + 1;
+
+    if ((std::size_t)(end - pos) != keySize + asmSize + dataSize
+            || key.compare(0, key.size(), pos, keySize) != 0) {
+        misses++;
+        return false;
+    }
+    pos += keySize;
+    output.out.write(pos, asmSize);
+    pos += asmSize;
+    output.data.write(pos, dataSize);
+    output.usedBuiltinFns.insert(builtins.begin(), builtins.end());
+    stats.name = output.stats.name;
+    output.stats = stats;
+
+    // Refresh the mtime, which evict() treats as the last use
+    ::utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+    hits++;
+    return true;
+}
+
+void FnCache::store(const std::string &key, const FnOutput &output) {
+    const std::string path = pathFor(key);
+    const std::string asmText = output.out.str();
+    const std::string dataText = output.data.str();
+
+    std::string header = CACHE_FORMAT;
+    header += '\n' + std::to_string(key.size())
+            + ' ' + std::to_string(asmText.size())
+            + ' ' + std::to_string(dataText.size());
+    const FnStats &stats = output.stats;
+    for (unsigned long counter : {stats.instrs, stats.stackLoads,
+                                  stats.stackStores, stats.pairs,
+                                  stats.frameSize, stats.spills}) {
+        header += ' ' + std::to_string(counter);
+    }
+    for (unsigned long counter : stats.rewrites) {
+        header += ' ' + std::to_string(counter);
+    }
+    header += ' ' + std::to_string(output.usedBuiltinFns.size());
+    for (BuiltinFn builtin : output.usedBuiltinFns) {
+        header += ' ' + std::to_string((int)builtin);
+    }
+    header += '\n';
+
+    // Written to a private file and renamed into place, so concurrent
+    // compilers never see a partial entry
+    const std::string tmpPath = path + ".tmp." + std::to_string(::getpid())
+                                + "." + std::to_string(tmpCounter++);
+    int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) { return; }
+
+    bool ok = true;
+    const std::string *parts[] = {&header, &key, &asmText, &dataText};
+    for (const std::string *part : parts) {
+        const char *data = part->data();
+        std::size_t left = part->size();
+        while (ok && left > 0) {
+            ssize_t written = ::write(fd, data, left);
+            if (written < 0 && errno == EINTR) { continue; }
+            ok = written > 0;
+            if (ok) {
+                data += written;
+                left -= written;
+            }
+        }
+    }
+    ok = ::close(fd) == 0 && ok;
+
+    if (!ok || ::rename(tmpPath.c_str(), path.c_str()) != 0) {
+        ::unlink(tmpPath.c_str());
+    }
+}
+
+/* SECTION: Eviction */
+
+void FnCache::evict() {
+    struct Entry {
+        std::string path;
+        std::uint64_t size;
+        std::time_t mtime;
+    };
+    std::vector<Entry> entries;
+
+    DIR *d = ::opendir(dir.c_str());
+    if (!d) { return; }
+    while (struct dirent *dirent = ::readdir(d)) {
+        // Skips ".", ".." and leftover temporary files
+        if (std::strchr(dirent->d_name, '.')) { continue; }
+
+        std::string path = dir + "/" + dirent->d_name;
+        struct stat st;
+        if (::stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+        entries.push_back({path, (std::uint64_t)st.st_size, st.st_mtime});
+    }
+    ::closedir(d);
+
+    totalBytes = 0;
+    for (Entry &entry : entries) {
+        totalBytes += entry.size;
+    }
+
+    // Least recently used first
+    std::sort(entries.begin(), entries.end(),
+              [](const Entry &a, const Entry &b) {
+        return a.mtime < b.mtime;
+    });
+
+    numEntries = entries.size();
+    for (Entry &entry : entries) {
+        if (totalBytes <= maxBytes) { break; }
+        if (::unlink(entry.path.c_str()) == 0) {
+            totalBytes -= entry.size;
+            numEntries--;
+            evictions++;
+        }
+    }
+}
+
+void FnCache::printStats(std::ostream &os) {
+    unsigned long lookups = hits + misses;
+    os << "Cache: " << hits << " hits, " << misses << " misses";
+    if (lookups > 0) {
+        os << " (" << hits * 100 / lookups << "% hit rate)";
+    }
+    os << ", " << evictions << " evicted, " << numEntries << " entries, "
+       << totalBytes << " bytes\n";
+}
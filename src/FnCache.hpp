@@ -0,0 +1,46 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include "CompileState.hpp"
+
+/*
+  Content-addressed on-disk cache of generated functions, so that a rebuild
+  only regenerates the functions that changed.
+
+  The key is a normalized description of everything a function's code
+  depends on: its AST (with variables reduced to slots), the signatures of
+  the functions it calls, the bodies of those it may inline, the code
+  generation options and the compiler version. The value is the function's FnOutput. Entries are stored under a
+  hash of the key together with the full key, so hash collisions are
+  detected rather than replayed. Hits refresh an entry's mtime, and evict()
+  removes the least recently used entries once the cache outgrows its size
+  bound. Lookups and stores are safe to call from several threads.
+*/
+class FnCache {
+public:
+    FnCache(std::string dir, std::uint64_t maxBytes);
+
+    static std::string key(FnDefNode *fnDef, CompileState &cs);
+
+    bool lookup(const std::string &key, FnOutput &output);
+    void store(const std::string &key, const FnOutput &output);
+    void evict();
+
+    void printStats(std::ostream &os);
+
+private:
+    std::string dir;
+    std::uint64_t maxBytes;
+
+    std::atomic<unsigned long> hits{0};
+    std::atomic<unsigned long> misses{0};
+    std::atomic<unsigned long> evictions{0};
+    std::atomic<unsigned long> tmpCounter{0};
+    std::uint64_t totalBytes = 0;
+    unsigned long numEntries = 0;
+
+    std::string pathFor(const std::string &key);
+};
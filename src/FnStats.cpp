@@ -0,0 +1,122 @@
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "FnStats.hpp"
+#include "util.hpp"
+
+static bool isStackAccess(const MachineInstr &instr) {
+    for (unsigned i = 0; i < instr.numOperands; i++) {
+        const MOperand &op = instr.operands[i];
+        if (op.kind == MOperand::Mem) {
+            return op.reg == Register::sp || op.reg == Register::fp;
+        }
+    }
+    return false;
+}
+
+void FnStats::collect(const MachineFunction &mf) {
+    name = *mf.name;
+    for (const MachineBasicBlock &block : mf.blocks) {
+        instrs += block.instrs.size();
+        for (const MachineInstr &instr : block.instrs) {
+            switch (instr.opcode) {
+                case Opcode::Ldr:
+                case Opcode::Ldrb:
+                    stackLoads += isStackAccess(instr);
+                    break;
+                case Opcode::Str:
+                case Opcode::Strb:
+                    stackStores += isStackAccess(instr);
+                    break;
+                case Opcode::Ldp:
+                case Opcode::Stp:
+                    pairs++;
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+}
+
+void printStats(std::ostream &os, const std::vector<const FnStats *> &stats) {
+    // Largest functions first, as they are the ones worth looking at
+    std::vector<const FnStats *> sorted = stats;
+    std::stable_sort(sorted.begin(), sorted.end(),
+                     [](const FnStats *a, const FnStats *b) {
+        return a->instrs > b->instrs;
+    });
+
+    FnStats total;
+    total.name = "Total";
+    for (const FnStats *fnStats : sorted) {
+        total.instrs += fnStats->instrs;
+        total.stackLoads += fnStats->stackLoads;
+        total.stackStores += fnStats->stackStores;
+        total.pairs += fnStats->pairs;
+        total.frameSize += fnStats->frameSize;
+        total.spills += fnStats->spills;
+    }
+    sorted.push_back(&total);
+
+    char line[128];
+    os << "===== qcc function stats =====\n";
+    std::snprintf(line, sizeof(line), "%8s %7s %7s %7s %7s %7s  %s\n",
+                  "Instrs", "Loads", "Stores", "Pairs", "Frame", "Spills",
+                  "Function");
+    os << line;
+    for (const FnStats *fnStats : sorted) {
+        std::snprintf(line, sizeof(line),
+                      "%8lu %7lu %7lu %7lu %7lu %7lu  ",
+                      fnStats->instrs, fnStats->stackLoads,
+                      fnStats->stackStores, fnStats->pairs,
+                      fnStats->frameSize, fnStats->spills);
+        os << line << fnStats->name << '\n';
+    }
+}
+
+void printPeepholeStats(std::ostream &os,
+                        const std::vector<const FnStats *> &stats) {
+    char line[128];
+    os << "===== qcc peephole report =====\n";
+    std::snprintf(line, sizeof(line), "%10s  %s\n", "Rewrites", "Pattern");
+    os << line;
+    for (int i = 0; i < PeepholeOptimizer::NumPatterns; i++) {
+        unsigned long total = 0;
+        for (const FnStats *fnStats : stats) {
+            total += fnStats->rewrites[i];
+        }
+        std::snprintf(line, sizeof(line), "%10lu  %s\n", total,
+                      PeepholeOptimizer::patternName(
+                          (PeepholeOptimizer::Pattern)i));
+        os << line;
+    }
+}
+
+bool writeStatsJson(const char *path,
+                    const std::vector<const FnStats *> &stats) {
+    // Identifiers never need escaping
+    AsmWriter out;
+    out << "{\"functions\":[\n";
+    for (std::size_t i = 0; i < stats.size(); i++) {
+        const FnStats *fnStats = stats[i];
+        out << "{\"name\":\"" << fnStats->name
+            << "\",\"instrs\":" << fnStats->instrs
+            << ",\"stackLoads\":" << fnStats->stackLoads
+            << ",\"stackStores\":" << fnStats->stackStores
+            << ",\"pairs\":" << fnStats->pairs
+            << ",\"frameSize\":" << fnStats->frameSize
+            << ",\"spills\":" << fnStats->spills
+            << ",\"peephole\":{";
+        for (int j = 0; j < PeepholeOptimizer::NumPatterns; j++) {
+            out << (j > 0 ? ",\"" : "\"")
+                << PeepholeOptimizer::patternName(
+                       (PeepholeOptimizer::Pattern)j)
+                << "\":" << fnStats->rewrites[j];
+        }
+        out << (i + 1 < stats.size() ? "}},\n" : "}}\n");
+    }
+    out << "]}\n";
+    return out.writeToFile(path);
+}
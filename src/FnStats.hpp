@@ -0,0 +1,32 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include "mir/mir.hpp"
+
+/*
+  Code quality figures for one generated function, for -stats and
+  -stats-json. Counted from the final machine code, so they reflect every
+  pass that ran. They are small and cheap to collect, so every function
+  collects them and the cache stores them with the code.
+*/
+struct FnStats {
+    std::string name;
+    unsigned long instrs = 0;
+    unsigned long stackLoads = 0;   // ldr/ldrb from [sp]/[fp]
+    unsigned long stackStores = 0;  // str/strb to [sp]/[fp]
+    unsigned long pairs = 0;        // ldp/stp, mostly caller-saved registers
+    unsigned long frameSize = 0;    // Bytes of locals and spills
+    unsigned long spills = 0;       // Expression temporaries on the stack
+    // Rewrites by each peephole pattern
+    unsigned long rewrites[PeepholeOptimizer::NumPatterns] = {};
+
+    void collect(const MachineFunction &mf);
+};
+
+void printStats(std::ostream &os, const std::vector<const FnStats *> &stats);
+void printPeepholeStats(std::ostream &os,
+                        const std::vector<const FnStats *> &stats);
+bool writeStatsJson(const char *path,
+                    const std::vector<const FnStats *> &stats);
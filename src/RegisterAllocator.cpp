@@ -0,0 +1,196 @@
+#include <algorithm>
+#include <set>
+#include <vector>
+#include "ast/ast.hpp"
+#include "CompileState.hpp"
+
+static const Register FIRST_CALLEE_SAVED = Register::x19;
+static const Register LAST_CALLEE_SAVED = Register::x28;
+
+RegisterAllocator::RegisterAllocator(FnDefNode *fnDef)
+        : fnDef(fnDef),
+          ranges(fnDef->numVars),
+          types(fnDef->numVars),
+          addressTaken(fnDef->numVars) {}
+
+std::vector<int> RegisterAllocator::allocate() {
+    for (ParamNode *param : fnDef->paramList) {
+        define(param->slot, param->type);
+    }
+    pos++;
+    visitBlock(fnDef->block);
+
+    std::vector<LiveRange> candidates;
+    for (unsigned slot = 0; slot < fnDef->numVars; slot++) {
+        if (types[slot] && types[slot]->size() == 8 && !addressTaken[slot]) {
+            candidates.push_back(ranges[slot]);
+        }
+    }
+    std::stable_sort(candidates.begin(), candidates.end(),
+                     [](const LiveRange &a, const LiveRange &b) {
+        return a.start < b.start;
+    });
+
+    std::vector<int> regs(fnDef->numVars, NoReg);
+    std::set<int> freeRegs;
+    for (int reg = (int)FIRST_CALLEE_SAVED; reg <= (int)LAST_CALLEE_SAVED;
+         reg++) {
+        freeRegs.insert(reg);
+    }
+    std::vector<LiveRange> active;  // Sorted by end
+    auto byEnd = [](const LiveRange &a, const LiveRange &b) {
+        return a.end < b.end;
+    };
+
+    for (LiveRange &range : candidates) {
+        while (!active.empty() && active.front().end < range.start) {
+            freeRegs.insert(regs[active.front().slot]);
+            active.erase(active.begin());
+        }
+
+        if (!freeRegs.empty()) {
+            regs[range.slot] = *freeRegs.begin();
+            freeRegs.erase(freeRegs.begin());
+            active.insert(std::upper_bound(active.begin(), active.end(),
+                                           range, byEnd),
+                          range);
+            continue;
+        }
+
+        // Spill whichever range ends last, which frees a register for longest
+        LiveRange &last = active.back();
+        if (last.end > range.end) {
+            regs[range.slot] = regs[last.slot];
+            regs[last.slot] = NoReg;
+            active.pop_back();
+            active.insert(std::upper_bound(active.begin(), active.end(),
+                                           range, byEnd),
+                          range);
+        }
+    }
+    return regs;
+}
+
+void RegisterAllocator::define(unsigned slot, TypeNode *type) {
+    types[slot] = type;
+    ranges[slot] = {slot, pos, pos};
+    use(slot);
+}
+
+void RegisterAllocator::use(unsigned slot) {
+    ranges[slot].end = std::max(ranges[slot].end, pos);
+    if (!loops.empty()) {
+        loops.back().push_back(slot);
+    }
+}
+
+/* SECTION: Live ranges */
+
+void RegisterAllocator::visitBlock(std::vector<StatementNode *> &block) {
+    for (StatementNode *statement : block) {
+        visitStatement(statement);
+    }
+}
+
+void RegisterAllocator::visitStatement(StatementNode *statement) {
+    pos++;
+    switch (statement->kind) {
+        case StatementNode::Declaration:
+            define(statement->slot, statement->type);
+            break;
+        case StatementNode::Initialization:
+            // The initializer is evaluated into the variable, so anything it
+            // reads must still be live where the variable starts
+            visitExpr(statement->expr);
+            define(statement->slot, statement->type);
+            break;
+        case StatementNode::Assignment:
+            visitAccessor(statement->accessor);
+            visitExpr(statement->expr);
+            break;
+        case StatementNode::Return:
+            visitExpr(statement->expr);
+            break;
+        case StatementNode::FnCall:
+            visitFnCall(statement->fnCall);
+            break;
+        case StatementNode::If: {
+            IfNode *ifNode = static_cast<IfNode *>(statement);
+            visitExpr(ifNode->condition);
+            visitBlock(ifNode->block);
+            visitBlock(ifNode->elseBlock);
+            break;
+        }
+        case StatementNode::While: {
+            // Values flow from the end of the body back to the condition, so
+            // everything the loop uses is live throughout it
+            WhileNode *whileNode = static_cast<WhileNode *>(statement);
+            const unsigned loopStart = pos;
+            loops.emplace_back();
+            visitExpr(whileNode->condition);
+            visitBlock(whileNode->block);
+            pos++;
+
+            std::vector<unsigned> slots = std::move(loops.back());
+            loops.pop_back();
+            for (unsigned slot : slots) {
+                ranges[slot].start = std::min(ranges[slot].start, loopStart);
+                ranges[slot].end = std::max(ranges[slot].end, pos);
+                if (!loops.empty()) {
+                    loops.back().push_back(slot);
+                }
+            }
+            break;
+        }
+        case StatementNode::Break:
+        case StatementNode::Continue:
+            break;
+    }
+}
+
+void RegisterAllocator::visitFnCall(FnCallNode *fnCall) {
+    for (ExprNode *arg : fnCall->argList) {
+        visitExpr(arg);
+    }
+}
+
+void RegisterAllocator::visitAccessor(AccessorNode *accessor) {
+    switch (accessor->kind) {
+        case AccessorNode::Identifier:
+            use(accessor->slot);
+            break;
+        case AccessorNode::Dereference:
+            visitExpr(accessor->expr);
+            break;
+    }
+}
+
+void RegisterAllocator::visitExpr(ExprNode *expr) {
+    switch (expr->kind) {
+        case ExprNode::Accessor:
+            visitAccessor(expr->accessor);
+            break;
+        case ExprNode::FnCall:
+            visitFnCall(expr->fnCall);
+            break;
+        case ExprNode::BinaryOp:
+            visitExpr(expr->opr1);
+            visitExpr(expr->opr2);
+            break;
+        case ExprNode::UnaryOp:
+            if (expr->builtinOperator == BuiltinOperator::BitAnd) {
+                addressTaken[expr->opr->accessor->slot] = true;
+            }
+            visitExpr(expr->opr);
+            break;
+        case ExprNode::Array:
+            for (ExprNode *elem : *expr->array) {
+                visitExpr(elem);
+            }
+            break;
+        case ExprNode::Literal:
+        case ExprNode::Static:
+        case ExprNode::Empty:
+            break;
+    }
+}
@@ -20,62 +20,56 @@ StackFrame::Reservation::Reservation(TypeNode *type, long stackOffset)
 StackFrame::Reservation::Reservation()
         : valid(false) {}
 
-std::string StackFrame::Reservation::emitCopyTo(Reservation other) {
+void StackFrame::Reservation::emitCopyTo(MachineFunction &mf,
+                                         Reservation other) {
     if (*this == other) {
-        return "";
+        return;
     }
 
-    std::string output = "";
-
-    std::string strInstr, ldrInstr, rTo, rFrom;
+    Opcode strInstr, ldrInstr;
+    RegWidth rTo, rFrom;
     switch (type->size()) {
         case 1:
-            ldrInstr = "ldrb";
-            rFrom = "w";
+            ldrInstr = Opcode::Ldrb;
+            rFrom = RegWidth::W;
             break;
         default:
-            ldrInstr = "ldr";
-            rFrom = "x";
+            ldrInstr = Opcode::Ldr;
+            rFrom = RegWidth::X;
     }
     switch (other.type->size()) {
         case 1:
-            strInstr = "strb";
-            rTo = "w";
+            strInstr = Opcode::Strb;
+            rTo = RegWidth::W;
             break;
         default:
-            strInstr = "str";
-            rTo = "x";
+            strInstr = Opcode::Str;
+            rTo = RegWidth::X;
     }
 
     if (kind == Reg && other.kind == Reg) {
-        output += "mov " + toStr(other.location.reg, rTo) + ", "
-                + toStr(location.reg, rFrom) + "\n";
+        mf.emit(Opcode::Mov, mReg(other.location.reg, rTo),
+                mReg(location.reg, rFrom));
 
     } else if (kind == Reg && other.kind == Stack) {
-        output += strInstr + " " + toStr(location.reg, rTo) + ", "
-                + "[fp, #-" + toStr(other.location.stackOffset)
-                + "]\n";
+        mf.emit(strInstr, mReg(location.reg, rTo),
+                mMem(Register::fp, -other.location.stackOffset));
 
     } else if (kind == Stack && other.kind == Reg) {
-        output += ldrInstr + " " + toStr(other.location.reg, rFrom) + ", "
-                + "[fp, #-" + toStr(location.stackOffset)
-                + "]\n";
+        mf.emit(ldrInstr, mReg(other.location.reg, rFrom),
+                mMem(Register::fp, -location.stackOffset));
 
     } else if (kind == Stack && other.kind == Stack) {
         const Register TMP_REG = Register::x16;
-        output += ldrInstr + " " + toStr(TMP_REG, rFrom) + ", "
-                + "[fp, #-" + toStr(location.stackOffset)
-                + "]\n";
-        output += strInstr + " " + toStr(TMP_REG, rTo) + ", "
-                + "[fp, #-" + toStr(other.location.stackOffset)
-                + "]\n";
+        mf.emit(ldrInstr, mReg(TMP_REG, rFrom),
+                mMem(Register::fp, -location.stackOffset));
+        mf.emit(strInstr, mReg(TMP_REG, rTo),
+                mMem(Register::fp, -other.location.stackOffset));
     }
-
-    return output;
 }
 
-std::string StackFrame::Reservation::emitPutValue(unsigned long val) {
-    std::string output = "";
+void StackFrame::Reservation::emitPutValue(MachineFunction &mf,
+                                           unsigned long val) {
     Reservation res;
     if (kind == Reg) {
         res = *this;
@@ -83,33 +77,28 @@ std::string StackFrame::Reservation::emitPutValue(unsigned long val) {
         res = Reservation(type, Register::x16);
     }
 
-    output += "mov " + toStr(res.location.reg) + ", #"
-            + std::to_string(val & 0xffff) + "\n";
+    mf.emit(Opcode::Mov, mReg(res.location.reg), mImm(val & 0xffff));
     if (val & 0x00000000ffff0000l) {
-        output += "movk " + toStr(res.location.reg) + ", #"
-                + std::to_string((val >> 16) & 0xffff)
-                + ", LSL #16\n";
+        mf.emit(Opcode::Movk, mReg(res.location.reg),
+                mImm((val >> 16) & 0xffff), mLsl(16));
     }
     if (val & 0x0000ffff00000000l) {
-        output += "movk " + toStr(res.location.reg) + ", #"
-                + std::to_string((val >> 32) & 0xffff)
-                + ", LSL #32\n";
+        mf.emit(Opcode::Movk, mReg(res.location.reg),
+                mImm((val >> 32) & 0xffff), mLsl(32));
     }
     if (val & 0xffff000000000000l) {
-        output += "movk " + toStr(res.location.reg) + ", #"
-                + std::to_string((val >> 48) & 0xffff)
-                + ", LSL #48\n";
+        mf.emit(Opcode::Movk, mReg(res.location.reg),
+                mImm((val >> 48) & 0xffff), mLsl(48));
     }
 
     if (kind == Stack) {
-        output += res.emitCopyTo(*this);
+        res.emitCopyTo(mf, *this);
     }
-    return output;
 }
 
-std::string StackFrame::Reservation::emitFromExprNode(StackFrame *sf,
-                                                      ExprNode *expr) {
-    std::string output = "";
+void StackFrame::Reservation::emitFromExprNode(MachineFunction &mf,
+                                               StackFrame *sf,
+                                               ExprNode *expr) {
     switch(expr->kind) {
         case ExprNode::Literal: {
             unsigned long val;
@@ -121,78 +110,102 @@ std::string StackFrame::Reservation::emitFromExprNode(StackFrame *sf,
                     val = expr->literal->c;
                     break;
             }
-            output += emitPutValue(val);
+            emitPutValue(mf, val);
             break;
         }
         case ExprNode::Accessor: {
             if (expr->accessor->kind == AccessorNode::Identifier) {
-                Reservation var = sf->getVariable(expr->accessor->identifier);
-                output += var.emitCopyTo(*this);
+                Reservation var = sf->getVariable(expr->accessor->slot);
+                var.emitCopyTo(mf, *this);
                 break;
             }
             if (expr->accessor->kind == AccessorNode::Dereference) {
-                ExprNode derefOp(BuiltinOperator::Star, expr->accessor->expr);
-                output += emitFromExprNode(sf, &derefOp);
+                ExprNode derefOp(sf->cs, BuiltinOperator::Star,
+                                 expr->accessor->expr);
+                emitFromExprNode(mf, sf, &derefOp);
                 break;
             }
         }
         case ExprNode::FnCall: {
             if (expr->fnCall->identifier == "svc") {
-                for (int i = 1; i < expr->fnCall->argList.size() && i < 8; i++) {
+                for (std::size_t i = 1; i < expr->fnCall->argList.size() && i < 8; i++) {
                     ExprNode *argNode = expr->fnCall->argList[i];
                     auto arg = StackFrame::Reservation(argNode->type, (Register)(i-1));
                     if (argNode->containsFnCalls()) {
                         auto tmpRes = sf->reserveExpr(argNode->type);
-                        output += tmpRes.emitFromExprNode(sf, argNode);
-                        output += tmpRes.emitCopyTo(arg);
+                        tmpRes.emitFromExprNode(mf, sf, argNode);
+                        tmpRes.emitCopyTo(mf, arg);
                         sf->unreserveExpr();
                     } else {
-                        output += arg.emitFromExprNode(sf, argNode);
+                        arg.emitFromExprNode(mf, sf, argNode);
                     }
                 }
-                TypeNode intType = TypeNode(BuiltinType::Int);
-                auto syscallRes = StackFrame::Reservation(&intType, Register::x16);
-                auto returnVal = StackFrame::Reservation(&intType, Register::x0);
-                output += syscallRes.emitFromExprNode(sf, expr->fnCall->argList[0]);
-                output += "svc #0\n";
-                output += returnVal.emitCopyTo(*this);
+                TypeNode *intType = sf->cs->types.get(BuiltinType::Int);
+                auto syscallRes = StackFrame::Reservation(intType, Register::x16);
+                auto returnVal = StackFrame::Reservation(intType, Register::x0);
+                syscallRes.emitFromExprNode(mf, sf, expr->fnCall->argList[0]);
+                mf.emit(Opcode::Svc, mImm(0));
+                returnVal.emitCopyTo(mf, *this);
                 break;
             }
             // TODO: allow more than 8 arguments
             FnCallNode *fnCall = expr->fnCall;
             FnDeclNode *fnDecl = fnCall->fnDecl;
-            for (int i = 0; i < fnCall->argList.size() && i < 8; i++) {
+            for (std::size_t i = 0; i < fnCall->argList.size() && i < 8; i++) {
                 ExprNode *argNode = fnCall->argList[i];
                 auto arg = StackFrame::Reservation(fnDecl->paramList[i]->type, (Register)i);
                 if (argNode->containsFnCalls()) {
                     auto tmpRes = sf->reserveExpr(argNode->type);
-                    output += tmpRes.emitFromExprNode(sf, argNode);
-                    output += tmpRes.emitCopyTo(arg);
+                    tmpRes.emitFromExprNode(mf, sf, argNode);
+                    tmpRes.emitCopyTo(mf, arg);
                     sf->unreserveExpr();
                 } else {
-                    output += arg.emitFromExprNode(sf, argNode);
+                    arg.emitFromExprNode(mf, sf, argNode);
                 }
             }
             auto returnVal = StackFrame::Reservation(fnDecl->returnType, Register::x0);
-            output += sf->emitSaveCaller();
-            output += "bl _" + fnCall->identifier + "\n";
-            output += sf->emitLoadCaller();
-            output += returnVal.emitCopyTo(*this);
+            sf->emitSaveCaller(mf);
+            mf.emit(Opcode::Bl, mSymbol(&fnCall->identifier));
+            sf->emitLoadCaller(mf);
+            returnVal.emitCopyTo(mf, *this);
             break;
         }
         case ExprNode::BinaryOp: {
+            BuiltinOperator op = expr->builtinOperator;
+            ExprNode *opr1 = expr->opr1, *opr2 = expr->opr2;
+            long imm;
+            const bool useImm = sf->immediateOperand(op, opr1, opr2, imm);
+
+            // Division and remainder by a constant use x16 and x17 for
+            // themselves
+            const bool scratch = kind == Reg
+                && (location.reg == Register::x16
+                    || location.reg == Register::x17);
             Reservation dstRes = *this;
-            if (expr->opr1->type->size() > this->type->size()) {
-                dstRes = sf->reserveExpr(expr->opr1->type);
+            if (opr1->type->size() > this->type->size() || scratch) {
+                dstRes = sf->reserveExpr(opr1->type);
+            }
+            Reservation opr2Res;
+            if (!useImm) {
+                opr2Res = sf->reserveExpr(opr2->type);
             }
-            Reservation opr2Res = sf->reserveExpr(expr->opr2->type);
 
-            output += dstRes.emitFromExprNode(sf, expr->opr1);
-            output += opr2Res.emitFromExprNode(sf, expr->opr2);
-            output += sf->emitBinaryOp(expr->builtinOperator, dstRes, dstRes, opr2Res);
-            output += dstRes.emitCopyTo(*this);
+            // Variables held in registers are read in place
+            Reservation opr1Res = dstRes;
+            if (!sf->inRegister(opr1, opr1Res)) {
+                dstRes.emitFromExprNode(mf, sf, opr1);
+            }
+            if (useImm) {
+                sf->emitBinaryOpImm(mf, op, dstRes, opr1Res, imm);
+            } else {
+                if (!sf->inRegister(opr2, opr2Res)) {
+                    opr2Res.emitFromExprNode(mf, sf, opr2);
+                }
+                sf->emitBinaryOp(mf, op, dstRes, opr1Res, opr2Res);
+                sf->unreserveExpr();
+            }
+            dstRes.emitCopyTo(mf, *this);
 
-            sf->unreserveExpr();
             if (dstRes != *this) {
                 sf->unreserveExpr();
             }
@@ -200,25 +213,27 @@ std::string StackFrame::Reservation::emitFromExprNode(StackFrame *sf,
         }
         case ExprNode::UnaryOp:
             if (expr->builtinOperator == BuiltinOperator::BitAnd) {
-                output += sf->emitAddressOf(*this, expr->opr->accessor->identifier);
+                sf->emitAddressOf(mf, *this, expr->opr->accessor->slot);
+            } else if (expr->builtinOperator == BuiltinOperator::Star) {
+                sf->emitLoad(mf, *this, expr->opr);
             } else {
-                output += emitFromExprNode(sf, expr->opr);
-                output += sf->emitUnaryOp(expr->builtinOperator, *this, *this);
+                Reservation oprRes = *this;
+                if (!sf->inRegister(expr->opr, oprRes)) {
+                    emitFromExprNode(mf, sf, expr->opr);
+                }
+                sf->emitUnaryOp(mf, expr->builtinOperator, *this, oprRes);
             }
             break;
         case ExprNode::Array: {
             for (int i = expr->array->size() - 1; i >= 0; i--) {
                 ExprNode *elem = (*expr->array)[i];
                 Reservation elemRes = sf->reserveVariable(elem->type);
-                output += elemRes.emitFromExprNode(sf, elem);
+                elemRes.emitFromExprNode(mf, sf, elem);
             }
-            TypeNode voidType(BuiltinType::Void);
-            TypeNode ptrType(&voidType);
-            Reservation tmp = Reservation(&ptrType, Register::x16);
-            std::string tmpStr = toStr(tmp.location.reg);
-            output += tmp.emitPutValue(sf->stackPos);
-            output += "sub " + tmpStr + ", fp, " + tmpStr + "\n";
-            output += tmp.emitCopyTo(*this);
+            Reservation tmp = Reservation(expr->type, Register::x16);
+            mf.emit(Opcode::Sub, mReg(tmp.location.reg), mReg(Register::fp),
+                    mImm(sf->stackPos));
+            tmp.emitCopyTo(mf, *this);
             break;
         }
         case ExprNode::Static: {
@@ -233,23 +248,23 @@ std::string StackFrame::Reservation::emitFromExprNode(StackFrame *sf,
             } else {
                 dst = Reservation(expr->type, Register::x16);
             }
-            std::string dstStr = toStr(dst.location.reg);
-            std::string dataLabel =expr->staticData->label();
+            const std::string *dataLabel = &expr->staticData->label();
 
-            output += "adrp " + dstStr +  ", " + dataLabel + "@PAGE\n";
-            output += "add " + dstStr + ", " + dstStr + ", " + dataLabel + "@PAGEOFF\n";
-            output += dst.emitCopyTo(*this);
+            mf.emit(Opcode::Adrp, mReg(dst.location.reg),
+                    mSymbol(dataLabel, MOperand::Page));
+            mf.emit(Opcode::Add, mReg(dst.location.reg), mReg(dst.location.reg),
+                    mSymbol(dataLabel, MOperand::PageOff));
+            dst.emitCopyTo(mf, *this);
         }
         case ExprNode::Empty:
             break;
     }
-    return output;
 }
 
 bool StackFrame::Reservation::operator==(const Reservation &other) const {
     if (!valid || !other.valid) { return false; }
     if (kind != other.kind) { return false; }
-    if (*type != *other.type) { return false; }
+    if (type != other.type) { return false; }
 
     if (kind == Reg) {
         return location.reg == other.location.reg;
@@ -1,13 +1,18 @@
+#include <climits>
 #include <cstdlib>
 #include <iostream>
 #include <string>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 #include "CompileState.hpp"
 
-StackFrame::StackFrame(CompileState *cs, FnDefNode *fnDef)
-        : cs(cs),
-          fnDef(fnDef) {}
+StackFrame::StackFrame(CompileState *cs, FnDefNode *fnDef, FnOutput *output)
+        : variables(fnDef->numVars),
+          varRegs(fnDef->numVars, RegisterAllocator::NoReg),
+          cs(cs),
+          fnDef(fnDef),
+          output(output) {}
 
 void StackFrame::incStackPos(long amt) {
     stackPos += amt;
@@ -29,18 +34,21 @@ void StackFrame::incStackPos(long amt) {
     }
 }
 
-void StackFrame::addVariable(TypeNode *type, std::string identifier) {
-    Reservation res = reserveVariable(type);
-    variables[identifier] = res;
+void StackFrame::addVariable(TypeNode *type, unsigned slot) {
+    if (varRegs[slot] != RegisterAllocator::NoReg) {
+        variables[slot] = Reservation(type, (Register)varRegs[slot]);
+        return;
+    }
+    variables[slot] = reserveVariable(type);
 }
 
-StackFrame::Reservation StackFrame::getVariable(std::string identifier) {
-    if (variables.find(identifier) == variables.end()) {
-        std::cerr << "ERROR: Undefined variable: "
-                  << identifier << '\n';
+StackFrame::Reservation StackFrame::getVariable(unsigned slot) {
+    if (!variables[slot].valid) {
+        std::cerr << "COMPILER ERROR: Variable slot " << slot
+                  << " used before it was reserved\n";
         exit(EXIT_FAILURE);
     }
-    return variables[identifier];
+    return variables[slot];
 }
 
 StackFrame::Reservation StackFrame::reserveVariable(TypeNode *type) {
@@ -61,6 +69,7 @@ StackFrame::Reservation StackFrame::reserveExpr(TypeNode *type) {
     } else {
         incStackPos(type->size());
         exprReservations.emplace_back(type, stackPos);
+        numSpilledExprs++;
     }
     return exprReservations.back();
 }
@@ -85,102 +94,367 @@ void StackFrame::unreserveExpr() {
     exprReservations.pop_back();
 }
 
-std::string StackFrame::emitBinaryOp(BuiltinOperator op, Reservation res,
-                                     Reservation opr1, Reservation opr2) {
-    std::string output = "";
-    Reservation dst, src;
+bool StackFrame::isRelational(BuiltinOperator op, Condition &cond) {
+    switch (op) {
+        case BuiltinOperator::Eq: cond = Condition::Eq; return true;
+        case BuiltinOperator::Ne: cond = Condition::Ne; return true;
+        // TODO: assumes signed
+        case BuiltinOperator::Lt: cond = Condition::Lt; return true;
+        case BuiltinOperator::Gt: cond = Condition::Gt; return true;
+        case BuiltinOperator::Le: cond = Condition::Le; return true;
+        case BuiltinOperator::Ge: cond = Condition::Ge; return true;
+        default: return false;
+    }
+}
 
-    if (res.kind == Reservation::Reg) {
-        dst = res;
-    } else {
-        dst = Reservation(res.type, Register::x16);
+bool StackFrame::reversed(BuiltinOperator op, BuiltinOperator &swapped) {
+    switch (op) {
+        case BuiltinOperator::Lt: swapped = BuiltinOperator::Gt; return true;
+        case BuiltinOperator::Gt: swapped = BuiltinOperator::Lt; return true;
+        case BuiltinOperator::Le: swapped = BuiltinOperator::Ge; return true;
+        case BuiltinOperator::Ge: swapped = BuiltinOperator::Le; return true;
+        case BuiltinOperator::Plus:
+        case BuiltinOperator::Star:
+        case BuiltinOperator::Eq:
+        case BuiltinOperator::Ne:
+        case BuiltinOperator::BitAnd:
+        case BuiltinOperator::BitOr:
+        case BuiltinOperator::BitXor:
+            swapped = op;
+            return true;
+        default:
+            return false;
     }
-    output += opr1.emitCopyTo(dst);
+}
 
-    if (opr2.kind == Reservation::Reg) {
-        src = opr2;
-    } else {
-        src = Reservation(opr2.type, Register::x17);
-        output += opr2.emitCopyTo(src);
+// and/orr/eor take a 2, 4, 8, 16, 32 or 64-bit element, repeated to fill
+// 64 bits, whose set bits are one contiguous run, possibly rotated
+static bool isLogicalImmediate(unsigned long value) {
+    if (value == 0 || value == ~0ul) { return false; }
+
+    unsigned size = 64;
+    while (size > 2) {
+        const unsigned half = size / 2;
+        const unsigned long mask = (1ul << half) - 1;
+        if ((value & mask) != ((value >> half) & mask)) { break; }
+        size = half;
+    }
+    const unsigned long mask = size == 64 ? ~0ul : (1ul << size) - 1;
+    const unsigned long elem = value & mask;
+
+    // A rotated run has exactly two places where a bit differs from the one
+    // after it
+    const unsigned long rotated =
+        ((elem >> 1) | (elem << (size - 1))) & mask;
+    unsigned changes = 0;
+    for (unsigned long diff = elem ^ rotated; diff != 0; diff &= diff - 1) {
+        changes++;
     }
+    return changes == 2;
+}
 
-    switch(op) {
+bool StackFrame::fitsImmediate(BuiltinOperator op, long imm) {
+    Condition cond;
+    const unsigned long uimm = imm;
+    switch (op) {
+        case BuiltinOperator::Star:
+            // Shifts and shift-adds, see emitMulImm
+            return imm > 0 && (util::isPowerOf2(uimm)
+                               || util::isPowerOf2(uimm - 1)
+                               || util::isPowerOf2(uimm + 1));
+        case BuiltinOperator::Fslash:
+        case BuiltinOperator::Percent:
+            // Shifts or a multiply-high, see emitDivImm
+            return imm != 0 && imm != LONG_MIN;
         case BuiltinOperator::Plus:
-            output += "add " + toStr(dst.location.reg) + ", "
-                    + toStr(dst.location.reg) + ", "
-                    + toStr(src.location.reg) + "\n";
+        case BuiltinOperator::Minus:
+            // 12 bits, with add and sub swapped for negative values
+            return imm > -4096 && imm < 4096;
+        case BuiltinOperator::BitAnd:
+        case BuiltinOperator::BitOr:
+        case BuiltinOperator::BitXor:
+            return isLogicalImmediate(imm);
+        default:
+            return isRelational(op, cond) && imm >= 0 && imm < 4096;
+    }
+}
+
+bool StackFrame::immediateOperand(BuiltinOperator &op, ExprNode *&opr1,
+                                  ExprNode *&opr2, long &imm) {
+    BuiltinOperator swapped;
+    if (opr1->kind == ExprNode::Literal && opr2->kind != ExprNode::Literal
+            && reversed(op, swapped)
+            && fitsImmediate(swapped, opr1->literal->value())) {
+        op = swapped;
+        std::swap(opr1, opr2);
+    }
+    if (opr2->kind != ExprNode::Literal) { return false; }
+    imm = opr2->literal->value();
+    return fitsImmediate(op, imm);
+}
+
+// d = l op s, where s is a register or an immediate that fits op
+static void emitOp(MachineFunction &mf, BuiltinOperator op,
+                   MOperand d, MOperand l, MOperand s) {
+    Condition cond;
+    if (StackFrame::isRelational(op, cond)) {
+        mf.emit(Opcode::Cmp, l, s);
+        mf.emit(Opcode::Cset, d, mCond(cond));
+        return;
+    }
+    switch (op) {
+        case BuiltinOperator::Plus:
+            if (s.kind == MOperand::Imm && s.imm < 0) {
+                mf.emit(Opcode::Sub, d, l, mImm(-s.imm));
+            } else {
+                mf.emit(Opcode::Add, d, l, s);
+            }
             break;
         case BuiltinOperator::Minus:
-            output += "sub " + toStr(dst.location.reg) + ", "
-                    + toStr(dst.location.reg) + ", "
-                    + toStr(src.location.reg) + "\n";
+            if (s.kind == MOperand::Imm && s.imm < 0) {
+                mf.emit(Opcode::Add, d, l, mImm(-s.imm));
+            } else {
+                mf.emit(Opcode::Sub, d, l, s);
+            }
             break;
         case BuiltinOperator::Star:
-            output += "mul " + toStr(dst.location.reg) + ", "
-                    + toStr(dst.location.reg) + ", "
-                    + toStr(src.location.reg) + "\n";
+            mf.emit(Opcode::Mul, d, l, s);
             break;
         case BuiltinOperator::Fslash:
-            output += "sdiv " + toStr(dst.location.reg) + ", " // TODO: assumes signed
-                    + toStr(dst.location.reg) + ", "
-                    + toStr(src.location.reg) + "\n";
-            break;
-        case BuiltinOperator::Eq:
-            output += "cmp " + toStr(dst.location.reg) + ", "
-                    + toStr(src.location.reg) + "\n";
-            output += "cset " + toStr(dst.location.reg) + ", eq\n";
-            break;
-        case BuiltinOperator::Ne:
-            output += "cmp " + toStr(dst.location.reg) + ", "
-                    + toStr(src.location.reg) + "\n";
-            output += "cset " + toStr(dst.location.reg) + ", ne\n";
-            break;
-        case BuiltinOperator::Lt:
-            output += "cmp " + toStr(dst.location.reg) + ", "
-                    + toStr(src.location.reg) + "\n";
-            output += "cset " + toStr(dst.location.reg) + ", lt\n"; // TODO: assumes signed
-            break;
-        case BuiltinOperator::Gt:
-            output += "cmp " + toStr(dst.location.reg) + ", "
-                    + toStr(src.location.reg) + "\n";
-            output += "cset " + toStr(dst.location.reg) + ", gt\n"; // TODO: assumes signed
-            break;
-        case BuiltinOperator::Le:
-            output += "cmp " + toStr(dst.location.reg) + ", "
-                    + toStr(src.location.reg) + "\n";
-            output += "cset " + toStr(dst.location.reg) + ", le\n"; // TODO: assumes signed
-            break;
-        case BuiltinOperator::Ge:
-            output += "cmp " + toStr(dst.location.reg) + ", "
-                    + toStr(src.location.reg) + "\n";
-            output += "cset " + toStr(dst.location.reg) + ", ge\n"; // TODO: assumes signed
+            mf.emit(Opcode::Sdiv, d, l, s);  // TODO: assumes signed
             break;
         case BuiltinOperator::BitAnd:
-            output += "and " + toStr(dst.location.reg) + ", "
-                    + toStr(dst.location.reg) + ", "
-                    + toStr(src.location.reg) + "\n";
+            mf.emit(Opcode::And, d, l, s);
             break;
         case BuiltinOperator::BitOr:
-            output += "orr " + toStr(dst.location.reg) + ", "
-                    + toStr(dst.location.reg) + ", "
-                    + toStr(src.location.reg) + "\n";
+            mf.emit(Opcode::Orr, d, l, s);
             break;
         case BuiltinOperator::BitXor:
-            output += "eor " + toStr(dst.location.reg) + ", "
-                    + toStr(dst.location.reg) + ", "
-                    + toStr(src.location.reg) + "\n";
+            mf.emit(Opcode::Eor, d, l, s);
             break;
         default:
             break;
     }
+}
 
-    output += dst.emitCopyTo(res);
-    return output;
+/*
+    x * 8   → lsl d, x, #3
+    x * 9   → add d, x, x, LSL #3
+    x * 7   → lsl x17, x, #3
+              sub d, x17, x
+*/
+static void emitMulImm(MachineFunction &mf, MOperand d, MOperand l,
+                       long imm) {
+    const unsigned long uimm = imm;
+    if (util::isPowerOf2(uimm)) {
+        if (imm == 1) {
+            if (d.reg != l.reg) { mf.emit(Opcode::Mov, d, l); }
+            return;
+        }
+        mf.emit(Opcode::Lsl, d, l, mImm(util::log2(uimm)));
+    } else if (util::isPowerOf2(uimm - 1)) {
+        mf.emit(Opcode::Add, d, l, l, mLsl(util::log2(uimm - 1)));
+    } else {
+        MOperand tmp = mReg(Register::x17);
+        mf.emit(Opcode::Lsl, tmp, l, mImm(util::log2(uimm + 1)));
+        mf.emit(Opcode::Sub, d, tmp, l);
+    }
 }
 
-std::string StackFrame::emitUnaryOp(BuiltinOperator op, Reservation res,
-                                    Reservation opr) {
-    std::string output = "";
+// The magic number M and shift s for signed division by divisor, so that
+// x / divisor is the high half of x * M (adjusted by x if the signs of M
+// and divisor differ), shifted right by s and rounded towards zero. From
+// Hacker's Delight, section 10-4.
+static void divisionMagic(long divisor, long &magic, unsigned &shift) {
+    const unsigned long two63 = 1ul << 63;
+    const unsigned long ad = divisor < 0 ? -(unsigned long)divisor : divisor;
+    const unsigned long t = two63 + ((unsigned long)divisor >> 63);
+    const unsigned long anc = t - 1 - t % ad;  // |nc|
+    unsigned p = 63;
+    unsigned long q1 = two63 / anc, r1 = two63 - q1 * anc;
+    unsigned long q2 = two63 / ad, r2 = two63 - q2 * ad;
+    unsigned long delta;
+    do {
+        p++;
+        q1 *= 2;
+        r1 *= 2;
+        if (r1 >= anc) {
+            q1++;
+            r1 -= anc;
+        }
+        q2 *= 2;
+        r2 *= 2;
+        if (r2 >= ad) {
+            q2++;
+            r2 -= ad;
+        }
+        delta = ad - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+
+    magic = q2 + 1;
+    if (divisor < 0) { magic = -(unsigned long)magic; }
+    shift = p - 64;
+}
+
+/*
+    x / 8   → asr x17, x, #63
+              add x17, x, x17, LSR #61    ; + 7 if x is negative
+              asr d, x17, #3
+    x / 7   → mov x17, #M
+              smulh x17, x, x17
+              add x17, x17, x             ; if M and 7 differ in sign
+              asr x17, x17, #s
+              add d, x17, x17, LSR #63    ; + 1 if negative
+    Only x17 is used besides d, which is written last, so d may be x.
+*/
+static void emitDivImm(MachineFunction &mf, MOperand d, MOperand l,
+                       long imm) {
+    MOperand tmp = mReg(Register::x17);
+    const unsigned long abs = imm < 0 ? -(unsigned long)imm : imm;
+    if (abs == 1) {
+        if (imm < 0) {
+            mf.emit(Opcode::Neg, d, l);
+        } else if (d.reg != l.reg) {
+            mf.emit(Opcode::Mov, d, l);
+        }
+        return;
+    }
+
+    if (util::isPowerOf2(abs)) {
+        const unsigned k = util::log2(abs);
+        mf.emit(Opcode::Asr, tmp, l, mImm(63));
+        mf.emit(Opcode::Add, tmp, l, tmp, mLsr(64 - k));
+        mf.emit(Opcode::Asr, d, tmp, mImm(k));
+        if (imm < 0) { mf.emit(Opcode::Neg, d, d); }
+        return;
+    }
+
+    long magic;
+    unsigned shift;
+    divisionMagic(imm, magic, shift);
+    StackFrame::Reservation(nullptr, Register::x17).emitPutValue(mf, magic);
+    mf.emit(Opcode::Smulh, tmp, l, tmp);
+    if (imm > 0 && magic < 0) { mf.emit(Opcode::Add, tmp, tmp, l); }
+    if (imm < 0 && magic > 0) { mf.emit(Opcode::Sub, tmp, tmp, l); }
+    if (shift > 0) { mf.emit(Opcode::Asr, tmp, tmp, mImm(shift)); }
+    mf.emit(Opcode::Add, d, tmp, tmp, mLsr(63));
+}
+
+void StackFrame::emitBinaryOp(MachineFunction &mf, BuiltinOperator op,
+                              Reservation res,
+                              Reservation opr1, Reservation opr2) {
+    Reservation dst, lhs, src;
+
+    if (res.kind == Reservation::Reg) {
+        dst = res;
+    } else {
+        dst = Reservation(res.type, Register::x16);
+    }
+
+    // Operands already in registers are read in place
+    if (opr1.kind == Reservation::Reg) {
+        lhs = opr1;
+    } else {
+        lhs = dst;
+        opr1.emitCopyTo(mf, dst);
+    }
+
+    if (opr2.kind == Reservation::Reg) {
+        src = opr2;
+    } else {
+        src = Reservation(opr2.type, Register::x17);
+        opr2.emitCopyTo(mf, src);
+    }
+
+    MOperand d = mReg(dst.location.reg);
+    MOperand l = mReg(lhs.location.reg);
+    MOperand s = mReg(src.location.reg);
+    if (op != BuiltinOperator::Percent) {
+        emitOp(mf, op, d, l, s);
+    } else if (src.location.reg != Register::x17
+               || lhs.location.reg != Register::x16) {
+        // x - (x / y) * y, with the quotient in whichever scratch register
+        // is free
+        MOperand q = mReg(src.location.reg != Register::x17 ? Register::x17
+                                                            : Register::x16);
+        mf.emit(Opcode::Sdiv, q, l, s);
+        mf.emit(Opcode::Msub, d, q, s, l);
+    } else {
+        // Both operands are on the stack, so they are reloaded to free a
+        // register
+        Reservation x16(opr2.type, Register::x16);
+        mf.emit(Opcode::Sdiv, s, l, s);
+        opr2.emitCopyTo(mf, x16);
+        mf.emit(Opcode::Mul, s, s, mReg(Register::x16));
+        opr1.emitCopyTo(mf, x16);
+        mf.emit(Opcode::Sub, d, mReg(Register::x16), s);
+    }
+    dst.emitCopyTo(mf, res);
+}
+
+void StackFrame::emitBinaryOpImm(MachineFunction &mf, BuiltinOperator op,
+                                 Reservation res, Reservation opr1,
+                                 long imm) {
+    Reservation dst, lhs;
+
+    if (res.kind == Reservation::Reg) {
+        dst = res;
+    } else {
+        dst = Reservation(res.type, Register::x16);
+    }
+
+    if (opr1.kind == Reservation::Reg) {
+        lhs = opr1;
+    } else {
+        lhs = dst;
+        opr1.emitCopyTo(mf, dst);
+    }
+
+    MOperand d = mReg(dst.location.reg);
+    MOperand l = mReg(lhs.location.reg);
+    switch (op) {
+        case BuiltinOperator::Star:
+            emitMulImm(mf, d, l, imm);
+            break;
+        case BuiltinOperator::Fslash:
+            emitDivImm(mf, d, l, imm);
+            break;
+        case BuiltinOperator::Percent: {
+            // x - (x / imm) * imm, with the quotient in x17
+            MOperand q = mReg(Register::x17);
+            const unsigned long abs = imm < 0 ? -(unsigned long)imm : imm;
+            if (abs == 1) {
+                mf.emit(Opcode::Mov, d, mImm(0));
+            } else if (util::isPowerOf2(abs)) {
+                // Rounds x towards zero to a multiple of imm
+                const unsigned k = util::log2(abs);
+                mf.emit(Opcode::Asr, q, l, mImm(63));
+                mf.emit(Opcode::Add, q, l, q, mLsr(64 - k));
+                mf.emit(Opcode::And, q, q, mImm(-(long)abs));
+                mf.emit(Opcode::Sub, d, l, q);
+            } else if (lhs.location.reg != Register::x16) {
+                emitDivImm(mf, q, l, imm);
+                Reservation(res.type, Register::x16).emitPutValue(mf, imm);
+                mf.emit(Opcode::Msub, d, q, mReg(Register::x16), l);
+            } else {
+                // x is in x16 and on the stack, so it is reloaded to free x16
+                Reservation x16(opr1.type, Register::x16);
+                emitDivImm(mf, q, l, imm);
+                x16.emitPutValue(mf, imm);
+                mf.emit(Opcode::Mul, q, q, mReg(Register::x16));
+                opr1.emitCopyTo(mf, x16);
+                mf.emit(Opcode::Sub, d, mReg(Register::x16), q);
+            }
+            break;
+        }
+        default:
+            emitOp(mf, op, d, l, mImm(imm));
+    }
+    dst.emitCopyTo(mf, res);
+}
+
+void StackFrame::emitUnaryOp(MachineFunction &mf, BuiltinOperator op,
+                             Reservation res, Reservation opr) {
     Reservation dst, src;
 
     if (res.kind == Reservation::Reg) {
@@ -193,49 +467,33 @@ std::string StackFrame::emitUnaryOp(BuiltinOperator op, Reservation res,
         src = opr;
     } else {
         src = Reservation(opr.type, Register::x17);
-        output += opr.emitCopyTo(src);
+        opr.emitCopyTo(mf, src);
     }
 
+    MOperand d = mReg(dst.location.reg);
+    MOperand s = mReg(src.location.reg);
     switch (op) {
         case BuiltinOperator::Minus:
-            output += "neg " + toStr(dst.location.reg) + ", "
-                    + toStr(src.location.reg) + "\n";
-            break;
-        case BuiltinOperator::Star: {
-            std::string ldrInstr, r;
-            switch (res.type->size()) {
-                case 1:
-                    ldrInstr = "ldrb";
-                    r = "w";
-                    break;
-                default:
-                    ldrInstr = "ldr";
-                    r = "x";
-            }
-            output += ldrInstr + " " + toStr(dst.location.reg, r) + ", ["
-                    + toStr(src.location.reg) + "]\n";
+            mf.emit(Opcode::Neg, d, s);
             break;
-        }
         case BuiltinOperator::Not:
-            output += "cmp " + toStr(src.location.reg) + ", #0\n";
-            output += "cset " + toStr(dst.location.reg) + ", eq\n";
+            mf.emit(Opcode::Cmp, s, mImm(0));
+            mf.emit(Opcode::Cset, d, mCond(Condition::Eq));
             break;
         case BuiltinOperator::BitNot:
-            output += "mvn " + toStr(dst.location.reg) + ", "
-                    + toStr(src.location.reg) + "\n";
+            mf.emit(Opcode::Mvn, d, s);
             break;
         default:
             break;
     }
 
-    output += dst.emitCopyTo(res);
-    return output;
+    dst.emitCopyTo(mf, res);
 }
 
-std::string StackFrame::emitAddressOf(Reservation res, std::string identifier) {
-    Reservation var = getVariable(identifier);
+void StackFrame::emitAddressOf(MachineFunction &mf, Reservation res,
+                               unsigned slot) {
+    Reservation var = getVariable(slot);
     long stackOffset = var.location.stackOffset;
-    std::string output = "";
     Reservation dst;
 
     if (res.kind == Reservation::Reg) {
@@ -244,37 +502,290 @@ std::string StackFrame::emitAddressOf(Reservation res, std::string identifier) {
         dst = Reservation(res.type, Register::x16);
     }
 
-    output += "mov " + toStr(dst.location.reg) + ", #"
-            + toStr(stackOffset) + "\n";
-    output += "sub " + toStr(dst.location.reg) + ", fp, "
-            + toStr(dst.location.reg) + "\n";
+    mf.emit(Opcode::Sub, mReg(dst.location.reg), mReg(Register::fp),
+            mImm(stackOffset));
+
+    dst.emitCopyTo(mf, res);
+}
+
+// Whether expr is a variable kept in a register, which is then stored in res
+bool StackFrame::inRegister(ExprNode *expr, Reservation &res) {
+    if (expr->kind != ExprNode::Accessor
+            || expr->accessor->kind != AccessorNode::Identifier) {
+        return false;
+    }
+    Reservation var = getVariable(expr->accessor->slot);
+    if (var.kind != Reservation::Reg) { return false; }
+    res = var;
+    return true;
+}
+
+/*
+    !x           → the branch on x, inverted
+    x == 0       → cbz x / cbnz x
+    x < y        → cmp x, y
+                   b.lt label (b.ge if branchIf is false)
+    x < 10       → cmp x, #10
+                   b.lt label
+    1            → b label, or nothing
+    (otherwise)  → cbnz x / cbz x
+*/
+void StackFrame::emitCondBranch(MachineFunction &mf, ExprNode *cond,
+                                bool branchIf, unsigned label) {
+    if (cond->kind == ExprNode::Literal) {
+        if ((cond->literal->value() != 0) == branchIf) {
+            mf.emit(Opcode::B, mLabel(label));
+        }
+        return;
+    }
+    if (cond->kind == ExprNode::UnaryOp
+            && cond->builtinOperator == BuiltinOperator::Not) {
+        emitCondBranch(mf, cond->opr, !branchIf, label);
+        return;
+    }
+
+    Condition relation;
+    if (cond->kind == ExprNode::BinaryOp
+            && isRelational(cond->builtinOperator, relation)) {
+        BuiltinOperator op = cond->builtinOperator;
+        ExprNode *opr1 = cond->opr1, *opr2 = cond->opr2;
+        long imm;
+        const bool useImm = immediateOperand(op, opr1, opr2, imm);
+        isRelational(op, relation);
+        if (useImm && imm == 0 && (relation == Condition::Eq
+                                   || relation == Condition::Ne)) {
+            // x == 0 branches like !x, x != 0 like x
+            emitCondBranch(mf, opr1, relation == Condition::Eq ? !branchIf
+                                                               : branchIf,
+                           label);
+            return;
+        }
+
+        // Variables held in registers are compared in place
+        Reservation opr1Res = reserveExpr(opr1->type);
+        Reservation opr2Res;
+        if (!useImm) { opr2Res = reserveExpr(opr2->type); }
+        if (!inRegister(opr1, opr1Res)) {
+            opr1Res.emitFromExprNode(mf, this, opr1);
+        }
+        if (!useImm && !inRegister(opr2, opr2Res)) {
+            opr2Res.emitFromExprNode(mf, this, opr2);
+        }
+
+        Reservation lhs = opr1Res;
+        if (lhs.kind != Reservation::Reg) {
+            lhs = Reservation(opr1->type, Register::x16);
+            opr1Res.emitCopyTo(mf, lhs);
+        }
+        if (useImm) {
+            mf.emit(Opcode::Cmp, mReg(lhs.location.reg), mImm(imm));
+        } else {
+            Reservation rhs = opr2Res;
+            if (rhs.kind != Reservation::Reg) {
+                rhs = Reservation(opr2->type, Register::x17);
+                opr2Res.emitCopyTo(mf, rhs);
+            }
+            mf.emit(Opcode::Cmp, mReg(lhs.location.reg),
+                    mReg(rhs.location.reg));
+            unreserveExpr();
+        }
+        mf.emit(Opcode::BCond,
+                mCond(branchIf ? relation : inverse(relation)), mLabel(label));
+        unreserveExpr();
+        return;
+    }
+
+    Reservation condRes = reserveExpr(cond->type);
+    if (!inRegister(cond, condRes)) {
+        condRes.emitFromExprNode(mf, this, cond);
+    }
+    Reservation test = condRes;
+    if (test.kind != Reservation::Reg) {
+        test = Reservation(cond->type, Register::x16);
+        condRes.emitCopyTo(mf, test);
+    }
+    mf.emit(branchIf ? Opcode::Cbnz : Opcode::Cbz, mReg(test.location.reg),
+            mLabel(label));
+    unreserveExpr();
+}
+
+/* SECTION: Memory accesses */
+
+// If offset is index * size, for an access of size bytes, sets index
+static bool isScaledIndex(ExprNode *offset, unsigned size, ExprNode *&index) {
+    if (offset->kind == ExprNode::BinaryOp
+            && offset->builtinOperator == BuiltinOperator::Star) {
+        if (offset->opr2->kind == ExprNode::Literal
+                && offset->opr2->literal->value() == size) {
+            index = offset->opr1;
+            return true;
+        }
+        if (offset->opr1->kind == ExprNode::Literal
+                && offset->opr1->literal->value() == size) {
+            index = offset->opr2;
+            return true;
+        }
+    }
+    if (size == 1) {
+        index = offset;
+        return true;
+    }
+    return false;
+}
+
+/*
+    *(p + 24)     → [xp, #24]
+    *(p + i * 8)  → [xp, xi, LSL #3]
+    *(p + i)      → [xp, xi]          (char *p)
+    *p            → [xp]
+*/
+StackFrame::Address StackFrame::reserveAddress(MachineFunction &mf,
+                                               ExprNode *addr,
+                                               Reservation base) {
+    const unsigned size = addr->type->pointerType->size();
+    Address address;
+    ExprNode *baseExpr = addr, *indexExpr = nullptr;
+    bool indexFirst = false;  // Evaluated in source order, as in i + p
+
+    if (addr->kind == ExprNode::BinaryOp
+            && addr->builtinOperator == BuiltinOperator::Plus
+            && (size == 1 || size == 8)) {
+        ExprNode *ptr = addr->opr1, *offset = addr->opr2;
+        if (ptr->type->kind != TypeNode::Pointer) {
+            std::swap(ptr, offset);
+            indexFirst = true;
+        }
+        long value;
+        if (offset->kind == ExprNode::Literal) {
+            // ldr/ldrb take an unsigned 12-bit offset, scaled by the size
+            value = offset->literal->value();
+            if (value >= 0 && value % size == 0 && value / size < 4096) {
+                baseExpr = ptr;
+                address.offset = value;
+            }
+        } else if (offset->type->kind != TypeNode::Pointer
+                   && isScaledIndex(offset, size, indexExpr)) {
+            baseExpr = ptr;
+            address.shift = size == 8 ? 3 : 0;
+        }
+    }
+
+    // Variables held in registers are used in place
+    address.base = base.valid ? Reservation(baseExpr->type, base.location.reg)
+                              : reserveExpr(baseExpr->type);
+    address.numReserved = base.valid ? 0 : 1;
+    if (indexExpr) {
+        address.index = reserveExpr(indexExpr->type);
+        address.numReserved++;
+    }
+    if (indexExpr && indexFirst && !inRegister(indexExpr, address.index)) {
+        address.index.emitFromExprNode(mf, this, indexExpr);
+    }
+    if (!inRegister(baseExpr, address.base)) {
+        address.base.emitFromExprNode(mf, this, baseExpr);
+    }
+    if (indexExpr && !indexFirst && !inRegister(indexExpr, address.index)) {
+        address.index.emitFromExprNode(mf, this, indexExpr);
+    }
+    return address;
+}
+
+// Parts on the stack are loaded into x16, with x17 used only in between, so
+// that x17 is free for a value to store
+MOperand StackFrame::emitAddress(MachineFunction &mf, Address address) {
+    Register base = Register::x16;
+    if (address.base.kind == Reservation::Reg) {
+        base = address.base.location.reg;
+    } else {
+        address.base.emitCopyTo(mf, Reservation(address.base.type, base));
+    }
+
+    if (!address.index.valid) {
+        return address.offset ? mMem(base, address.offset) : mMem(base);
+    }
+    if (address.index.kind == Reservation::Reg) {
+        return mMem(base, address.index.location.reg, address.shift);
+    }
+    address.index.emitCopyTo(mf, Reservation(address.index.type,
+                                             Register::x17));
+    mf.emit(Opcode::Add, mReg(Register::x16), mReg(base),
+            mReg(Register::x17), mLsl(address.shift));
+    return mMem(Register::x16);
+}
+
+void StackFrame::unreserveAddress(Address address) {
+    for (unsigned i = 0; i < address.numReserved; i++) {
+        unreserveExpr();
+    }
+}
+
+void StackFrame::emitLoad(MachineFunction &mf, Reservation res,
+                          ExprNode *addr) {
+    // The destination register can hold the address until it is loaded
+    Address address = reserveAddress(
+        mf, addr, res.kind == Reservation::Reg ? res : Reservation());
+    MOperand mem = emitAddress(mf, address);
+
+    Reservation dst = res;
+    if (res.kind != Reservation::Reg) {
+        dst = Reservation(res.type, Register::x16);
+    }
+    switch (addr->type->pointerType->size()) {
+        case 1:
+            mf.emit(Opcode::Ldrb, mReg(dst.location.reg, RegWidth::W), mem);
+            break;
+        default:
+            mf.emit(Opcode::Ldr, mReg(dst.location.reg), mem);
+    }
+    dst.emitCopyTo(mf, res);
+    unreserveAddress(address);
+}
+
+void StackFrame::emitStore(MachineFunction &mf, ExprNode *addr,
+                           ExprNode *value) {
+    Address address = reserveAddress(mf, addr, Reservation());
+    Reservation valRes = reserveExpr(value->type);
+    if (!inRegister(value, valRes)) {
+        valRes.emitFromExprNode(mf, this, value);
+    }
+    MOperand mem = emitAddress(mf, address);
 
-    output += dst.emitCopyTo(res);
-    return output;
+    Reservation src = valRes;
+    if (valRes.kind != Reservation::Reg) {
+        src = Reservation(valRes.type, Register::x17);
+        valRes.emitCopyTo(mf, src);
+    }
+    switch (addr->type->pointerType->size()) {
+        case 1:
+            mf.emit(Opcode::Strb, mReg(src.location.reg, RegWidth::W), mem);
+            break;
+        default:
+            mf.emit(Opcode::Str, mReg(src.location.reg), mem);
+    }
+    unreserveExpr();
+    unreserveAddress(address);
 }
 
-std::string StackFrame::emitSaveCaller() {
-    std::string output = "";
+void StackFrame::emitSaveCaller(MachineFunction &mf) {
     int numToSave = exprReservations.size() < 8 ? exprReservations.size() : 8;
     for (int i = 1; i < numToSave; i += 2) {
-        output += "stp " + toStr((Register)(i+7)) + ", "
-                + toStr((Register)(i+8)) + ", [sp, #-16]!\n";
+        mf.emit(Opcode::Stp, mReg((Register)(i+7)), mReg((Register)(i+8)),
+                mMem(Register::sp, -16, MOperand::PreIndex));
     }
     if (numToSave % 2 == 1) {
-        output += "str " + toStr((Register)(numToSave+7)) + ", [sp, #-16]!\n";
+        mf.emit(Opcode::Str, mReg((Register)(numToSave+7)),
+                mMem(Register::sp, -16, MOperand::PreIndex));
     }
-    return output;
 }
 
-std::string StackFrame::emitLoadCaller() {
-    std::string output = "";
+void StackFrame::emitLoadCaller(MachineFunction &mf) {
     int numToLoad = exprReservations.size() < 8 ? exprReservations.size() : 8;
     if (numToLoad % 2 == 1) {
-        output += "ldr " + toStr((Register)(numToLoad+7)) + ", [sp], #16\n";
+        mf.emit(Opcode::Ldr, mReg((Register)(numToLoad+7)),
+                mMem(Register::sp, 16, MOperand::PostIndex));
     }
     for (int i = numToLoad - 1 - (numToLoad % 2); i > 0; i -= 2) {
-        output += "ldp " + toStr((Register)(i+7)) + ", "
-                + toStr((Register)(i+8)) + ", [sp], #16\n";
+        mf.emit(Opcode::Ldp, mReg((Register)(i+7)), mReg((Register)(i+8)),
+                mMem(Register::sp, 16, MOperand::PostIndex));
     }
-    return output;
 }
@@ -5,30 +5,34 @@
 #include "CompileState.hpp"
 #include "util.hpp"
 
-StaticData::StaticData(unsigned long id, std::string string)
+StaticData::StaticData(CompileState *cs, unsigned long id, std::string string)
         : kind(String),
           string(string),
           id(id) {
-    ptrType = new TypeNode(new TypeNode(BuiltinType::Char));
+    ptrType = cs->types.pointerTo(cs->types.get(BuiltinType::Char));
+}
+
+// Data is numbered per function, so the label only depends on the function
+// that uses it
+void StaticData::setOwner(const std::string &fnName) {
+    labelName = "static.String." + fnName + "." + std::to_string(id);
 }
 
 StaticData::StaticData()
         : kind(None) {}
 
-void StaticData::emit(CompileState &cs) {
-    IndentedStream ios(cs.os, cs.indent);
-
-    ios << ".data\n";
+void StaticData::emit(AsmWriter &out, unsigned indent) {
+    out.indent(indent) << ".data\n";
 
     unsigned align = p2alignment();
     if (align > 0) {
-        ios << ".p2align " << p2alignment() << "\n";
+        out.indent(indent) << ".p2align " << p2alignment() << "\n";
     }
 
-    cs.os << label() << ":\n";
+    out << label() << ":\n";
     switch (kind) {
         case String:
-            ios << ".asciz " << string << "\n";
+            out.indent(indent) << ".asciz " << string << "\n";
             break;
         case None: break;
     }
@@ -41,15 +45,10 @@ unsigned StaticData::p2alignment() {
     }
 }
 
-std::string StaticData::label() {
-    std::string kindStr;
-    switch (kind) {
-        case String:
-            kindStr = "String";
-            break;
-        case None: break;
-    }
-    return "static." + kindStr + "." + std::to_string(id);
+// Stable for the lifetime of the StaticData, so machine instructions can
+// refer to it by pointer
+const std::string &StaticData::label() {
+    return labelName;
 }
 
 std::ostream &operator<<(std::ostream &os, StaticData &staticData) {
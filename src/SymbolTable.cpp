@@ -0,0 +1,16 @@
+#include <string>
+#include "CompileState.hpp"
+
+Symbol::Symbol(std::string name) : name(name) {}
+
+SymbolTable::SymbolTable(Arena &arena) : arena(arena) {}
+
+Symbol *SymbolTable::intern(StringView name) {
+    auto it = symbols.find(name);
+    if (it != symbols.end()) {
+        return it->second;
+    }
+    Symbol *symbol = arena.create<Symbol>(name.str());
+    symbols.emplace(StringView(symbol->name), symbol);
+    return symbol;
+}
@@ -0,0 +1,143 @@
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "TimeTrace.hpp"
+#include "util.hpp"
+
+TimeTrace::TimeTrace() : begin(Clock::now()) {
+    // The thread that creates the trace is the main thread
+    threadIds.emplace(std::this_thread::get_id(), 0);
+}
+
+void TimeTrace::addEvent(const char *name, const std::string &detail,
+                         Clock::time_point start, Clock::time_point end) {
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto tid = threadIds.emplace(std::this_thread::get_id(),
+                                 threadIds.size()).first->second;
+    events.push_back({
+        name, detail, tid,
+        duration_cast<microseconds>(start - begin).count(),
+        duration_cast<microseconds>(end - start).count(),
+    });
+}
+
+static void writeJsonString(AsmWriter &out, const std::string &str) {
+    out << '"';
+    for (char c : str) {
+        switch (c) {
+            case '"':  out << "\\\""; break;
+            case '\\': out << "\\\\"; break;
+            case '\n': out << "\\n"; break;
+            case '\t': out << "\\t"; break;
+            default:
+                if ((unsigned char)c < 0x20) {
+                    char escaped[7];
+                    std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                    out << escaped;
+                } else {
+                    out << c;
+                }
+        }
+    }
+    out << '"';
+}
+
+bool TimeTrace::writeChromeTrace(const char *path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    AsmWriter out;
+
+    out << "{\"traceEvents\":[\n";
+    for (std::size_t i = 0; i < events.size(); i++) {
+        Event &event = events[i];
+        out << "{\"ph\":\"X\",\"pid\":1,\"tid\":" << event.tid
+            << ",\"ts\":" << (long)event.start
+            << ",\"dur\":" << (long)event.duration
+            << ",\"name\":";
+        writeJsonString(out, event.name);
+        if (!event.detail.empty()) {
+            out << ",\"args\":{\"detail\":";
+            writeJsonString(out, event.detail);
+            out << '}';
+        }
+        out << "},\n";
+    }
+    for (auto &thread : threadIds) {
+        out << "{\"ph\":\"M\",\"pid\":1,\"tid\":" << thread.second
+            << ",\"name\":\"thread_name\",\"args\":{\"name\":\""
+            << (thread.second == 0 ? "qcc" : "qcc worker") << "\"}},\n";
+    }
+    out << "{\"ph\":\"M\",\"pid\":1,\"name\":\"process_name\","
+           "\"args\":{\"name\":\"qcc\"}}\n";
+    out << "],\"displayTimeUnit\":\"ms\"}\n";
+
+    return out.writeToFile(path);
+}
+
+void TimeTrace::printReport(std::ostream &os) {
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+
+    struct Phase {
+        const char *name;
+        long long total = 0;
+        unsigned long count = 0;
+    };
+    std::vector<Phase> phases;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    const long long wall = duration_cast<microseconds>(
+        Clock::now() - begin).count();
+    for (Event &event : events) {
+        auto it = std::find_if(phases.begin(), phases.end(),
+                               [&](const Phase &phase) {
+            return std::string(phase.name) == event.name;
+        });
+        if (it == phases.end()) {
+            phases.emplace_back();
+            phases.back().name = event.name;
+            it = phases.end() - 1;
+        }
+        it->total += event.duration;
+        it->count++;
+    }
+    std::sort(phases.begin(), phases.end(),
+              [](const Phase &a, const Phase &b) { return a.total > b.total; });
+
+    // Phases nest and may run on several threads, so the times can add up
+    // to more than the wall time
+    char line[128];
+    os << "===== qcc time report =====\n";
+    std::snprintf(line, sizeof(line), "%12s %7s %8s  %s\n",
+                  "Time (ms)", "% wall", "Count", "Phase");
+    os << line;
+    for (Phase &phase : phases) {
+        std::snprintf(line, sizeof(line), "%12.3f %6.1f%% %8lu  %s\n",
+                      phase.total / 1000.0,
+                      wall > 0 ? phase.total * 100.0 / wall : 0.0,
+                      phase.count, phase.name);
+        os << line;
+    }
+    std::snprintf(line, sizeof(line), "%12.3f %6.1f%% %8s  %s\n",
+                  wall / 1000.0, 100.0, "", "Total (wall)");
+    os << line;
+}
+
+TimeScope::TimeScope(TimeTrace *trace, const char *name,
+                     const std::string &detail)
+        : trace(trace),
+          name(name) {
+    if (trace) {
+        this->detail = detail;
+        start = TimeTrace::Clock::now();
+    }
+}
+
+TimeScope::~TimeScope() {
+    if (trace) {
+        trace->addEvent(name, detail, start, TimeTrace::Clock::now());
+    }
+}
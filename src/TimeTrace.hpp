@@ -0,0 +1,59 @@
+#pragma once
+
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+  Records how long each compile phase takes, for -ftime-trace (Chrome
+  trace-event JSON, viewable in chrome://tracing or Perfetto) and
+  -ftime-report (a plain-text summary per phase). Phases are recorded with
+  TimeScope; events may come from several threads.
+*/
+class TimeTrace {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    TimeTrace();
+
+    void addEvent(const char *name, const std::string &detail,
+                  Clock::time_point start, Clock::time_point end);
+
+    bool writeChromeTrace(const char *path);
+    void printReport(std::ostream &os);
+
+private:
+    struct Event {
+        const char *name;
+        std::string detail;
+        unsigned tid;
+        long long start;     // Microseconds since the trace began
+        long long duration;  // Microseconds
+    };
+
+    Clock::time_point begin;
+    std::mutex mutex;
+    std::vector<Event> events;
+    std::map<std::thread::id, unsigned> threadIds;  // In order of first use
+};
+
+// Times the enclosing scope. Does nothing if trace is null, so phases can be
+// instrumented unconditionally.
+class TimeScope {
+public:
+    TimeScope(TimeTrace *trace, const char *name,
+              const std::string &detail = std::string());
+    ~TimeScope();
+    TimeScope(const TimeScope &) = delete;
+    TimeScope &operator=(const TimeScope &) = delete;
+
+private:
+    TimeTrace *trace;
+    const char *name;
+    std::string detail;
+    TimeTrace::Clock::time_point start;
+};
@@ -0,0 +1,39 @@
+#include <string>
+#include "ast/ast.hpp"
+#include "CompileState.hpp"
+
+TypeTable::TypeTable(Arena &arena)
+        : arena(arena),
+          voidType(arena.create<TypeNode>(BuiltinType::Void)),
+          intType(arena.create<TypeNode>(BuiltinType::Int)),
+          charType(arena.create<TypeNode>(BuiltinType::Char)) {}
+
+TypeNode *TypeTable::get(BuiltinType builtinType) {
+    switch (builtinType) {
+        case BuiltinType::Void: return voidType;
+        case BuiltinType::Int:  return intType;
+        case BuiltinType::Char: return charType;
+    }
+    return nullptr;
+}
+
+TypeNode *TypeTable::get(LiteralType literalType) {
+    return get(toBuiltinType(literalType));
+}
+
+TypeNode *TypeTable::get(std::string customType) {
+    auto it = customTypes.find(customType);
+    if (it != customTypes.end()) {
+        return it->second;
+    }
+    TypeNode *type = arena.create<TypeNode>(customType);
+    customTypes.emplace(customType, type);
+    return type;
+}
+
+TypeNode *TypeTable::pointerTo(TypeNode *type) {
+    if (!type->pointerToThis) {
+        type->pointerToThis = arena.create<TypeNode>(type);
+    }
+    return type->pointerToThis;
+}
@@ -1,9 +1,10 @@
 #include "ast/ast.hpp"
 #include "util.hpp"
 
-AccessorNode::AccessorNode(std::string identifier, TypeNode *type)
+AccessorNode::AccessorNode(Symbol *identifier, unsigned slot, TypeNode *type)
         : kind(Identifier),
           identifier(identifier),
+          slot(slot),
           type(type) {}
 
 AccessorNode::AccessorNode(ExprNode *expr)
@@ -22,7 +23,7 @@ std::ostream &operator<<(std::ostream &os, AccessorNode &node) {
     os << "AccessorNode (";
     switch (node.kind) {
         case AccessorNode::Identifier:
-            os << "Identifier): " << node.identifier;
+            os << "Identifier): " << node.identifier->name;
             break;
         case AccessorNode::Dereference:
             os << "Dereference):\n";
@@ -3,7 +3,6 @@
 
 BreakNode::BreakNode() : StatementNode(Break) {}
 
-std::string BreakNode::emit(StackFrame *sf) {
-    std::string labelIdStr = std::to_string(sf->loopIds.back());
-    return "b WHILE_EXIT_" + labelIdStr + "\n";
+void BreakNode::emit(MachineFunction &mf, StackFrame *sf) {
+    mf.emit(Opcode::B, mLabel(sf->loopLabels.back().second));
 }
@@ -3,7 +3,6 @@
 
 ContinueNode::ContinueNode() : StatementNode(Continue) {}
 
-std::string ContinueNode::emit(StackFrame *sf) {
-    std::string labelIdStr = std::to_string(sf->loopIds.back());
-    return "b WHILE_COND_" + labelIdStr + "\n";
+void ContinueNode::emit(MachineFunction &mf, StackFrame *sf) {
+    mf.emit(Opcode::B, mLabel(sf->loopLabels.back().first));
 }
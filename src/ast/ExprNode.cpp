@@ -1,10 +1,10 @@
 #include "ast/ast.hpp"
 #include "util.hpp"
 
-ExprNode::ExprNode(LiteralNode *literal)
+ExprNode::ExprNode(CompileState *cs, LiteralNode *literal)
         : kind(Literal),
           literal(literal),
-          type(new TypeNode(literal->type)) {}
+          type(cs->types.get(literal->type)) {}
 
 ExprNode::ExprNode(AccessorNode *accessor)
         : kind(Accessor),
@@ -15,13 +15,14 @@ ExprNode::ExprNode(FnCallNode *fnCall)
         : kind(FnCall),
           fnCall(fnCall),
           type(fnCall->fnDecl->returnType) {
-    if (*type == TypeNode(BuiltinType::Void)) {
+    if (type->isVoid()) {
         std::cerr << "ERROR: Can't use void function in expression\n";
         exit(EXIT_FAILURE);
     }
 }
 
-ExprNode::ExprNode(BuiltinOperator binaryOperator, ExprNode *opr1, ExprNode *opr2)
+ExprNode::ExprNode(CompileState *cs, BuiltinOperator binaryOperator,
+                   ExprNode *opr1, ExprNode *opr2)
         : kind(BinaryOp),
           builtinOperator(binaryOperator),
           opr1(opr1),
@@ -38,11 +39,14 @@ ExprNode::ExprNode(BuiltinOperator binaryOperator, ExprNode *opr1, ExprNode *opr
     if (opr1->type->kind == TypeNode::Pointer) {
         type = opr1->type;
         if (opr2->type->kind != TypeNode::Pointer) {
-            this->opr2 = new ExprNode(
+            this->opr2 = cs->arena.create<ExprNode>(
+                cs,
                 BuiltinOperator::Star,
                 opr2,
-                new ExprNode(
-                    new LiteralNode((long)opr1->type->pointerType->size())
+                cs->arena.create<ExprNode>(
+                    cs,
+                    cs->arena.create<LiteralNode>(
+                        (long)opr1->type->pointerType->size())
                 )
             );
         }
@@ -51,35 +55,30 @@ ExprNode::ExprNode(BuiltinOperator binaryOperator, ExprNode *opr1, ExprNode *opr
     if (opr2->type->kind == TypeNode::Pointer) {
         type = opr2->type;
         if (opr1->type->kind != TypeNode::Pointer) {
-            this->opr1 = new ExprNode(
+            this->opr1 = cs->arena.create<ExprNode>(
+                cs,
                 BuiltinOperator::Star,
                 opr1,
-                new ExprNode(
-                    new LiteralNode((long)opr2->type->pointerType->size())
+                cs->arena.create<ExprNode>(
+                    cs,
+                    cs->arena.create<LiteralNode>(
+                        (long)opr2->type->pointerType->size())
                 )
             );
         }
         return;
     }
 
-    if (builtinOperator == BuiltinOperator::Percent) {
-        builtinOperator = BuiltinOperator::Minus;
-        this->opr1 = opr1;
-        this->opr2 = new ExprNode(BuiltinOperator::Star,
-            new ExprNode(BuiltinOperator::Fslash, opr1, opr2),
-            opr2
-        );
-    }
-
-    if (*opr1->type == *opr2->type) {
+    if (opr1->type == opr2->type) {
         type = opr1->type;
         return;
     }
 
-    type = new TypeNode(BuiltinType::Int);
+    type = cs->types.get(BuiltinType::Int);
 }
 
-ExprNode::ExprNode(BuiltinOperator unaryOperator, ExprNode *opr)
+ExprNode::ExprNode(CompileState *cs, BuiltinOperator unaryOperator,
+                   ExprNode *opr)
         : kind(UnaryOp),
           builtinOperator(unaryOperator),
           opr(opr) {
@@ -96,33 +95,35 @@ ExprNode::ExprNode(BuiltinOperator unaryOperator, ExprNode *opr)
     }
 
     if (unaryOperator == BuiltinOperator::BitAnd) {
-        type = new TypeNode(opr->type);
+        type = cs->types.pointerTo(opr->type);
         return;
     }
 
     type = opr->type;
 }
 
-ExprNode::ExprNode(std::vector<ExprNode *> *array)
+ExprNode::ExprNode(CompileState *cs, std::vector<ExprNode *> *array)
         : kind(Array),
           array(array),
-          type(new TypeNode(new TypeNode(BuiltinType::Void))) {}
+          type(cs->types.pointerTo(cs->types.get(BuiltinType::Void))) {}
 
 ExprNode::ExprNode(StaticData *staticData)
         : kind(Static),
           staticData(staticData),
           type(staticData->ptrType) {}
 
-ExprNode::ExprNode()
+ExprNode::ExprNode(CompileState *cs)
         : kind(Empty),
-          type(new TypeNode(BuiltinType::Void)) {}
+          type(cs->types.get(BuiltinType::Void)) {}
 
 bool ExprNode::containsFnCalls() {
     return kind == FnCall
-        || kind == BinaryOp
-            && (opr1->containsFnCalls() || opr2->containsFnCalls())
-        || kind == UnaryOp
-            && opr->containsFnCalls();
+        || (kind == Accessor && accessor->kind == AccessorNode::Dereference
+            && accessor->expr->containsFnCalls())
+        || (kind == BinaryOp
+            && (opr1->containsFnCalls() || opr2->containsFnCalls()))
+        || (kind == UnaryOp
+            && opr->containsFnCalls());
 }
 
 std::ostream &operator<<(std::ostream &os, ExprNode &node) {
@@ -17,13 +17,13 @@ bool FnDeclNode::operator==(FnDeclNode &other) {
         return false;
     }
 
-    for (int i = 0; i < paramList.size(); i++) {
-        if (*paramList[i]->type != *other.paramList[i]->type) {
+    for (std::size_t i = 0; i < paramList.size(); i++) {
+        if (paramList[i]->type != other.paramList[i]->type) {
             return false;
         }
     }
 
-    return *returnType == *other.returnType
+    return returnType == other.returnType
         &&  identifier == other.identifier;
 }
 
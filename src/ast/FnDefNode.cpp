@@ -1,13 +1,26 @@
+#include <algorithm>
+#include <sstream>
+#include <vector>
 #include "ast/ast.hpp"
 #include "util.hpp"
 #include "CompileState.hpp"
+#include "ir/ir.hpp"
 
-FnDefNode::FnDefNode(FnDeclNode fnDeclNode, std::vector<StatementNode *> block)
+FnDefNode::FnDefNode(FnDeclNode fnDeclNode,
+                     std::vector<StatementNode *> block,
+                     unsigned numVars,
+                     std::vector<StaticData *> staticData)
         : FnDeclNode(fnDeclNode.returnType,
                      fnDeclNode.identifier,
                      fnDeclNode.paramList),
-          block(block) {
-    bool returnsVoid = *returnType == TypeNode(BuiltinType::Void);
+          block(block),
+          numVars(numVars),
+          staticData(staticData) {
+    for (StaticData *data : staticData) {
+        data->setOwner(identifier);
+    }
+
+    bool returnsVoid = returnType->isVoid();
     for (auto *statement : block) {
         if (statement->kind != StatementNode::Return) { continue; }
         if (returnsVoid && statement->expr->kind != ExprNode::Empty) {
@@ -41,64 +54,111 @@ std::ostream &operator<<(std::ostream &os, FnDefNode &node) {
     return os << '}';
 }
 
-void FnDefNode::emit(CompileState &cs) {
-    IndentedStream ios(cs.os, cs.indent);
-    ios << ".globl _" << identifier << '\n';
-    ios << ".p2align 2\n";
-    cs.os << "_" << identifier << ":\n";
+// Lowers the function to IR, optimizes it and selects instructions from it,
+// after the entry block
+static void emitFromIR(CompileState &cs, FnDefNode *fnDef, FnOutput &output,
+                       MachineFunction &mf, unsigned returnLabel) {
+    IRFunction fn(fnDef);
+    {
+        TimeScope timeScope(cs.trace, "IRBuilder", fnDef->identifier);
+        IRBuilder(&cs, fnDef, fn).build();
+    }
+    PassManager passes(&cs);
+    passes.addStandardPasses();
+    passes.run(fn);
+    if (cs.printIR) {
+        std::ostringstream os;
+        os << fn;
+        output.ir = os.str();
+    }
+
+    InstructionSelector isel(&cs, fn, output);
+    {
+        TimeScope timeScope(cs.trace, "InstructionSelector",
+                            fnDef->identifier);
+        isel.select(mf, returnLabel);
+    }
+    const long localsSize = (isel.frameSize + 15) / 16 * 16;
+    FrameLayout layout(isel.savedRegs, localsSize, isel.hasCalls);
+    layout.emit(mf, returnLabel);
+    output.stats.frameSize = localsSize;
+    output.stats.spills = isel.numSpills;
+}
+
+void FnDefNode::emit(CompileState &cs, FnOutput &output) {
+    TimeScope timeScope(cs.trace, "CodeGen", identifier);
+    MachineFunction mf(&identifier);
+    // The prologue depends on the frame size, so the entry block is filled in
+    // last
+    mf.startBlock(mf.newLabel("_" + identifier));
+    mf.startBlock();
+    const unsigned returnLabel = mf.newLabel("return_" + identifier);
+
+    if (cs.optLevel >= 1) {
+        emitFromIR(cs, this, output, mf, returnLabel);
+    } else {
+        emitFromAST(cs, output, mf, returnLabel);
+    }
+
+    PeepholeOptimizer(cs.peepholes).run(mf, output.stats.rewrites);
+    output.stats.collect(mf);
 
+    mf.print(output.out, cs.indent);
+
+    TimeScope dataScope(cs.trace, "StaticData", identifier);
+    for (StaticData *data : staticData) {
+        data->emit(output.data, cs.indent);
+    }
+}
+
+void FnDefNode::emitFromAST(CompileState &cs, FnOutput &output,
+                            MachineFunction &mf, unsigned returnLabel) {
     bool containsFnCalls = false;
     for (StatementNode *sNode : block) {
         containsFnCalls |= sNode->containsFnCalls();
     }
 
-    cs.pushFrame(this);
-    StackFrame *sf = cs.getTopFrame();
-    const long fnCallOffset = containsFnCalls ? 16 : 0;
+    StackFrame frame(&cs, this, &output);
+    StackFrame *sf = &frame;
+    sf->returnLabel = returnLabel;
+    sf->varRegs = RegisterAllocator(this).allocate();
+
+    std::vector<Register> savedRegs;
+    for (int reg : sf->varRegs) {
+        if (reg != RegisterAllocator::NoReg) {
+            savedRegs.push_back((Register)reg);
+        }
+    }
+    std::sort(savedRegs.begin(), savedRegs.end());
+    savedRegs.erase(std::unique(savedRegs.begin(), savedRegs.end()),
+                    savedRegs.end());
 
-    std::string statementsOutput = "";
-    for (int i = 0; i < paramList.size() && i < 8; i++) { // TODO: support more than 8 arguments
+    for (std::size_t i = 0; i < paramList.size() && i < 8; i++) { // TODO: support more than 8 arguments
         ParamNode *param = paramList[i];
-        sf->addVariable(param->type, param->identifier);
+        sf->addVariable(param->type, param->slot);
 
-        StackFrame::Reservation to = sf->getVariable(param->identifier);
+        StackFrame::Reservation to = sf->getVariable(param->slot);
         auto from = StackFrame::Reservation(param->type, (Register)i);
-        statementsOutput += from.emitCopyTo(to);
+        from.emitCopyTo(mf, to);
     }
 
-    if (identifier == "main") {
-        auto *zero = new LiteralNode(0l);
-        auto *retVal = new ExprNode(zero);
-        auto *retStatement = new StatementNode(retVal);
-        block.push_back(retStatement);
+    for (auto *sNode : block) {
+        sNode->emit(mf, sf);
     }
 
-    for (auto *sNode : block) {
-        statementsOutput += sNode->emit(sf);
+    // main returns 0 if it falls off the end
+    if (identifier == "main"
+            && (block.empty() || block.back()->kind != StatementNode::Return)) {
+        auto ret = StackFrame::Reservation(returnType, Register::x0);
+        ret.emitPutValue(mf, 0);
+        mf.emit(Opcode::B, mLabel(sf->returnLabel));
     }
     while (sf->maxStackPos % 16 != 0) {
         sf->maxStackPos += 1;
     }
 
-    if (sf->maxStackPos > 0 || containsFnCalls) {
-        ios << "sub sp, sp, #" << sf->maxStackPos + fnCallOffset << '\n';
-    }
-    if (containsFnCalls) {
-        ios << "stp fp, lr, [sp, #" << sf->maxStackPos << "]\n";
-        ios << "add fp, sp, #" << sf->maxStackPos << '\n';
-    }
-
-    ios << statementsOutput;
-    cs.os << "return_" << identifier << ":\n";
-
-    if (containsFnCalls) {
-        ios << "ldp fp, lr, [sp, #" << sf->maxStackPos << "]\n";
-    }
-    if (sf->maxStackPos > 0 || containsFnCalls) {
-        ios << "add sp, sp, #" << sf->maxStackPos + fnCallOffset << '\n';
-    }
-
-    cs.popFrame();
-    ios << "ret\n";
-    cs.os << '\n';
+    FrameLayout layout(savedRegs, sf->maxStackPos, containsFnCalls);
+    layout.emit(mf, returnLabel);
+    output.stats.frameSize = sf->maxStackPos;
+    output.stats.spills = sf->numSpilledExprs;
 }
@@ -18,11 +18,8 @@ IfNode::IfNode(ExprNode *condition,
           elseBlock(elseBlock) {}
 
 /*
-    ldr x16, [fp, #-24] ; where fp,#-24 is the condition expression
-    cmp x16, #0
-    cset x16, eq
-    tbnz x16, #0, IF_FALSE_0
-    b IF_TRUE_0
+    cmp x8, x9          ; or cbz, see StackFrame::emitCondBranch
+    b.ge IF_FALSE_0     ; where the condition is x8 < x9
 IF_TRUE_0:
     ; (run if true)
     b IF_EXIT_0
@@ -31,34 +28,28 @@ IF_FALSE_0:
     b IF_EXIT_0
 IF_EXIT_0:
 */
-std::string IfNode::emit(StackFrame *sf) {
-    std::string output = "";
-    const unsigned long labelId = (sf->cs->numIfs)++;
-    const std::string labelIdStr = std::to_string(labelId);
+void IfNode::emit(MachineFunction &mf, StackFrame *sf) {
+    const std::string labelId = std::to_string((sf->numIfs)++);
+    const std::string &fnName = sf->fnDef->identifier;
+    const unsigned trueLabel = mf.newLabel(fnName + "_IF_TRUE_" + labelId);
+    const unsigned falseLabel = mf.newLabel(fnName + "_IF_FALSE_" + labelId);
+    const unsigned exitLabel = mf.newLabel(fnName + "_IF_EXIT_" + labelId);
 
-    TypeNode condType = TypeNode(LiteralType::Int);
-    auto condRes = StackFrame::Reservation(&condType, Register::x16);
-
-    output += condRes.emitFromExprNode(sf, condition);
-    output += "cmp x16, #0\n"
-              "cset x16, eq\n"
-              "tbnz x16, #0, IF_FALSE_" + labelIdStr + "\n"
-              "b IF_TRUE_" + labelIdStr + "\n"
-              "IF_TRUE_" + labelIdStr + ":\n";
+    sf->emitCondBranch(mf, condition, false, falseLabel);
 
+    mf.startBlock(trueLabel);
     for (auto *statement : block) {
-        output += statement->emit(sf);
+        statement->emit(mf, sf);
     }
+    mf.emit(Opcode::B, mLabel(exitLabel));
 
-    output += "b IF_EXIT_" + labelIdStr + "\n"
-              "IF_FALSE_" + labelIdStr + ":\n";
+    mf.startBlock(falseLabel);
     for (auto *statement : elseBlock) {
-        output += statement->emit(sf);
+        statement->emit(mf, sf);
     }
+    mf.emit(Opcode::B, mLabel(exitLabel));
 
-    output += "b IF_EXIT_" + labelIdStr + "\n"
-              "IF_EXIT_" + labelIdStr + ":\n";
-    return output;
+    mf.startBlock(exitLabel);
 }
 
 bool IfNode::containsFnCalls() {
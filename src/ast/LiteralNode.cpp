@@ -9,6 +9,14 @@ LiteralNode::LiteralNode(char c)
         : type(LiteralType::Char),
           c(c) {}
 
+long LiteralNode::value() {
+    switch (type) {
+        case LiteralType::Int: return i;
+        case LiteralType::Char: return c;
+    }
+    return 0;
+}
+
 std::ostream &operator<<(std::ostream &os, LiteralNode &node) {
     os << "LiteralNode ";
     switch (node.type) {
@@ -1,10 +1,11 @@
 #include "ast/ast.hpp"
 #include "util.hpp"
 
-ParamNode::ParamNode(TypeNode *type, std::string identifier)
+ParamNode::ParamNode(TypeNode *type, Symbol *identifier, unsigned slot)
         : type(type),
-          identifier(identifier) {
-    if (*type == TypeNode(BuiltinType::Void)) {
+          identifier(identifier),
+          slot(slot) {
+    if (type->isVoid()) {
         std::cerr << "ERROR: Can't declare parameter with void type\n";
         exit(EXIT_FAILURE);
     }
@@ -12,6 +13,6 @@ ParamNode::ParamNode(TypeNode *type, std::string identifier)
 
 std::ostream &operator<<(std::ostream &os, ParamNode &node) {
     os << "ParamNode: (";
-    os << *(node.type) << ") " << node.identifier;
+    os << *(node.type) << ") " << node.identifier->name;
     return os;
 }
@@ -1,22 +1,25 @@
 #include "ast/ast.hpp"
 #include "util.hpp"
 
-StatementNode::StatementNode(TypeNode *type, std::string identifier)
+StatementNode::StatementNode(TypeNode *type, Symbol *identifier, unsigned slot)
         : kind(Declaration),
           type(type),
-          identifier(identifier) {
-    if (*type == TypeNode(BuiltinType::Void)) {
+          identifier(identifier),
+          slot(slot) {
+    if (type->isVoid()) {
         std::cerr << "ERROR: Can't declare variable with void type\n";
         exit(EXIT_FAILURE);
     }
 }
 
-StatementNode::StatementNode(TypeNode *type, std::string identifier, ExprNode *expr)
+StatementNode::StatementNode(TypeNode *type, Symbol *identifier, unsigned slot,
+                             ExprNode *expr)
         : kind(Initialization),
           type(type),
           identifier(identifier),
+          slot(slot),
           expr(expr) {
-    if (*type == TypeNode(BuiltinType::Void)) {
+    if (type->isVoid()) {
         std::cerr << "ERROR: Can't declare variable with void type\n";
         exit(EXIT_FAILURE);
     }
@@ -51,26 +54,62 @@ StatementNode::StatementNode(StatementKind derivedKind)
     }
 }
 
-std::string StatementNode::emit(StackFrame *sf) {
-    std::string output = "";
+static bool readsSlot(ExprNode *expr, unsigned slot) {
+    switch (expr->kind) {
+        case ExprNode::Accessor:
+            if (expr->accessor->kind == AccessorNode::Identifier) {
+                return expr->accessor->slot == slot;
+            }
+            return readsSlot(expr->accessor->expr, slot);
+        case ExprNode::FnCall:
+            for (ExprNode *arg : expr->fnCall->argList) {
+                if (readsSlot(arg, slot)) { return true; }
+            }
+            return false;
+        case ExprNode::BinaryOp:
+            return readsSlot(expr->opr1, slot) || readsSlot(expr->opr2, slot);
+        case ExprNode::UnaryOp:
+            return readsSlot(expr->opr, slot);
+        case ExprNode::Array:
+            for (ExprNode *elem : *expr->array) {
+                if (readsSlot(elem, slot)) { return true; }
+            }
+            return false;
+        default:
+            return false;
+    }
+}
 
+// Whether expr can be evaluated straight into the register of the variable in
+// slot: either it doesn't read the variable, or it is x op y where only x
+// reads it, which is read in place before the result is written (x = x + 1).
+static bool computableInPlace(ExprNode *expr, unsigned slot) {
+    if (!readsSlot(expr, slot)) { return true; }
+    return expr->kind == ExprNode::BinaryOp
+        && expr->opr1->kind == ExprNode::Accessor
+        && expr->opr1->accessor->kind == AccessorNode::Identifier
+        && expr->opr1->accessor->slot == slot
+        && !readsSlot(expr->opr2, slot);
+}
+
+void StatementNode::emit(MachineFunction &mf, StackFrame *sf) {
     if (kind == StatementNode::FnCall && fnCall->identifier == "svc") {
-        for (int i = 1; i < fnCall->argList.size() && i < 8; i++) {
+        for (std::size_t i = 1; i < fnCall->argList.size() && i < 8; i++) {
             ExprNode *argNode = fnCall->argList[i];
             auto arg = StackFrame::Reservation(argNode->type, (Register)(i-1));
             if (argNode->containsFnCalls()) {
                 auto tmpRes = sf->reserveExpr(argNode->type);
-                output += tmpRes.emitFromExprNode(sf, argNode);
-                output += tmpRes.emitCopyTo(arg);
+                tmpRes.emitFromExprNode(mf, sf, argNode);
+                tmpRes.emitCopyTo(mf, arg);
                 sf->unreserveExpr();
             } else {
-                output += arg.emitFromExprNode(sf, argNode);
+                arg.emitFromExprNode(mf, sf, argNode);
             }
         }
-        TypeNode intType = TypeNode(BuiltinType::Int);
-        auto syscallRes = StackFrame::Reservation(&intType, Register::x16);
-        output += syscallRes.emitFromExprNode(sf, fnCall->argList[0]);
-        output += "svc #0\n";
+        auto syscallRes = StackFrame::Reservation(
+            sf->cs->types.get(BuiltinType::Int), Register::x16);
+        syscallRes.emitFromExprNode(mf, sf, fnCall->argList[0]);
+        mf.emit(Opcode::Svc, mImm(0));
         goto endStatement;
     }
 
@@ -79,26 +118,26 @@ std::string StatementNode::emit(StackFrame *sf) {
         for (auto &builtin : BUILTIN_FNS) {
             const std::string &name = builtin.second;
             if (name == fnCall->identifier) {
-                sf->cs->usedBuiltinFns.insert(builtin.first);
+                sf->output->usedBuiltinFns.insert(builtin.first);
             }
         }
 
         // TODO: use fnDef types instead of fnCall types, and allow more than 8 arguments
-        for (int i = 0; i < fnCall->argList.size() && i < 8; i++) {
+        for (std::size_t i = 0; i < fnCall->argList.size() && i < 8; i++) {
             ExprNode *argNode = fnCall->argList[i];
             auto arg = StackFrame::Reservation(argNode->type, (Register)i);
             if (argNode->containsFnCalls()) {
                 auto tmpRes = sf->reserveExpr(argNode->type);
-                output += tmpRes.emitFromExprNode(sf, argNode);
-                output += tmpRes.emitCopyTo(arg);
+                tmpRes.emitFromExprNode(mf, sf, argNode);
+                tmpRes.emitCopyTo(mf, arg);
                 sf->unreserveExpr();
             } else {
-                output += arg.emitFromExprNode(sf, argNode);
+                arg.emitFromExprNode(mf, sf, argNode);
             }
         }
-        output += sf->emitSaveCaller();
-        output += "bl _" + fnCall->identifier + "\n";
-        output += sf->emitLoadCaller();
+        sf->emitSaveCaller(mf);
+        mf.emit(Opcode::Bl, mSymbol(&fnCall->identifier));
+        sf->emitLoadCaller(mf);
         goto endStatement;
     }
 
@@ -107,33 +146,38 @@ std::string StatementNode::emit(StackFrame *sf) {
             auto ret = StackFrame::Reservation(expr->type, Register::x0);
             if (containsFnCalls()) {
                 auto tmpRes = sf->reserveExpr(expr->type);
-                output += tmpRes.emitFromExprNode(sf, expr);
-                output += tmpRes.emitCopyTo(ret);
+                tmpRes.emitFromExprNode(mf, sf, expr);
+                tmpRes.emitCopyTo(mf, ret);
             } else {
-                output += ret.emitFromExprNode(sf, expr);
+                ret.emitFromExprNode(mf, sf, expr);
             }
         }
-        output += "b return_" + sf->fnDef->identifier + "\n";
+        mf.emit(Opcode::B, mLabel(sf->returnLabel));
         goto endStatement;
     }
 
     if (kind == StatementNode::Declaration) {
-        sf->addVariable(type, identifier);
+        sf->addVariable(type, slot);
         goto endStatement;
     }
 
     if (kind == StatementNode::Initialization) {
-        sf->addVariable(type, identifier);
-        StackFrame::Reservation var = sf->getVariable(identifier);
-        output += var.emitFromExprNode(sf, expr);
+        sf->addVariable(type, slot);
+        StackFrame::Reservation var = sf->getVariable(slot);
+        var.emitFromExprNode(mf, sf, expr);
         goto endStatement;
     }
 
     if (kind == StatementNode::Assignment && accessor->kind == AccessorNode::Identifier) {
-        StackFrame::Reservation varRes = sf->getVariable(accessor->identifier);
+        StackFrame::Reservation varRes = sf->getVariable(accessor->slot);
+        if (varRes.kind == StackFrame::Reservation::Reg
+                && computableInPlace(expr, accessor->slot)) {
+            varRes.emitFromExprNode(mf, sf, expr);
+            goto endStatement;
+        }
         StackFrame::Reservation valRes = sf->reserveExpr(varRes.type);
-        output += valRes.emitFromExprNode(sf, expr);
-        output += valRes.emitCopyTo(varRes);
+        valRes.emitFromExprNode(mf, sf, expr);
+        valRes.emitCopyTo(mf, varRes);
         sf->unreserveExpr();
         goto endStatement;
     }
@@ -145,31 +189,7 @@ std::string StatementNode::emit(StackFrame *sf) {
             exit(EXIT_FAILURE);
         }
 
-        StackFrame::Reservation ptrRes = sf->reserveVariable(accessor->expr->type);
-        output += ptrRes.emitFromExprNode(sf, accessor->expr);
-        StackFrame::Reservation valRes = sf->reserveVariable(expr->type);
-        output += valRes.emitFromExprNode(sf, expr);
-
-        StackFrame::Reservation tmpPtrRes(ptrRes.type, Register::x16);
-        output += ptrRes.emitCopyTo(tmpPtrRes);
-        StackFrame::Reservation tmpValRes(ptrRes.type, Register::x17);
-        output += valRes.emitCopyTo(tmpValRes);
-
-        std::string strInstr, r;
-        switch (ptrRes.type->pointerType->size()) {
-             case 1:
-                 strInstr = "strb";
-                 r = "w";
-                 break;
-             default:
-                 strInstr = "str";
-                 r = "x";
-        }
-        output += strInstr + " " + toStr(tmpValRes.location.reg, r) + ", ["
-                  + toStr(tmpPtrRes.location.reg) + "]\n";
-
-        sf->unreserveVariable();  // unreserve valRes
-        sf->unreserveVariable();  // unreserve ptrRes
+        sf->emitStore(mf, accessor->expr, expr);
         goto endStatement;
     }
 
@@ -178,13 +198,13 @@ std::string StatementNode::emit(StackFrame *sf) {
     exit(EXIT_FAILURE);
 
 endStatement:
-    return output;
+    return;
 }
 
 bool StatementNode::containsFnCalls() {
     return kind == FnCall
-        || (kind == Initialization || kind == Assignment || kind == Return)
-            && expr->containsFnCalls();
+        || ((kind == Initialization || kind == Assignment || kind == Return)
+            && expr->containsFnCalls());
 }
 
 bool StatementNode::isDerived() {
@@ -199,11 +219,11 @@ std::ostream &operator<<(std::ostream &os, StatementNode &node) {
     switch (node.kind) {
         case StatementNode::Declaration:
             os << "Declaration): (";
-            os << *(node.type) << ") " << node.identifier;
+            os << *(node.type) << ") " << node.identifier->name;
             break;
         case StatementNode::Initialization:
             os << "Initialization): (";
-            os << *(node.type) << ") " << node.identifier;
+            os << *(node.type) << ") " << node.identifier->name;
             ios << '\n' << *(node.expr);
             break;
         case StatementNode::Assignment:
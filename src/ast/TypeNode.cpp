@@ -3,21 +3,24 @@
 
 TypeNode::TypeNode(BuiltinType builtinType)
         : kind(Builtin),
-          builtinType(builtinType) {}
-
-TypeNode::TypeNode(LiteralType literalType)
-        : kind(Builtin),
-          builtinType(toBuiltinType(literalType)) {}
+          builtinType(builtinType),
+          cachedSize(computeSize()) {}
 
 TypeNode::TypeNode(std::string customType)
         : kind(Custom),
-          customType(customType) {}
+          customType(customType),
+          cachedSize(computeSize()) {}
 
 TypeNode::TypeNode(TypeNode *pointerType)
         : kind(Pointer),
-          pointerType(pointerType) {}
+          pointerType(pointerType),
+          cachedSize(computeSize()) {}
 
 unsigned TypeNode::size() {
+    return cachedSize;
+}
+
+unsigned TypeNode::computeSize() {
     if (kind == Custom) {
         return 0;
     }
@@ -36,8 +39,12 @@ unsigned TypeNode::size() {
     }
 }
 
+bool TypeNode::isVoid() {
+    return kind == Builtin && builtinType == BuiltinType::Void;
+}
+
 bool TypeNode::validOp(BuiltinOperator op, TypeNode *otherType) {
-    if (*this == TypeNode(BuiltinType::Void)) { return false; }
+    if (isVoid()) { return false; }
 
     if (kind == Pointer) {
         switch (op) {
@@ -60,7 +67,7 @@ bool TypeNode::validOp(BuiltinOperator op, TypeNode *otherType) {
 }
 
 bool TypeNode::validOp(BuiltinOperator op) {
-    if (*this == TypeNode(BuiltinType::Void)) { return false; }
+    if (isVoid()) { return false; }
 
     if (kind == Pointer) {
         switch (op) {
@@ -77,23 +84,6 @@ bool TypeNode::validOp(BuiltinOperator op) {
     return true;
 }
 
-bool TypeNode::operator==(const TypeNode &other) const {
-    if (kind != other.kind) { return false; }
-
-    switch (kind) {
-        case Builtin:
-            return builtinType == other.builtinType;
-        case Custom:
-            return customType == other.customType;
-        case Pointer:
-            return *pointerType == *other.pointerType;
-    }
-}
-
-bool TypeNode::operator!=(const TypeNode &other) const {
-    return !(*this == other);
-}
-
 std::ostream &operator<<(std::ostream &os, TypeNode &node) {
     os << "TypeNode: ";
     switch (node.kind) {
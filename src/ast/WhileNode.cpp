@@ -11,43 +11,38 @@ WhileNode::WhileNode(ExprNode *condition, std::vector<StatementNode *> block)
           block(block) {}
 
 /*
-WHILE_COND_0:
-    ldr x16, [fp #-24] ; where fp,#-24 is the condition expression
-    cmp x16, #0
-    cset x16, eq
-    tbnz x16, #0, WHILE_EXIT_0
-    b WHILE_BODY_0
+Rotated, so that each iteration takes one branch:
+    cmp x8, x9          ; guard, see StackFrame::emitCondBranch
+    b.ge WHILE_EXIT_0   ; where the condition is x8 < x9
 WHILE_BODY_0:
     ; (body of loop)
-    b WHILE_COND_0
+WHILE_COND_0:
+    cmp x8, x9
+    b.lt WHILE_BODY_0
 WHILE_EXIT_0:
     ; (after the loop)
 */
-std::string WhileNode::emit(StackFrame *sf) {
-    std::string output = "";
-    const unsigned long labelId = (sf->cs->numWhiles)++;
-    sf->loopIds.push_back(labelId);
-    const std::string labelIdStr = std::to_string(labelId);
+void WhileNode::emit(MachineFunction &mf, StackFrame *sf) {
+    const std::string labelId = std::to_string((sf->numWhiles)++);
+    const std::string &fnName = sf->fnDef->identifier;
+    const unsigned condLabel = mf.newLabel(fnName + "_WHILE_COND_" + labelId);
+    const unsigned bodyLabel = mf.newLabel(fnName + "_WHILE_BODY_" + labelId);
+    const unsigned exitLabel = mf.newLabel(fnName + "_WHILE_EXIT_" + labelId);
+    // continue goes to the test at the bottom
+    sf->loopLabels.emplace_back(condLabel, exitLabel);
 
-    TypeNode condType = TypeNode(LiteralType::Int);
-    auto condRes = StackFrame::Reservation(&condType, Register::x16);
-
-    output += "WHILE_COND_" + labelIdStr + ":\n";
-    output += condRes.emitFromExprNode(sf, condition);
-    output += "cmp x16, #0\n"
-              "cset x16, eq\n"
-              "tbnz x16, #0, WHILE_EXIT_" + labelIdStr + "\n"
-              "b WHILE_BODY_" + labelIdStr + "\n"
-              "WHILE_BODY_" + labelIdStr + ":\n";
+    sf->emitCondBranch(mf, condition, false, exitLabel);
 
+    mf.startBlock(bodyLabel);
     for (auto *statement : block) {
-        output += statement->emit(sf);
+        statement->emit(mf, sf);
     }
-    output += "b WHILE_COND_" + labelIdStr + "\n"
-              "WHILE_EXIT_" + labelIdStr + ":\n";
 
-    sf->loopIds.pop_back();
-    return output;
+    mf.startBlock(condLabel);
+    sf->emitCondBranch(mf, condition, true, bodyLabel);
+
+    mf.startBlock(exitLabel);
+    sf->loopLabels.pop_back();
 }
 
 bool WhileNode::containsFnCalls() {
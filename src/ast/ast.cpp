@@ -15,7 +15,7 @@ std::ostream &operator<<(std::ostream &os, BuiltinOperator &op) {
         case BuiltinOperator::Minus:   return os << "Minus";
         case BuiltinOperator::Star:    return os << "Star";
         case BuiltinOperator::Fslash:  return os << "Fslash";
-        case BuiltinOperator::Percent: return os << "Percent";  // not used
+        case BuiltinOperator::Percent: return os << "Percent";
         case BuiltinOperator::Eq:      return os << "Eq";
         case BuiltinOperator::Ne:      return os << "Ne";
         case BuiltinOperator::Lt:      return os << "Lt";
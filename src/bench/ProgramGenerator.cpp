@@ -0,0 +1,255 @@
+#include <string>
+#include "bench/ProgramGenerator.hpp"
+
+static const unsigned NUM_LOCALS = 4;
+
+static const char *BINARY_OPS[] = {
+    "+", "-", "*", "/", "%", "==", "!=", "<", ">", "<=", ">=", "&", "|", "^",
+};
+static const char *DEEP_OPS[] = { "+", "-", "&", "|", "^" };
+static const char *UNARY_OPS[] = { "-", "!", "~" };
+
+ProgramGenerator::ProgramGenerator(Options options, std::uint64_t seed)
+        : options(options),
+          state(seed) {}
+
+// splitmix64, so the output is the same with every standard library
+unsigned ProgramGenerator::next(unsigned bound) {
+    std::uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    z ^= z >> 31;
+    return bound ? (unsigned)(z % bound) : 0;
+}
+
+std::string ProgramGenerator::generate() {
+    out.clear();
+    for (fnIndex = 0; fnIndex < options.numFunctions; fnIndex++) {
+        function();
+    }
+    main();
+    return out;
+}
+
+void ProgramGenerator::line(unsigned depth) {
+    out.append(4 * depth, ' ');
+}
+
+/* SECTION: Declarations */
+
+void ProgramGenerator::function() {
+    out += "int f" + std::to_string(fnIndex) + "(int a, int b) {\n";
+
+    for (numLocals = 0; numLocals < NUM_LOCALS; numLocals++) {
+        line(1);
+        out += "int v" + std::to_string(numLocals) + " = ";
+        expr(1);
+        out += ";\n";
+    }
+
+    line(1);
+    out += "int *arr = {";
+    for (unsigned i = 0; i < options.arraySize; i++) {
+        if (i > 0) { out += ", "; }
+        out += std::to_string(next(1000));
+    }
+    out += "};\n";
+
+    line(1);
+    out += "char *str = \"";
+    for (unsigned i = 0; i < options.stringLength; i++) {
+        unsigned c = next(32);
+        if (c < 26) { out += (char)('a' + c); }
+        else if (c < 30) { out += ' '; }
+        else if (c == 30) { out += "\\n"; }
+        else { out += "\\\""; }
+    }
+    out += "\";\n";
+
+    // Right-leaning, so every level holds a temporary and the deepest ones
+    // spill to the stack
+    line(1);
+    out += "v3 = ";
+    for (unsigned i = 0; i < options.deepExprDepth; i++) {
+        leaf();
+        out += ' ';
+        out += DEEP_OPS[next(sizeof(DEEP_OPS) / sizeof(*DEEP_OPS))];
+        out += " (";
+    }
+    leaf();
+    out.append(options.deepExprDepth, ')');
+    out += ";\n";
+
+    block(1, options.nestingDepth);
+
+    line(1);
+    out += "return ";
+    expr(options.exprDepth);
+    out += ";\n}\n\n";
+}
+
+void ProgramGenerator::main() {
+    out += "int main() {\n";
+    line(1);
+    out += "printi(" + std::to_string(options.numFunctions) + ");\n";
+    // Never taken, as the generated functions aren't meant to be run
+    if (options.numFunctions > 0) {
+        line(1);
+        out += "if (0) {\n";
+        line(2);
+        out += "printi(f" + std::to_string(options.numFunctions - 1)
+               + "(1, 2));\n";
+        line(1);
+        out += "}\n";
+    }
+    line(1);
+    out += "return 0;\n}\n";
+}
+
+/* SECTION: Statements */
+
+void ProgramGenerator::block(unsigned depth, unsigned nesting) {
+    unsigned numStatements = depth == 1 ? options.statementsPerBlock
+                                        : options.statementsPerBlock / 3 + 1;
+    for (unsigned i = 0; i < numStatements; i++) {
+        statement(depth, nesting);
+    }
+}
+
+void ProgramGenerator::statement(unsigned depth, unsigned nesting) {
+    unsigned kind = next(10);
+    if (kind >= 6 && kind <= 7 && nesting == 0) { kind = 0; }
+    if (kind == 8 && loopDepth == 0) { kind = 1; }
+
+    line(depth);
+    switch (kind) {
+        case 3:
+            out += "arr[";
+            local();
+            out += "] = ";
+            expr(options.exprDepth);
+            out += ";\n";
+            break;
+        case 4:
+            if (fnIndex > 0) {
+                local();
+                out += " = f" + std::to_string(next(fnIndex)) + "(";
+                expr(options.exprDepth / 2);
+                out += ", ";
+                expr(options.exprDepth / 2);
+                out += ");\n";
+                break;
+            }
+            // Fall through
+        case 5:
+            out += "printi(";
+            expr(options.exprDepth);
+            out += ");\n";
+            break;
+        case 6:
+            out += "if (";
+            expr(options.exprDepth);
+            out += ") {\n";
+            block(depth + 1, nesting - 1);
+            line(depth);
+            if (next(2)) {
+                out += "} else {\n";
+                block(depth + 1, nesting - 1);
+                line(depth);
+            }
+            out += "}\n";
+            break;
+        case 7: {
+            std::string counter = "v" + std::to_string(next(NUM_LOCALS));
+            out += "while (" + counter + " < "
+                   + std::to_string(next(100)) + ") {\n";
+            loopDepth++;
+            block(depth + 1, nesting - 1);
+            loopDepth--;
+            line(depth + 1);
+            out += counter + " = " + counter + " + 1;\n";
+            line(depth);
+            out += "}\n";
+            break;
+        }
+        case 8:
+            out += "if (";
+            expr(1);
+            out += next(2) ? ") break;\n" : ") continue;\n";
+            break;
+        default:
+            local();
+            out += " = ";
+            expr(options.exprDepth);
+            out += ";\n";
+            break;
+    }
+}
+
+/* SECTION: Expressions */
+
+void ProgramGenerator::expr(unsigned depth) {
+    if (depth == 0 || next(4) == 0) {
+        leaf();
+        return;
+    }
+    if (next(8) == 0) {
+        out += UNARY_OPS[next(sizeof(UNARY_OPS) / sizeof(*UNARY_OPS))];
+        out += '(';
+        expr(depth - 1);
+        out += ')';
+        return;
+    }
+    out += '(';
+    expr(depth - 1);
+    out += ' ';
+    out += BINARY_OPS[next(sizeof(BINARY_OPS) / sizeof(*BINARY_OPS))];
+    out += ' ';
+    expr(depth - 1);
+    out += ')';
+}
+
+void ProgramGenerator::leaf() {
+    // The array and string are only declared after the first locals
+    unsigned kind = next(numLocals < NUM_LOCALS ? 3 : 10);
+    switch (kind) {
+        case 0:
+            out += std::to_string(next(1000));
+            break;
+        case 1:
+            out += next(2) ? "a" : "b";
+            break;
+        case 2:
+            out += '\'';
+            out += (char)('a' + next(26));
+            out += '\'';
+            break;
+        case 3:
+            out += "arr[";
+            local();
+            out += ']';
+            break;
+        case 4:
+            out += "str[";
+            local();
+            out += ']';
+            break;
+        case 5:
+            if (fnIndex > 0) {
+                out += "f" + std::to_string(next(fnIndex)) + "(";
+                local();
+                out += ", ";
+                local();
+                out += ')';
+                break;
+            }
+            // Fall through
+        default:
+            local();
+            break;
+    }
+}
+
+void ProgramGenerator::local() {
+    out += "v" + std::to_string(next(NUM_LOCALS));
+}
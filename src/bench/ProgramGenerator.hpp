@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+/*
+  Generates large, valid qcc programs for benchmarking the compiler. The
+  output depends only on the options and the seed (the generator doesn't use
+  the standard distributions, which differ between standard libraries), so a
+  given configuration is a fixed baseline across machines and versions.
+
+  Every function exercises the whole grammar: parameters and locals, a large
+  array initializer, a long string literal, nested if/else and while with
+  break/continue, calls to earlier functions and builtins, and expression
+  trees of every operator.
+*/
+class ProgramGenerator {
+public:
+    struct Options {
+        unsigned numFunctions = 200;
+        unsigned statementsPerBlock = 12;
+        unsigned nestingDepth = 3;    // Of if/while blocks
+        unsigned exprDepth = 5;       // Of ordinary expression trees
+        unsigned deepExprDepth = 40;  // Of one right-leaning tree per function
+        unsigned arraySize = 64;      // Elements per array initializer
+        unsigned stringLength = 256;  // Characters per string literal
+    };
+
+    ProgramGenerator(Options options, std::uint64_t seed);
+
+    std::string generate();
+
+private:
+    Options options;
+    std::uint64_t state;
+    std::string out;
+    unsigned fnIndex = 0;
+    unsigned numLocals = 0;
+    unsigned loopDepth = 0;
+
+    unsigned next(unsigned bound);
+
+    void line(unsigned depth);
+    void function();
+    void main();
+    void block(unsigned depth, unsigned nesting);
+    void statement(unsigned depth, unsigned nesting);
+    void expr(unsigned depth);
+    void leaf();
+    void local();
+};
@@ -0,0 +1,331 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "parse/driver.hpp"
+#include "ast/ast.hpp"
+#include "bench/ProgramGenerator.hpp"
+#include "CompileState.hpp"
+#include "util.hpp"
+
+/*
+  Compiler throughput benchmark. Compiles one program (generated, or given
+  on the command line) several times and reports, per phase, the median
+  time and its variance, throughput at the median, and the peak RSS while
+  the phase ran:
+    lex      tokens/s  (scanner only)
+    parse    tokens/s and AST nodes/s  (scanner and parser)
+    codegen  AST nodes/s and emitted bytes/s
+*/
+
+typedef std::chrono::steady_clock Clock;
+
+/* SECTION: Measurement */
+
+// Resets the peak RSS so that it can be measured per phase. Only Linux can
+// do this; elsewhere the peak covers the whole run so far.
+static void resetPeakRss() {
+    std::FILE *f = std::fopen("/proc/self/clear_refs", "w");
+    if (f) {
+        std::fputs("5", f);
+        std::fclose(f);
+    }
+}
+
+// In KiB
+static long peakRss() {
+    std::FILE *f = std::fopen("/proc/self/status", "r");
+    if (f) {
+        char line[256];
+        long kb = -1;
+        while (std::fgets(line, sizeof(line), f)) {
+            if (std::strncmp(line, "VmHWM:", 6) == 0) {
+                kb = std::strtol(line + 6, nullptr, 10);
+                break;
+            }
+        }
+        std::fclose(f);
+        if (kb >= 0) { return kb; }
+    }
+
+    struct rusage usage;
+    ::getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+}
+
+struct Phase {
+    const char *name;
+    std::vector<double> seconds;
+    long peakRssKB = 0;
+
+    explicit Phase(const char *name) : name(name) {}
+
+    double median() const {
+        std::vector<double> sorted = seconds;
+        std::sort(sorted.begin(), sorted.end());
+        std::size_t n = sorted.size();
+        return n % 2 ? sorted[n / 2]
+                     : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+    }
+
+    double variance() const {
+        double mean = 0;
+        for (double s : seconds) { mean += s; }
+        mean /= seconds.size();
+        double sum = 0;
+        for (double s : seconds) { sum += (s - mean) * (s - mean); }
+        return seconds.size() > 1 ? sum / (seconds.size() - 1) : 0;
+    }
+};
+
+template <typename Fn>
+static void measure(Phase &phase, bool record, Fn fn) {
+    resetPeakRss();
+    auto start = Clock::now();
+    fn();
+    auto end = Clock::now();
+    if (!record) { return; }
+    phase.seconds.push_back(std::chrono::duration<double>(end - start).count());
+    phase.peakRssKB = std::max(phase.peakRssKB, peakRss());
+}
+
+/* SECTION: AST node counting */
+
+static unsigned long countExpr(ExprNode *expr);
+
+static unsigned long countFnCall(FnCallNode *fnCall) {
+    unsigned long n = 1;
+    for (ExprNode *arg : fnCall->argList) { n += countExpr(arg); }
+    return n;
+}
+
+static unsigned long countAccessor(AccessorNode *accessor) {
+    return 1 + (accessor->kind == AccessorNode::Dereference
+                ? countExpr(accessor->expr) : 0);
+}
+
+static unsigned long countExpr(ExprNode *expr) {
+    switch (expr->kind) {
+        case ExprNode::Literal: return 2;
+        case ExprNode::Accessor: return 1 + countAccessor(expr->accessor);
+        case ExprNode::FnCall: return 1 + countFnCall(expr->fnCall);
+        case ExprNode::BinaryOp:
+            return 1 + countExpr(expr->opr1) + countExpr(expr->opr2);
+        case ExprNode::UnaryOp: return 1 + countExpr(expr->opr);
+        case ExprNode::Array: {
+            unsigned long n = 1;
+            for (ExprNode *elem : *expr->array) { n += countExpr(elem); }
+            return n;
+        }
+        case ExprNode::Static:
+        case ExprNode::Empty:
+            return 1;
+    }
+    return 1;
+}
+
+static unsigned long countBlock(std::vector<StatementNode *> &block);
+
+static unsigned long countStatement(StatementNode *statement) {
+    switch (statement->kind) {
+        case StatementNode::Initialization:
+        case StatementNode::Return:
+            return 1 + countExpr(statement->expr);
+        case StatementNode::Assignment:
+            return 1 + countAccessor(statement->accessor)
+                     + countExpr(statement->expr);
+        case StatementNode::FnCall:
+            return 1 + countFnCall(statement->fnCall);
+        case StatementNode::If: {
+            IfNode *ifNode = static_cast<IfNode *>(statement);
+            return 1 + countExpr(ifNode->condition)
+                     + countBlock(ifNode->block)
+                     + countBlock(ifNode->elseBlock);
+        }
+        case StatementNode::While: {
+            WhileNode *whileNode = static_cast<WhileNode *>(statement);
+            return 1 + countExpr(whileNode->condition)
+                     + countBlock(whileNode->block);
+        }
+        default:
+            return 1;
+    }
+}
+
+static unsigned long countBlock(std::vector<StatementNode *> &block) {
+    unsigned long n = 0;
+    for (StatementNode *statement : block) { n += countStatement(statement); }
+    return n;
+}
+
+/* SECTION: Phases */
+
+static unsigned long lexFile(const std::string &path) {
+    CompileState cs;
+    Driver drv("qcc_bench", &cs);
+    drv.file = path;
+    drv.location.initialize(&drv.file);
+
+    unsigned long tokens = 0;
+    drv.scan_begin();
+    while (yylex(drv, drv.scanner).kind() != yy::parser::symbol_kind::S_YYEOF) {
+        tokens++;
+    }
+    drv.scan_end();
+    return tokens;
+}
+
+static void printRow(const Phase &phase, const char *unit1, double amount1,
+                     const char *unit2, double amount2) {
+    double median = phase.median();
+    double stddev = std::sqrt(phase.variance());
+    char line[256];
+    std::snprintf(line, sizeof(line),
+                  "%-8s %10.3f %12.6f %6.1f%% %12.0f %-8s %12.0f %-8s %8ld\n",
+                  phase.name, median * 1000, phase.variance() * 1e6,
+                  median > 0 ? stddev * 100 / median : 0.0,
+                  median > 0 ? amount1 / median : 0.0, unit1,
+                  median > 0 ? amount2 / median : 0.0, unit2,
+                  phase.peakRssKB);
+    std::cout << line;
+}
+
+int main(int argc, char *argv[]) {
+    ProgramGenerator::Options options;
+    std::uint64_t seed = 1;
+    unsigned iterations = 7;
+    unsigned warmup = 1;
+    unsigned numThreads = 1;
+    const char *emitPath = nullptr;
+    std::string inputPath;
+    for (int i = 1; i < argc; i++) {
+        auto numArg = [&]() { return std::strtoul(argv[++i], nullptr, 10); };
+        bool hasArg = i + 1 < argc;
+        if (argv[i] == std::string("-n") && hasArg) { iterations = numArg(); }
+        else if (argv[i] == std::string("-warmup") && hasArg) {
+            warmup = numArg();
+        }
+        else if (argv[i] == std::string("-j") && hasArg) {
+            numThreads = numArg();
+            if (numThreads == 0) {
+                numThreads = std::thread::hardware_concurrency();
+            }
+        }
+        else if (argv[i] == std::string("-seed") && hasArg) { seed = numArg(); }
+        else if (argv[i] == std::string("-functions") && hasArg) {
+            options.numFunctions = numArg();
+        }
+        else if (argv[i] == std::string("-statements") && hasArg) {
+            options.statementsPerBlock = numArg();
+        }
+        else if (argv[i] == std::string("-nesting") && hasArg) {
+            options.nestingDepth = numArg();
+        }
+        else if (argv[i] == std::string("-expr-depth") && hasArg) {
+            options.exprDepth = numArg();
+        }
+        else if (argv[i] == std::string("-deep-expr") && hasArg) {
+            options.deepExprDepth = numArg();
+        }
+        else if (argv[i] == std::string("-array") && hasArg) {
+            options.arraySize = numArg();
+        }
+        else if (argv[i] == std::string("-string") && hasArg) {
+            options.stringLength = numArg();
+        }
+        else if (argv[i] == std::string("-emit") && hasArg) {
+            emitPath = argv[++i];
+        }
+        else if (argv[i][0] != '-') { inputPath = argv[i]; }
+        else {
+            std::cerr << "ERROR: Unknown option " << argv[i] << '\n';
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (iterations == 0) { iterations = 1; }
+
+    // Generated programs are compiled from a file, like real input
+    const bool generated = inputPath.empty();
+    if (generated) {
+        std::string program = ProgramGenerator(options, seed).generate();
+        inputPath = emitPath ? emitPath
+                             : "/tmp/qcc_bench." + std::to_string(::getpid())
+                               + ".q";
+        std::ofstream file(inputPath, std::ios::binary);
+        file << program;
+        if (!file.good()) {
+            std::cerr << "ERROR: Couldn't write " << inputPath << '\n';
+            exit(EXIT_FAILURE);
+        }
+        if (emitPath) { return 0; }
+    }
+
+    Phase lex("lex"), parse("parse"), codegen("codegen");
+    unsigned long tokens = 0, nodes = 0, bytes = 0;
+    for (unsigned i = 0; i < warmup + iterations; i++) {
+        bool record = i >= warmup;
+
+        measure(lex, record, [&]() { tokens = lexFile(inputPath); });
+
+        std::unique_ptr<CompileState> cs(new CompileState());
+        std::unique_ptr<Driver> drv(new Driver("qcc_bench", cs.get()));
+        int res = 0;
+        measure(parse, record, [&]() { res = drv->parse(inputPath); });
+        if (res != 0 || drv->res != 0) {
+            std::cerr << "ERROR: Couldn't parse " << inputPath << '\n';
+            exit(EXIT_FAILURE);
+        }
+        nodes = 0;
+        for (FnDefNode *fnDef : drv->fnDefNodes) {
+            nodes += 1 + fnDef->paramList.size() + countBlock(fnDef->block);
+        }
+
+        std::vector<FnOutput> fnOutputs(drv->fnDefNodes.size());
+        measure(codegen, record, [&]() {
+            util::parallelFor(fnOutputs.size(), numThreads,
+                              [&](std::size_t i) {
+                drv->fnDefNodes[i]->emit(*cs, fnOutputs[i]);
+            });
+        });
+        bytes = 0;
+        for (FnOutput &fnOutput : fnOutputs) {
+            bytes += fnOutput.out.size() + fnOutput.data.size();
+        }
+    }
+
+    struct stat st;
+    const unsigned long bytesRead =
+        ::stat(inputPath.c_str(), &st) == 0 ? st.st_size : 0;
+    if (generated) { ::unlink(inputPath.c_str()); }
+
+    std::cout << "Input: " << inputPath << ", " << bytesRead << " bytes, "
+              << tokens << " tokens, " << nodes << " AST nodes, "
+              << bytes << " bytes emitted\n"
+              << "Runs: " << iterations << " (after " << warmup
+              << " warmup), " << numThreads << " codegen thread(s)\n\n";
+
+    char header[256];
+    std::snprintf(header, sizeof(header),
+                  "%-8s %10s %12s %7s %21s %21s %8s\n",
+                  "Phase", "Median ms", "Var ms^2", "CV",
+                  "Throughput", "", "RSS KiB");
+    std::cout << header;
+    printRow(lex, "tokens/s", tokens, "bytes/s", bytesRead);
+    printRow(parse, "tokens/s", tokens, "nodes/s", nodes);
+    printRow(codegen, "nodes/s", nodes, "bytes/s", bytes);
+}
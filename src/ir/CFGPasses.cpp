@@ -0,0 +1,168 @@
+#include <algorithm>
+#include <vector>
+#include "ast/ast.hpp"
+#include "ir/ir.hpp"
+
+static bool hasPhis(IRBlock *block) {
+    return !block->instrs.empty()
+        && block->instrs.front()->opcode == IROpcode::Phi;
+}
+
+static bool isPlaced(IRFunction &fn, IRBlock *block) {
+    return std::find(fn.blocks.begin(), fn.blocks.end(), block)
+        != fn.blocks.end();
+}
+
+/* SECTION: SimplifyCFG */
+
+bool SimplifyCFG::run(IRFunction &fn) {
+    bool changed = false, changedNow = true;
+    while (changedNow) {
+        changedNow = false;
+        // Blocks may be removed along the way
+        std::vector<IRBlock *> blocks = fn.blocks;
+        for (IRBlock *block : blocks) {
+            if (!isPlaced(fn, block)) { continue; }
+            changedNow |= foldBranch(block);
+            changedNow |= skipEmptyBlock(fn, block)
+                || mergeIntoPred(fn, block);
+        }
+        changed |= changedNow;
+    }
+    return changed;
+}
+
+/*
+    condbr %c, bb1, bb2    ; %c = const 1   →   br bb1
+    condbr %c, bb1, bb1                     →   br bb1
+*/
+bool SimplifyCFG::foldBranch(IRBlock *block) {
+    IRInstr *term = block->terminator();
+    if (term->opcode != IROpcode::CondBr) { return false; }
+
+    long value;
+    IRBlock *target;
+    if (term->blocks[0] == term->blocks[1]) {
+        target = term->blocks[0];
+    } else if (term->operands[0]->isConst(value)) {
+        target = term->blocks[value != 0 ? 0 : 1];
+        IRBlock *notTaken = term->blocks[value != 0 ? 1 : 0];
+        notTaken->preds.erase(std::find(notTaken->preds.begin(),
+                                        notTaken->preds.end(), block));
+        for (IRInstr *instr : notTaken->instrs) {
+            if (instr->opcode != IROpcode::Phi) { break; }
+            instr->removeIncoming(block);
+        }
+    } else {
+        return false;
+    }
+
+    term->dropOperands();
+    term->opcode = IROpcode::Br;
+    term->blocks.assign(1, target);
+    return true;
+}
+
+// A block that only branches on is bypassed by its predecessors, unless one
+// of them also branches to the target directly and the target's phis would
+// need two values from it
+bool SimplifyCFG::skipEmptyBlock(IRFunction &fn, IRBlock *block) {
+    if (block == fn.blocks.front() || block->instrs.size() != 1
+            || block->preds.empty()
+            || block->terminator()->opcode != IROpcode::Br) {
+        return false;
+    }
+    IRBlock *target = block->terminator()->blocks[0];
+    if (target == block) { return false; }
+    if (hasPhis(target)) {
+        for (IRBlock *pred : block->preds) {
+            if (std::find(target->preds.begin(), target->preds.end(), pred)
+                    != target->preds.end()) {
+                return false;
+            }
+        }
+    }
+
+    // Whatever flowed into the target's phis from block now flows in from
+    // each of its predecessors. It is defined in a block that dominates
+    // block, and so dominates all of them too.
+    std::vector<IRBlock *> preds = block->preds;
+    for (IRBlock *pred : preds) {
+        pred->replaceSuccessor(block, target);
+        for (IRInstr *phi : target->instrs) {
+            if (phi->opcode != IROpcode::Phi) { break; }
+            phi->addOperand(phi->incoming(block));
+            phi->blocks.push_back(pred);
+        }
+    }
+    fn.eraseBlock(block);
+    return true;
+}
+
+// A block with one predecessor, which has no other successor, joins the end
+// of that predecessor
+bool SimplifyCFG::mergeIntoPred(IRFunction &fn, IRBlock *block) {
+    if (block == fn.blocks.front() || block->preds.size() != 1) {
+        return false;
+    }
+    IRBlock *pred = block->preds.front();
+    if (pred == block || pred->terminator()->opcode != IROpcode::Br) {
+        return false;
+    }
+
+    // Phis with a single predecessor are just their value
+    while (hasPhis(block)) {
+        IRInstr *phi = block->instrs.front();
+        phi->replaceAllUsesWith(phi->operands[0]);
+        block->erase(phi);
+    }
+
+    pred->erase(pred->terminator());
+    for (IRInstr *instr : block->instrs) {
+        pred->append(instr);
+    }
+    for (IRBlock *succ : block->succs()) {
+        std::replace(succ->preds.begin(), succ->preds.end(), block, pred);
+        for (IRInstr *phi : succ->instrs) {
+            if (phi->opcode != IROpcode::Phi) { break; }
+            std::replace(phi->blocks.begin(), phi->blocks.end(), block, pred);
+        }
+    }
+    block->instrs.clear();
+    block->preds.clear();
+    fn.blocks.erase(std::find(fn.blocks.begin(), fn.blocks.end(), block));
+    return true;
+}
+
+/* SECTION: SplitCriticalEdges */
+
+bool SplitCriticalEdges::run(IRFunction &fn) {
+    bool changed = false;
+    std::vector<IRBlock *> blocks = fn.blocks;
+    for (IRBlock *block : blocks) {
+        if (!hasPhis(block)) { continue; }
+
+        std::vector<IRBlock *> preds = block->preds;
+        for (IRBlock *pred : preds) {
+            if (pred->succs().size() < 2) { continue; }
+
+            IRBlock *split = fn.createBlock();
+            fn.blocks.insert(std::find(fn.blocks.begin(), fn.blocks.end(),
+                                       pred) + 1,
+                             split);
+            IRInstr *br = fn.create(IROpcode::Br, nullptr);
+            br->blocks.push_back(block);
+            split->append(br);
+
+            pred->replaceSuccessor(block, split);
+            block->preds.push_back(split);
+            for (IRInstr *phi : block->instrs) {
+                if (phi->opcode != IROpcode::Phi) { break; }
+                std::replace(phi->blocks.begin(), phi->blocks.end(), pred,
+                             split);
+            }
+            changed = true;
+        }
+    }
+    return changed;
+}
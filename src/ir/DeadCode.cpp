@@ -0,0 +1,221 @@
+#include <algorithm>
+#include <map>
+#include <utility>
+#include <vector>
+#include "ast/ast.hpp"
+#include "ir/ir.hpp"
+
+bool DeadCodeElimination::run(IRFunction &fn) {
+    bool changed = removeUnreachable(fn);
+    changed |= removeDeadStores(fn);
+    changed |= removeDeadInstrs(fn);
+    changed |= removeUnusedFrameObjects(fn);
+    return changed;
+}
+
+// Code after a return, break or continue, and the branches not taken on
+// constants. The predecessors of an unreachable block are unreachable too,
+// and go with it.
+bool DeadCodeElimination::removeUnreachable(IRFunction &fn) {
+    DominatorTree domTree(fn);
+    std::vector<IRBlock *> unreachable;
+    for (IRBlock *block : fn.blocks) {
+        if (!domTree.reachable(block)) { unreachable.push_back(block); }
+    }
+    for (IRBlock *block : unreachable) {
+        fn.eraseBlock(block);
+    }
+    return !unreachable.empty();
+}
+
+// Where addr points, if it is a frame object at a constant offset
+static bool frameLocation(IRInstr *addr, long &object, long &offset) {
+    long value;
+    if (addr->opcode == IROpcode::FrameAddr) {
+        object = addr->imm;
+        offset = 0;
+        return true;
+    }
+    if (addr->opcode != IROpcode::BinaryOp
+            || addr->op != BuiltinOperator::Plus) {
+        return false;
+    }
+    IRInstr *ptr = addr->operands[0], *index = addr->operands[1];
+    if (ptr->opcode != IROpcode::FrameAddr) { std::swap(ptr, index); }
+    if (ptr->opcode != IROpcode::FrameAddr || !index->isConst(value)) {
+        return false;
+    }
+    object = ptr->imm;
+    offset = value;
+    return true;
+}
+
+/*
+    Stores into a frame object that nothing reads, as its address is only
+    ever stored through:
+
+        int *arr = {1, 2, 3};   ; never indexed again
+
+    and, within a block, stores that a later store to the same place
+    overwrites before any load or call could read them:
+
+        *p = 1;                 ; p = &x
+        *p = 2;
+*/
+bool DeadCodeElimination::removeDeadStores(IRFunction &fn) {
+    // The pointers into each object and whatever uses them, to see which
+    // objects are written but never read
+    std::vector<bool> read(fn.frameObjects.size(), false);
+    std::vector<std::vector<IRInstr *>> stores(fn.frameObjects.size());
+    for (IRBlock *block : fn.blocks) {
+        for (IRInstr *instr : block->instrs) {
+            if (instr->opcode != IROpcode::FrameAddr) { continue; }
+            const long object = instr->imm;
+            std::vector<IRInstr *> pointers(1, instr);
+            while (!pointers.empty() && !read[object]) {
+                IRInstr *ptr = pointers.back();
+                pointers.pop_back();
+                for (IRInstr *user : ptr->users) {
+                    if (user->opcode == IROpcode::Store
+                            && user->operands[0] == ptr
+                            && user->operands[1] != ptr) {
+                        stores[object].push_back(user);
+                    } else if (user->opcode == IROpcode::BinaryOp
+                               && user->type->kind == TypeNode::Pointer) {
+                        pointers.push_back(user);
+                    } else {
+                        read[object] = true;
+                    }
+                }
+            }
+        }
+    }
+
+    bool changed = false;
+    for (std::size_t object = 0; object < read.size(); object++) {
+        if (read[object]) { continue; }
+        for (IRInstr *store : stores[object]) {
+            if (!store->block) { continue; }
+            store->block->erase(store);
+            changed = true;
+        }
+    }
+
+    struct Location {
+        long object, offset;
+        unsigned size;
+        bool operator<(const Location &other) const {
+            return object != other.object ? object < other.object
+                 : offset != other.offset ? offset < other.offset
+                 : size < other.size;
+        }
+    };
+    for (IRBlock *block : fn.blocks) {
+        std::map<Location, IRInstr *> pending;  // Not read since stored
+        std::vector<IRInstr *> overwritten;
+        for (IRInstr *instr : block->instrs) {
+            Location location;
+            const bool known = (instr->opcode == IROpcode::Store
+                                || instr->opcode == IROpcode::Load)
+                && frameLocation(instr->operands[0], location.object,
+                                 location.offset);
+            if (instr->opcode == IROpcode::Store && known) {
+                location.size = instr->type->size();
+                auto it = pending.find(location);
+                if (it != pending.end()) { overwritten.push_back(it->second); }
+                pending[location] = instr;
+            } else if (instr->opcode == IROpcode::Load && known) {
+                // Whatever part of the object it reads
+                for (auto it = pending.begin(); it != pending.end();) {
+                    if (it->first.object == location.object) {
+                        it = pending.erase(it);
+                    } else {
+                        ++it;
+                    }
+                }
+            } else if (instr->opcode == IROpcode::Load
+                       || instr->opcode == IROpcode::Call
+                       || instr->opcode == IROpcode::Svc) {
+                pending.clear();
+            }
+        }
+        for (IRInstr *store : overwritten) {
+            block->erase(store);
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+// Everything that has side effects is live, and so is everything a live
+// instruction uses. The rest goes, including cycles of phis that only feed
+// each other.
+bool DeadCodeElimination::removeDeadInstrs(IRFunction &fn) {
+    std::vector<bool> live(fn.numValues(), false);
+    std::vector<IRInstr *> worklist;
+    for (IRBlock *block : fn.blocks) {
+        for (IRInstr *instr : block->instrs) {
+            if (instr->hasSideEffects()) {
+                live[instr->id] = true;
+                worklist.push_back(instr);
+            }
+        }
+    }
+    while (!worklist.empty()) {
+        IRInstr *instr = worklist.back();
+        worklist.pop_back();
+        for (IRInstr *operand : instr->operands) {
+            if (!live[operand->id]) {
+                live[operand->id] = true;
+                worklist.push_back(operand);
+            }
+        }
+    }
+
+    // Dead instructions may use each other, so they all let go of their
+    // operands before any is erased
+    std::vector<IRInstr *> dead;
+    for (IRBlock *block : fn.blocks) {
+        for (IRInstr *instr : block->instrs) {
+            if (!live[instr->id]) {
+                instr->dropOperands();
+                dead.push_back(instr);
+            }
+        }
+    }
+    for (IRInstr *instr : dead) {
+        instr->block->erase(instr);
+    }
+    return !dead.empty();
+}
+
+// Renumbers the frame objects still referred to, so that the others take
+// no space in the frame
+bool DeadCodeElimination::removeUnusedFrameObjects(IRFunction &fn) {
+    std::vector<IRInstr *> frameAddrs;
+    std::vector<bool> used(fn.frameObjects.size(), false);
+    for (IRBlock *block : fn.blocks) {
+        for (IRInstr *instr : block->instrs) {
+            if (instr->opcode == IROpcode::FrameAddr) {
+                frameAddrs.push_back(instr);
+                used[instr->imm] = true;
+            }
+        }
+    }
+    if (std::find(used.begin(), used.end(), false) == used.end()) {
+        return false;
+    }
+
+    std::vector<long> renumbered(fn.frameObjects.size(), -1);
+    std::vector<FrameObject> objects;
+    for (std::size_t i = 0; i < fn.frameObjects.size(); i++) {
+        if (!used[i]) { continue; }
+        renumbered[i] = objects.size();
+        objects.push_back(fn.frameObjects[i]);
+    }
+    fn.frameObjects.swap(objects);
+    for (IRInstr *instr : frameAddrs) {
+        instr->imm = renumbered[instr->imm];
+    }
+    return true;
+}
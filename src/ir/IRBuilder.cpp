@@ -0,0 +1,818 @@
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "ast/ast.hpp"
+#include "ir/ir.hpp"
+
+IRBuilder::IRBuilder(CompileState *cs, FnDefNode *fnDef, IRFunction &fn)
+        : cs(cs),
+          fnDef(fnDef),
+          fn(fn),
+          intType(cs->types.get(BuiltinType::Int)),
+          varTypes(fnDef->numVars, nullptr),
+          frameSlots(fnDef->numVars, -1),
+          addrTypes(fnDef->numVars, nullptr) {}
+
+void IRBuilder::build() {
+    for (ParamNode *param : fnDef->paramList) {
+        varTypes[param->slot] = param->type;
+    }
+    scanVariables(fnDef->block);
+    allocateFrameSlots(0);
+
+    IRBlock *entry = newBlock();
+    sealBlock(entry);
+    startBlock(entry);
+
+    // TODO: support more than 8 arguments
+    for (unsigned i = 0; i < fnDef->paramList.size() && i < 8; i++) {
+        ParamNode *param = fnDef->paramList[i];
+        IRInstr *value = emit(IROpcode::Param, param->type);
+        value->imm = i;
+        assign(param->slot, param->type, value);
+    }
+
+    lowerBlock(fnDef->block);
+
+    // main returns 0 if it falls off the end, other functions return
+    // whatever is in x0
+    if (!current->terminator()) {
+        IRInstr *value = nullptr;
+        if (fnDef->identifier == "main") { value = constant(0, intType); }
+        IRInstr *ret = emit(IROpcode::Ret, nullptr);
+        if (value) { ret->addOperand(value); }
+    }
+}
+
+/* SECTION: Blocks */
+
+IRBlock *IRBuilder::newBlock() {
+    IRBlock *block = fn.createBlock();
+    states.resize(fn.numBlockIds());
+    states[block->id].defs.assign(varTypes.size(), nullptr);
+    return block;
+}
+
+void IRBuilder::startBlock(IRBlock *block) {
+    fn.blocks.push_back(block);
+    current = block;
+}
+
+// No more predecessors will be added to block, so its incomplete phis can
+// be given their operands
+void IRBuilder::sealBlock(IRBlock *block) {
+    BlockState &state = states[block->id];
+    std::vector<std::pair<unsigned, IRInstr *>> incomplete;
+    incomplete.swap(state.incompletePhis);
+    state.sealed = true;
+    for (auto &slotPhi : incomplete) {
+        addPhiOperands(slotPhi.first, slotPhi.second);
+    }
+}
+
+void IRBuilder::addEdge(IRBlock *from, IRBlock *to) {
+    for (IRBlock *pred : to->preds) {
+        if (pred == from) { return; }
+    }
+    to->preds.push_back(from);
+}
+
+IRInstr *IRBuilder::emit(IROpcode opcode, TypeNode *type) {
+    IRInstr *instr = fn.create(opcode, type);
+    current->append(instr);
+    return instr;
+}
+
+IRInstr *IRBuilder::constant(long value, TypeNode *type) {
+    IRInstr *instr = emit(IROpcode::Const, type);
+    instr->imm = value;
+    return instr;
+}
+
+void IRBuilder::branch(IRBlock *target) {
+    IRInstr *br = emit(IROpcode::Br, nullptr);
+    br->blocks.push_back(target);
+    addEdge(current, target);
+}
+
+void IRBuilder::condBranch(IRInstr *cond, IRBlock *ifTrue,
+                           IRBlock *ifFalse) {
+    IRInstr *condBr = emit(IROpcode::CondBr, nullptr);
+    condBr->addOperand(cond);
+    condBr->blocks.push_back(ifTrue);
+    condBr->blocks.push_back(ifFalse);
+    addEdge(current, ifTrue);
+    addEdge(current, ifFalse);
+}
+
+/* SECTION: SSA construction */
+
+// Blocks made before an inlined call know nothing of its variables, so
+// their defs only grow when written
+void IRBuilder::writeVariable(unsigned slot, IRBlock *block, IRInstr *value) {
+    std::vector<IRInstr *> &defs = states[block->id].defs;
+    if (defs.size() <= slot) { defs.resize(varTypes.size(), nullptr); }
+    defs[slot] = value;
+}
+
+IRInstr *IRBuilder::readVariable(unsigned slot, IRBlock *block) {
+    std::vector<IRInstr *> &defs = states[block->id].defs;
+    IRInstr *value = slot < defs.size() ? defs[slot] : nullptr;
+    if (value) { return resolve(value); }
+    return readVariableRecursive(slot, block);
+}
+
+IRInstr *IRBuilder::readVariableRecursive(unsigned slot, IRBlock *block) {
+    IRInstr *value;
+    if (!states[block->id].sealed) {
+        // Not all predecessors are known yet
+        value = fn.create(IROpcode::Phi, varTypes[slot]);
+        block->insertAtStart(value);
+        states[block->id].incompletePhis.emplace_back(slot, value);
+    } else if (block->preds.size() == 1) {
+        value = readVariable(slot, block->preds.front());
+    } else if (block->preds.empty()) {
+        value = undefined(varTypes[slot]);
+    } else {
+        // Breaks cycles through loops
+        IRInstr *phi = fn.create(IROpcode::Phi, varTypes[slot]);
+        block->insertAtStart(phi);
+        writeVariable(slot, block, phi);
+        value = addPhiOperands(slot, phi);
+    }
+    writeVariable(slot, block, value);
+    return value;
+}
+
+// The values are all read before any is added, as a phi with only some of
+// its operands could look trivial to tryRemoveTrivialPhi meanwhile. Values
+// removed in the meantime are followed to their replacements.
+IRInstr *IRBuilder::addPhiOperands(unsigned slot, IRInstr *phi) {
+    std::vector<IRInstr *> values;
+    for (IRBlock *pred : phi->block->preds) {
+        values.push_back(readVariable(slot, pred));
+    }
+    for (std::size_t i = 0; i < values.size(); i++) {
+        phi->addOperand(resolve(values[i]));
+        phi->blocks.push_back(phi->block->preds[i]);
+    }
+    return tryRemoveTrivialPhi(phi);
+}
+
+// A phi whose operands are all one value or itself is that value
+IRInstr *IRBuilder::tryRemoveTrivialPhi(IRInstr *phi) {
+    IRInstr *same = nullptr;
+    for (IRInstr *operand : phi->operands) {
+        if (operand == same || operand == phi) { continue; }
+        if (same) { return phi; }
+        same = operand;
+    }
+    if (!same) {
+        // Only reachable through itself, or not at all
+        same = undefined(phi->type);
+    }
+
+    std::vector<IRInstr *> users;
+    for (IRInstr *user : phi->users) {
+        if (user != phi) { users.push_back(user); }
+    }
+    phi->replaceAllUsesWith(same);
+    if (forwarded.size() <= phi->id) { forwarded.resize(fn.numValues()); }
+    forwarded[phi->id] = same;
+    phi->block->erase(phi);
+
+    // Removing this phi may have made the phis that used it trivial
+    for (IRInstr *user : users) {
+        if (user->opcode == IROpcode::Phi && user->block) {
+            tryRemoveTrivialPhi(user);
+        }
+    }
+    return same;
+}
+
+// The value of a variable read before it is written. Placed in the entry
+// block, which dominates every use.
+IRInstr *IRBuilder::undefined(TypeNode *type) {
+    IRBlock *entry = fn.blocks.front();
+    IRInstr *value = fn.create(IROpcode::Const, type);
+    if (entry == current) {
+        entry->insertAtStart(value);
+    } else {
+        entry->insertBeforeTerminator(value);
+    }
+    return value;
+}
+
+// Follows removed phis to the value that replaced them
+IRInstr *IRBuilder::resolve(IRInstr *value) {
+    while (value->opcode == IROpcode::Phi && value->id < forwarded.size()
+           && forwarded[value->id]) {
+        value = forwarded[value->id];
+    }
+    return value;
+}
+
+/* SECTION: Variables */
+
+void IRBuilder::scanVariables(std::vector<StatementNode *> &block) {
+    for (StatementNode *statement : block) {
+        switch (statement->kind) {
+            case StatementNode::Declaration:
+                varTypes[var(statement->slot)] = statement->type;
+                break;
+            case StatementNode::Initialization:
+                varTypes[var(statement->slot)] = statement->type;
+                scanVariables(statement->expr);
+                break;
+            case StatementNode::Assignment:
+                if (statement->accessor->kind == AccessorNode::Dereference) {
+                    scanVariables(statement->accessor->expr);
+                }
+                scanVariables(statement->expr);
+                break;
+            case StatementNode::Return:
+                scanVariables(statement->expr);
+                break;
+            case StatementNode::FnCall:
+                for (ExprNode *arg : statement->fnCall->argList) {
+                    scanVariables(arg);
+                }
+                break;
+            case StatementNode::If: {
+                IfNode *ifNode = static_cast<IfNode *>(statement);
+                scanVariables(ifNode->condition);
+                scanVariables(ifNode->block);
+                scanVariables(ifNode->elseBlock);
+                break;
+            }
+            case StatementNode::While: {
+                WhileNode *whileNode = static_cast<WhileNode *>(statement);
+                scanVariables(whileNode->condition);
+                scanVariables(whileNode->block);
+                break;
+            }
+            case StatementNode::Break:
+            case StatementNode::Continue:
+                break;
+        }
+    }
+}
+
+// Marks the variables whose address is taken
+void IRBuilder::scanVariables(ExprNode *expr) {
+    switch (expr->kind) {
+        case ExprNode::Accessor:
+            if (expr->accessor->kind == AccessorNode::Dereference) {
+                scanVariables(expr->accessor->expr);
+            }
+            break;
+        case ExprNode::FnCall:
+            for (ExprNode *arg : expr->fnCall->argList) {
+                scanVariables(arg);
+            }
+            break;
+        case ExprNode::BinaryOp:
+            scanVariables(expr->opr1);
+            scanVariables(expr->opr2);
+            break;
+        case ExprNode::UnaryOp:
+            if (expr->builtinOperator == BuiltinOperator::BitAnd) {
+                addrTypes[var(expr->opr->accessor->slot)] = expr->type;
+            } else {
+                scanVariables(expr->opr);
+            }
+            break;
+        case ExprNode::Array:
+            for (ExprNode *elem : *expr->array) {
+                scanVariables(elem);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+// Gives the variables from from on whose address is taken a place in the
+// frame
+void IRBuilder::allocateFrameSlots(unsigned from) {
+    for (unsigned slot = from; slot < varTypes.size(); slot++) {
+        if (!addrTypes[slot]) { continue; }
+        const long size = varTypes[slot]->size();
+        frameSlots[slot] = fn.frameObjects.size();
+        fn.frameObjects.push_back(FrameObject{size, size});
+    }
+}
+
+// Char variables hold the low byte of what is assigned to them, as a
+// strb/ldrb pair would leave it
+void IRBuilder::assign(unsigned slot, TypeNode *type, IRInstr *value) {
+    if (frameSlots[slot] >= 0) {
+        IRInstr *addr = emit(IROpcode::FrameAddr, addrTypes[slot]);
+        addr->imm = frameSlots[slot];
+        IRInstr *store = emit(IROpcode::Store, type);
+        store->addOperand(addr);
+        store->addOperand(value);
+        return;
+    }
+
+    if (type->size() == 1) {
+        long imm;
+        Condition cond;
+        if (value->isConst(imm)) {
+            if ((imm & 0xff) != imm) { value = constant(imm & 0xff, type); }
+        } else if (!(value->type->size() == 1
+                     && (value->opcode == IROpcode::Load
+                         || value->opcode == IROpcode::Trunc
+                         || value->opcode == IROpcode::Phi))
+                   && !(value->opcode == IROpcode::BinaryOp
+                        && StackFrame::isRelational(value->op, cond))) {
+            IRInstr *trunc = emit(IROpcode::Trunc, type);
+            trunc->addOperand(value);
+            value = trunc;
+        }
+    }
+    writeVariable(slot, current, value);
+}
+
+IRInstr *IRBuilder::variable(unsigned slot, TypeNode *type) {
+    if (frameSlots[slot] >= 0) {
+        IRInstr *addr = emit(IROpcode::FrameAddr, addrTypes[slot]);
+        addr->imm = frameSlots[slot];
+        IRInstr *load = emit(IROpcode::Load, type);
+        load->addOperand(addr);
+        return load;
+    }
+    return readVariable(slot, current);
+}
+
+/* SECTION: Statements */
+
+void IRBuilder::lowerBlock(std::vector<StatementNode *> &block) {
+    for (StatementNode *statement : block) {
+        lowerStatement(statement);
+    }
+}
+
+void IRBuilder::lowerStatement(StatementNode *statement) {
+    switch (statement->kind) {
+        case StatementNode::Declaration:
+            break;
+        case StatementNode::Initialization:
+            assign(var(statement->slot), varTypes[var(statement->slot)],
+                   lowerExpr(statement->expr));
+            break;
+        case StatementNode::Assignment: {
+            AccessorNode *accessor = statement->accessor;
+            if (accessor->kind == AccessorNode::Identifier) {
+                assign(var(accessor->slot), varTypes[var(accessor->slot)],
+                       lowerExpr(statement->expr));
+                break;
+            }
+            // The address is evaluated before the value
+            IRInstr *addr = lowerExpr(accessor->expr);
+            IRInstr *value = lowerExpr(statement->expr);
+            IRInstr *store = emit(IROpcode::Store, accessor->type);
+            store->addOperand(addr);
+            store->addOperand(value);
+            break;
+        }
+        case StatementNode::Return: {
+            IRInstr *value = lowerExpr(statement->expr);
+            if (!inlined.empty()) {
+                const Inlining &site = inlined.back();
+                TypeNode *type = varTypes[site.resultSlot];
+                if (value && type) { assign(site.resultSlot, type, value); }
+                branch(site.exit);
+            } else {
+                IRInstr *ret = emit(IROpcode::Ret, nullptr);
+                if (value) { ret->addOperand(value); }
+            }
+            // Anything after the return is unreachable
+            IRBlock *dead = newBlock();
+            sealBlock(dead);
+            startBlock(dead);
+            break;
+        }
+        case StatementNode::FnCall:
+            lowerFnCall(statement->fnCall);
+            break;
+        case StatementNode::If:
+            lowerIf(static_cast<IfNode *>(statement));
+            break;
+        case StatementNode::While:
+            lowerWhile(static_cast<WhileNode *>(statement));
+            break;
+        case StatementNode::Break:
+        case StatementNode::Continue: {
+            if (loops.empty()) {
+                std::cerr << "ERROR: break or continue outside of a loop in "
+                          << (inlined.empty() ? fnDef : inlined.back().callee)
+                                 ->identifier
+                          << '\n';
+                exit(EXIT_FAILURE);
+            }
+            const bool isBreak = statement->kind == StatementNode::Break;
+            branch(isBreak ? loops.back().second : loops.back().first);
+            IRBlock *dead = newBlock();
+            sealBlock(dead);
+            startBlock(dead);
+            break;
+        }
+    }
+}
+
+void IRBuilder::lowerIf(IfNode *ifNode) {
+    IRInstr *cond = lowerExpr(ifNode->condition);
+    IRBlock *thenBlock = newBlock(), *join = newBlock();
+    IRBlock *elseBlock = ifNode->elseBlock.empty() ? join : newBlock();
+    condBranch(cond, thenBlock, elseBlock);
+    sealBlock(thenBlock);
+
+    startBlock(thenBlock);
+    lowerBlock(ifNode->block);
+    branch(join);
+
+    if (elseBlock != join) {
+        sealBlock(elseBlock);
+        startBlock(elseBlock);
+        lowerBlock(ifNode->elseBlock);
+        branch(join);
+    }
+    sealBlock(join);
+    startBlock(join);
+}
+
+/*
+    Rotated, like WhileNode::emit, with the condition checked once before
+    the loop and again at its bottom:
+
+        guard:  condbr cond, body, exit
+        body:   ...
+                br latch
+        latch:  condbr cond, body, exit    ; continue branches here
+        exit:                              ; break branches here
+*/
+void IRBuilder::lowerWhile(WhileNode *whileNode) {
+    IRInstr *cond = lowerExpr(whileNode->condition);
+    IRBlock *body = newBlock(), *latch = newBlock(), *exit = newBlock();
+    condBranch(cond, body, exit);
+
+    loops.emplace_back(latch, exit);
+    startBlock(body);
+    lowerBlock(whileNode->block);
+    branch(latch);
+    loops.pop_back();
+
+    sealBlock(latch);
+    startBlock(latch);
+    condBranch(lowerExpr(whileNode->condition), body, exit);
+    sealBlock(body);
+    sealBlock(exit);
+    startBlock(exit);
+}
+
+/* SECTION: Expressions */
+
+// Null for an empty expression
+IRInstr *IRBuilder::lowerExpr(ExprNode *expr) {
+    switch (expr->kind) {
+        case ExprNode::Literal:
+            return constant(expr->literal->value(), expr->type);
+        case ExprNode::Accessor: {
+            AccessorNode *accessor = expr->accessor;
+            if (accessor->kind == AccessorNode::Identifier) {
+                return variable(var(accessor->slot),
+                                varTypes[var(accessor->slot)]);
+            }
+            IRInstr *addr = lowerExpr(accessor->expr);
+            IRInstr *load = emit(IROpcode::Load, accessor->type);
+            load->addOperand(addr);
+            return load;
+        }
+        case ExprNode::FnCall:
+            return lowerFnCall(expr->fnCall);
+        case ExprNode::BinaryOp: {
+            IRInstr *opr1 = lowerExpr(expr->opr1);
+            IRInstr *opr2 = lowerExpr(expr->opr2);
+            IRInstr *instr = emit(IROpcode::BinaryOp, expr->type);
+            instr->op = expr->builtinOperator;
+            instr->addOperand(opr1);
+            instr->addOperand(opr2);
+            return instr;
+        }
+        case ExprNode::UnaryOp: {
+            const BuiltinOperator op = expr->builtinOperator;
+            if (op == BuiltinOperator::BitAnd) {
+                IRInstr *addr = emit(IROpcode::FrameAddr, expr->type);
+                addr->imm = frameSlots[var(expr->opr->accessor->slot)];
+                return addr;
+            }
+            IRInstr *opr = lowerExpr(expr->opr);
+            IRInstr *instr;
+            if (op == BuiltinOperator::Star) {
+                instr = emit(IROpcode::Load, expr->type);
+            } else if (op == BuiltinOperator::Not) {
+                // !x is x == 0
+                IRInstr *zero = constant(0, expr->opr->type);
+                instr = emit(IROpcode::BinaryOp, expr->type);
+                instr->op = BuiltinOperator::Eq;
+                instr->addOperand(opr);
+                instr->addOperand(zero);
+                return instr;
+            } else {
+                instr = emit(IROpcode::UnaryOp, expr->type);
+                instr->op = op;
+            }
+            instr->addOperand(opr);
+            return instr;
+        }
+        case ExprNode::Array:
+            return lowerArray(expr);
+        case ExprNode::Static: {
+            IRInstr *addr = emit(IROpcode::StaticAddr, expr->type);
+            addr->staticData = expr->staticData;
+            return addr;
+        }
+        case ExprNode::Empty:
+            return nullptr;
+    }
+    return nullptr;
+}
+
+IRInstr *IRBuilder::lowerFnCall(FnCallNode *fnCall) {
+    std::vector<IRInstr *> args;
+    IRInstr *instr;
+    if (fnCall->identifier == "svc") {
+        // The arguments go in x0-x6 and the number in x16, which is
+        // evaluated last
+        for (unsigned i = 1; i < fnCall->argList.size() && i < 8; i++) {
+            args.push_back(lowerExpr(fnCall->argList[i]));
+        }
+        IRInstr *number = lowerExpr(fnCall->argList[0]);
+        instr = emit(IROpcode::Svc, intType);
+        instr->addOperand(number);
+    } else if (FnDefNode *callee = inlineCallee(fnCall)) {
+        return inlineCall(fnCall, callee);
+    } else {
+        // TODO: allow more than 8 arguments
+        for (unsigned i = 0; i < fnCall->argList.size() && i < 8; i++) {
+            args.push_back(lowerExpr(fnCall->argList[i]));
+        }
+        TypeNode *returnType = fnCall->fnDecl->returnType;
+        instr = emit(IROpcode::Call,
+                     returnType->isVoid() ? nullptr : returnType);
+        instr->callee = &fnCall->identifier;
+    }
+    for (IRInstr *arg : args) {
+        instr->addOperand(arg);
+    }
+    return instr;
+}
+
+/*
+    Laid out like variables reserved one after another from the last
+    element to the first, each aligned to its size, so that the result
+    points to the first element at the lowest address:
+
+        %1:void* = frameaddr 0       ; {a, b}, both int
+        store int %1+8, b
+        store int %1, a
+*/
+IRInstr *IRBuilder::lowerArray(ExprNode *expr) {
+    std::vector<ExprNode *> &elems = *expr->array;
+    std::vector<long> positions(elems.size());
+    long pos = 0, align = 1;
+    for (std::size_t i = elems.size(); i-- > 0;) {
+        const long size = elems[i]->type->size();
+        pos += size;
+        if (size > 0) {
+            pos = (pos + size - 1) / size * size;
+            if (size > align) { align = size; }
+        }
+        positions[i] = pos;
+    }
+
+    const long object = fn.frameObjects.size();
+    fn.frameObjects.push_back(FrameObject{pos, align});
+    IRInstr *base = emit(IROpcode::FrameAddr, expr->type);
+    base->imm = object;
+
+    for (std::size_t i = elems.size(); i-- > 0;) {
+        IRInstr *value = lowerExpr(elems[i]);
+        IRInstr *addr = base;
+        if (pos - positions[i] != 0) {
+            IRInstr *offset = constant(pos - positions[i], intType);
+            addr = emit(IROpcode::BinaryOp, expr->type);
+            addr->op = BuiltinOperator::Plus;
+            addr->addOperand(base);
+            addr->addOperand(offset);
+        }
+        IRInstr *store = emit(IROpcode::Store, elems[i]->type);
+        store->addOperand(addr);
+        store->addOperand(value);
+    }
+    return base;
+}
+
+/* SECTION: Inlining */
+
+// Limits, in AST nodes of the callee's body
+static const unsigned SMALL_FN_COST = 12;       // Cheaper than the call
+static const unsigned SINGLE_CALL_COST = 80;    // Called from one place
+static const unsigned INLINE_HINT_COST = 200;   // Marked inline
+static const unsigned MAX_INLINED_COST = 400;   // Into one function
+static const unsigned MAX_INLINE_DEPTH = 4;
+
+static unsigned cost(std::vector<StatementNode *> &block,
+                     std::vector<FnCallNode *> &calls);
+
+static unsigned cost(ExprNode *expr, std::vector<FnCallNode *> &calls) {
+    switch (expr->kind) {
+        case ExprNode::Accessor:
+            if (expr->accessor->kind == AccessorNode::Dereference) {
+                return 1 + cost(expr->accessor->expr, calls);
+            }
+            return 1;
+        case ExprNode::FnCall: {
+            unsigned n = 1;
+            calls.push_back(expr->fnCall);
+            for (ExprNode *arg : expr->fnCall->argList) {
+                n += cost(arg, calls);
+            }
+            return n;
+        }
+        case ExprNode::BinaryOp:
+            return 1 + cost(expr->opr1, calls) + cost(expr->opr2, calls);
+        case ExprNode::UnaryOp:
+            return 1 + cost(expr->opr, calls);
+        case ExprNode::Array: {
+            unsigned n = 1;
+            for (ExprNode *elem : *expr->array) {
+                n += cost(elem, calls);
+            }
+            return n;
+        }
+        case ExprNode::Empty:
+            return 0;
+        default:
+            return 1;
+    }
+}
+
+static unsigned cost(std::vector<StatementNode *> &block,
+                     std::vector<FnCallNode *> &calls) {
+    unsigned n = 0;
+    for (StatementNode *statement : block) {
+        n++;
+        switch (statement->kind) {
+            case StatementNode::Initialization:
+            case StatementNode::Return:
+                n += cost(statement->expr, calls);
+                break;
+            case StatementNode::Assignment:
+                if (statement->accessor->kind == AccessorNode::Dereference) {
+                    n += cost(statement->accessor->expr, calls);
+                }
+                n += cost(statement->expr, calls);
+                break;
+            case StatementNode::FnCall:
+                calls.push_back(statement->fnCall);
+                for (ExprNode *arg : statement->fnCall->argList) {
+                    n += cost(arg, calls);
+                }
+                break;
+            case StatementNode::If: {
+                IfNode *ifNode = static_cast<IfNode *>(statement);
+                n += cost(ifNode->condition, calls);
+                n += cost(ifNode->block, calls);
+                n += cost(ifNode->elseBlock, calls);
+                break;
+            }
+            case StatementNode::While: {
+                WhileNode *whileNode = static_cast<WhileNode *>(statement);
+                n += cost(whileNode->condition, calls);
+                n += cost(whileNode->block, calls);
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    return n;
+}
+
+// The definition of callee if calls to it may be inlined at all. This
+// depends only on the file, so that the cache can tell what a function's
+// code depends on.
+static FnDefNode *inlinable(CompileState *cs, const std::string &callee,
+                            unsigned &calleeCost) {
+    auto it = cs->fnDefs.find(callee);
+    if (it == cs->fnDefs.end() || callee == "main") { return nullptr; }
+    FnDefNode *fnDef = it->second;
+    // TODO: support more than 8 arguments
+    if (fnDef->paramList.size() > 8) { return nullptr; }
+
+    std::vector<FnCallNode *> calls;
+    calleeCost = cost(fnDef->block, calls);
+    auto numCalls = cs->numCalls.find(callee);
+    if (calleeCost <= SMALL_FN_COST
+            || (fnDef->isInline && calleeCost <= INLINE_HINT_COST)
+            || (numCalls != cs->numCalls.end() && numCalls->second == 1
+                && calleeCost <= SINGLE_CALL_COST)) {
+        return fnDef;
+    }
+    return nullptr;
+}
+
+void IRBuilder::inlineCandidates(CompileState *cs, FnDefNode *fnDef,
+                                 std::vector<FnDefNode *> &candidates) {
+    std::vector<FnCallNode *> calls;
+    cost(fnDef->block, calls);
+    for (std::size_t i = 0; i < calls.size(); i++) {
+        unsigned calleeCost;
+        FnDefNode *callee = inlinable(cs, calls[i]->identifier, calleeCost);
+        if (!callee || callee == fnDef
+                || std::find(candidates.begin(), candidates.end(), callee)
+                    != candidates.end()) {
+            continue;
+        }
+        candidates.push_back(callee);
+        cost(callee->block, calls);
+    }
+}
+
+// The callee to lower in place of fnCall, if it is worth inlining here.
+// Recursive calls are left alone, as is anything past the budget.
+FnDefNode *IRBuilder::inlineCallee(FnCallNode *fnCall) {
+    unsigned calleeCost;
+    FnDefNode *callee = inlinable(cs, fnCall->identifier, calleeCost);
+    if (!callee || callee == fnDef
+            || fnCall->argList.size() != callee->paramList.size()
+            || inlined.size() >= MAX_INLINE_DEPTH
+            || inlinedCost + calleeCost > MAX_INLINED_COST) {
+        return nullptr;
+    }
+    for (const Inlining &site : inlined) {
+        if (site.callee == callee) { return nullptr; }
+    }
+    inlinedCost += calleeCost;
+    return callee;
+}
+
+/*
+    The callee's body starts in the current block, with its parameters
+    assigned the arguments, and its returns branch to a block of their
+    own where the call's value is read:
+
+        %5:int* = ...                ; get(a), with int get(int *p)
+        %6:int = load %5             ; return *p;
+        br bb2
+    bb2:                             ; get(a) is %6
+*/
+IRInstr *IRBuilder::inlineCall(FnCallNode *fnCall, FnDefNode *callee) {
+    std::vector<IRInstr *> args;
+    for (ExprNode *arg : fnCall->argList) {
+        args.push_back(lowerExpr(arg));
+    }
+
+    Inlining site;
+    site.callee = callee;
+    site.slotBase = varTypes.size();
+    site.resultSlot = site.slotBase + callee->numVars;
+    const std::size_t numSlots = site.resultSlot + 1;
+    varTypes.resize(numSlots, nullptr);
+    frameSlots.resize(numSlots, -1);
+    addrTypes.resize(numSlots, nullptr);
+    if (!callee->returnType->isVoid()) {
+        varTypes[site.resultSlot] = callee->returnType;
+    }
+
+    const unsigned callerBase = slotBase;
+    slotBase = site.slotBase;
+    for (ParamNode *param : callee->paramList) {
+        varTypes[var(param->slot)] = param->type;
+    }
+    scanVariables(callee->block);
+    allocateFrameSlots(site.slotBase);
+    for (std::size_t i = 0; i < callee->paramList.size(); i++) {
+        ParamNode *param = callee->paramList[i];
+        assign(var(param->slot), param->type, args[i]);
+    }
+
+    // Loops of the caller are out of reach of the callee's break and
+    // continue
+    std::vector<std::pair<IRBlock *, IRBlock *>> callerLoops;
+    callerLoops.swap(loops);
+    site.exit = newBlock();
+    inlined.push_back(site);
+    lowerBlock(callee->block);
+    branch(site.exit);
+    inlined.pop_back();
+    loops.swap(callerLoops);
+    slotBase = callerBase;
+
+    sealBlock(site.exit);
+    startBlock(site.exit);
+    if (!varTypes[site.resultSlot]) { return nullptr; }
+    return variable(site.resultSlot, varTypes[site.resultSlot]);
+}
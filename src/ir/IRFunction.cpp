@@ -0,0 +1,403 @@
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "ast/ast.hpp"
+#include "ir/ir.hpp"
+#include "util.hpp"
+
+/* SECTION: Instructions */
+
+IRInstr::IRInstr(IROpcode opcode, unsigned id, TypeNode *type)
+        : opcode(opcode),
+          id(id),
+          type(type) {}
+
+bool IRInstr::hasResult() const {
+    return type && opcode != IROpcode::Store;
+}
+
+bool IRInstr::isTerminator() const {
+    return opcode == IROpcode::Br || opcode == IROpcode::CondBr
+        || opcode == IROpcode::Ret;
+}
+
+bool IRInstr::hasSideEffects() const {
+    return opcode == IROpcode::Store || opcode == IROpcode::Call
+        || opcode == IROpcode::Svc || isTerminator();
+}
+
+bool IRInstr::isConst(long &value) const {
+    if (opcode != IROpcode::Const) { return false; }
+    value = imm;
+    return true;
+}
+
+static void removeUser(IRInstr *value, IRInstr *user) {
+    auto it = std::find(value->users.begin(), value->users.end(), user);
+    if (it != value->users.end()) { value->users.erase(it); }
+}
+
+void IRInstr::addOperand(IRInstr *value) {
+    operands.push_back(value);
+    value->users.push_back(this);
+}
+
+void IRInstr::setOperand(unsigned i, IRInstr *value) {
+    removeUser(operands[i], this);
+    operands[i] = value;
+    value->users.push_back(this);
+}
+
+void IRInstr::removeOperand(unsigned i) {
+    removeUser(operands[i], this);
+    operands.erase(operands.begin() + i);
+    if (opcode == IROpcode::Phi) {
+        blocks.erase(blocks.begin() + i);
+    }
+}
+
+void IRInstr::dropOperands() {
+    for (IRInstr *value : operands) {
+        removeUser(value, this);
+    }
+    operands.clear();
+}
+
+void IRInstr::replaceAllUsesWith(IRInstr *value) {
+    std::vector<IRInstr *> oldUsers;
+    oldUsers.swap(users);
+    for (IRInstr *user : oldUsers) {
+        for (IRInstr *&operand : user->operands) {
+            if (operand == this) {
+                operand = value;
+                value->users.push_back(user);
+                break;  // Each entry in users is one use
+            }
+        }
+    }
+}
+
+IRInstr *IRInstr::incoming(IRBlock *pred) {
+    for (std::size_t i = 0; i < blocks.size(); i++) {
+        if (blocks[i] == pred) { return operands[i]; }
+    }
+    return nullptr;
+}
+
+void IRInstr::removeIncoming(IRBlock *pred) {
+    for (std::size_t i = 0; i < blocks.size(); i++) {
+        if (blocks[i] == pred) {
+            removeOperand(i);
+            return;
+        }
+    }
+}
+
+/* SECTION: Blocks */
+
+IRBlock::IRBlock(unsigned id) : id(id) {}
+
+IRInstr *IRBlock::terminator() {
+    if (instrs.empty() || !instrs.back()->isTerminator()) { return nullptr; }
+    return instrs.back();
+}
+
+std::vector<IRBlock *> IRBlock::succs() {
+    std::vector<IRBlock *> result;
+    IRInstr *term = terminator();
+    if (!term) { return result; }
+    for (IRBlock *succ : term->blocks) {
+        if (std::find(result.begin(), result.end(), succ) == result.end()) {
+            result.push_back(succ);
+        }
+    }
+    return result;
+}
+
+void IRBlock::append(IRInstr *instr) {
+    instr->block = this;
+    instrs.push_back(instr);
+}
+
+void IRBlock::insertAtStart(IRInstr *instr) {
+    auto it = instrs.begin();
+    while (it != instrs.end() && (*it)->opcode == IROpcode::Phi) { it++; }
+    instr->block = this;
+    instrs.insert(it, instr);
+}
+
+void IRBlock::insertBeforeTerminator(IRInstr *instr) {
+    instr->block = this;
+    instrs.insert(terminator() ? instrs.end() - 1 : instrs.end(), instr);
+}
+
+void IRBlock::erase(IRInstr *instr) {
+    instr->dropOperands();
+    instrs.erase(std::find(instrs.begin(), instrs.end(), instr));
+    instr->block = nullptr;
+}
+
+void IRBlock::replaceSuccessor(IRBlock *from, IRBlock *to) {
+    for (IRBlock *&succ : terminator()->blocks) {
+        if (succ == from) { succ = to; }
+    }
+    from->preds.erase(std::find(from->preds.begin(), from->preds.end(), this));
+    if (std::find(to->preds.begin(), to->preds.end(), this) == to->preds.end()) {
+        to->preds.push_back(this);
+    }
+}
+
+/* SECTION: Functions */
+
+IRFunction::IRFunction(FnDefNode *fnDef) : fnDef(fnDef) {}
+
+IRInstr *IRFunction::create(IROpcode opcode, TypeNode *type) {
+    instrPool.emplace_back(new IRInstr(opcode, instrPool.size(), type));
+    return instrPool.back().get();
+}
+
+IRBlock *IRFunction::createBlock() {
+    blockPool.emplace_back(new IRBlock(blockPool.size()));
+    return blockPool.back().get();
+}
+
+void IRFunction::eraseBlock(IRBlock *block) {
+    for (IRBlock *succ : block->succs()) {
+        succ->preds.erase(std::find(succ->preds.begin(), succ->preds.end(),
+                                    block));
+        for (IRInstr *instr : succ->instrs) {
+            if (instr->opcode != IROpcode::Phi) { break; }
+            instr->removeIncoming(block);
+        }
+    }
+    for (IRInstr *instr : block->instrs) {
+        instr->dropOperands();
+        instr->block = nullptr;
+    }
+    block->instrs.clear();
+    blocks.erase(std::find(blocks.begin(), blocks.end(), block));
+}
+
+unsigned IRFunction::numValues() const {
+    return instrPool.size();
+}
+
+unsigned IRFunction::numBlockIds() const {
+    return blockPool.size();
+}
+
+/* SECTION: Printing */
+
+static void printType(std::ostream &os, TypeNode *type) {
+    switch (type->kind) {
+        case TypeNode::Builtin:
+            switch (type->builtinType) {
+                case BuiltinType::Void: os << "void"; break;
+                case BuiltinType::Int: os << "int"; break;
+                case BuiltinType::Char: os << "char"; break;
+            }
+            break;
+        case TypeNode::Custom:
+            os << type->customType;
+            break;
+        case TypeNode::Pointer:
+            printType(os, type->pointerType);
+            os << '*';
+            break;
+    }
+}
+
+static const char *opName(BuiltinOperator op, bool unary) {
+    switch (op) {
+        case BuiltinOperator::Plus:    return "add";
+        case BuiltinOperator::Minus:   return unary ? "neg" : "sub";
+        case BuiltinOperator::Star:    return "mul";
+        case BuiltinOperator::Fslash:  return "div";
+        case BuiltinOperator::Percent: return "rem";
+        case BuiltinOperator::Eq:      return "eq";
+        case BuiltinOperator::Ne:      return "ne";
+        case BuiltinOperator::Lt:      return "lt";
+        case BuiltinOperator::Gt:      return "gt";
+        case BuiltinOperator::Le:      return "le";
+        case BuiltinOperator::Ge:      return "ge";
+        case BuiltinOperator::Not:     return "not";
+        case BuiltinOperator::BitNot:  return "bitnot";
+        case BuiltinOperator::BitAnd:  return "and";
+        case BuiltinOperator::BitOr:   return "or";
+        case BuiltinOperator::BitXor:  return "xor";
+    }
+    return "";
+}
+
+static const char *opcodeName(IRInstr &instr) {
+    switch (instr.opcode) {
+        case IROpcode::Const: return "const";
+        case IROpcode::Param: return "param";
+        case IROpcode::Phi: return "phi";
+        case IROpcode::BinaryOp: return opName(instr.op, false);
+        case IROpcode::UnaryOp: return opName(instr.op, true);
+        case IROpcode::Trunc: return "trunc";
+        case IROpcode::Load: return "load";
+        case IROpcode::Store: return "store";
+        case IROpcode::FrameAddr: return "frameaddr";
+        case IROpcode::StaticAddr: return "staticaddr";
+        case IROpcode::Call: return instr.isTailCall ? "tail call" : "call";
+        case IROpcode::Svc: return "svc";
+        case IROpcode::Br: return "br";
+        case IROpcode::CondBr: return "condbr";
+        case IROpcode::Ret: return "ret";
+    }
+    return "";
+}
+
+/*
+    %3:int = add %1, %2
+    %5:int = phi [%3, bb1], [%4, bb2]
+    store char %6, %7
+    condbr %8, bb3, bb4
+*/
+std::ostream &operator<<(std::ostream &os, IRInstr &instr) {
+    if (instr.opcode == IROpcode::Store) {
+        os << "store ";
+        printType(os, instr.type);
+        os << ' ';
+    } else if (instr.hasResult()) {
+        os << '%' << instr.id << ':';
+        printType(os, instr.type);
+        os << " = " << opcodeName(instr) << ' ';
+    } else {
+        os << opcodeName(instr) << ' ';
+    }
+
+    switch (instr.opcode) {
+        case IROpcode::Const:
+        case IROpcode::Param:
+        case IROpcode::FrameAddr:
+            return os << instr.imm;
+        case IROpcode::StaticAddr:
+            return os << instr.staticData->label();
+        case IROpcode::Call:
+            os << *instr.callee;
+            break;
+        case IROpcode::Phi:
+            for (std::size_t i = 0; i < instr.operands.size(); i++) {
+                os << (i == 0 ? "" : ", ") << "[%" << instr.operands[i]->id
+                   << ", bb" << instr.blocks[i]->id << ']';
+            }
+            return os;
+        default:
+            break;
+    }
+
+    bool first = instr.opcode != IROpcode::Call;
+    for (IRInstr *operand : instr.operands) {
+        os << (first ? "" : ", ") << '%' << operand->id;
+        first = false;
+    }
+    for (IRBlock *block : instr.blocks) {
+        os << (first ? "" : ", ") << "bb" << block->id;
+        first = false;
+    }
+    return os;
+}
+
+std::ostream &operator<<(std::ostream &os, IRFunction &fn) {
+    os << "function " << fn.fnDef->identifier << " {\n";
+    for (std::size_t i = 0; i < fn.frameObjects.size(); i++) {
+        os << "    ; frame object " << i << ": " << fn.frameObjects[i].size
+           << " bytes\n";
+    }
+    for (IRBlock *block : fn.blocks) {
+        os << "bb" << block->id << ':';
+        if (!block->preds.empty()) {
+            os << "  ; preds:";
+            for (IRBlock *pred : block->preds) {
+                os << " bb" << pred->id;
+            }
+        }
+        os << '\n';
+        for (IRInstr *instr : block->instrs) {
+            os << "    " << *instr << '\n';
+        }
+    }
+    return os << "}\n";
+}
+
+/* SECTION: Dominators */
+
+DominatorTree::DominatorTree(IRFunction &fn)
+        : order(fn.numBlockIds(), -1),
+          idoms(fn.numBlockIds(), nullptr) {
+    if (fn.blocks.empty()) { return; }
+
+    // Postorder by an explicit stack, as functions can nest deeply
+    std::vector<IRBlock *> postorder;
+    std::vector<bool> visited(fn.numBlockIds(), false);
+    std::vector<std::pair<IRBlock *, std::size_t>> stack;
+    stack.emplace_back(fn.blocks.front(), 0);
+    visited[fn.blocks.front()->id] = true;
+    while (!stack.empty()) {
+        IRBlock *block = stack.back().first;
+        std::vector<IRBlock *> succs = block->succs();
+        if (stack.back().second < succs.size()) {
+            IRBlock *succ = succs[stack.back().second++];
+            if (!visited[succ->id]) {
+                visited[succ->id] = true;
+                stack.emplace_back(succ, 0);
+            }
+            continue;
+        }
+        postorder.push_back(block);
+        stack.pop_back();
+    }
+    rpo.assign(postorder.rbegin(), postorder.rend());
+    for (std::size_t i = 0; i < rpo.size(); i++) {
+        order[rpo[i]->id] = i;
+    }
+
+    IRBlock *entry = rpo.front();
+    idoms[entry->id] = entry;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (std::size_t i = 1; i < rpo.size(); i++) {
+            IRBlock *block = rpo[i];
+            IRBlock *newIdom = nullptr;
+            for (IRBlock *pred : block->preds) {
+                if (!idoms[pred->id]) { continue; }
+                if (!newIdom) {
+                    newIdom = pred;
+                    continue;
+                }
+                // Intersect the two dominator chains
+                IRBlock *a = pred, *b = newIdom;
+                while (a != b) {
+                    while (order[a->id] > order[b->id]) { a = idoms[a->id]; }
+                    while (order[b->id] > order[a->id]) { b = idoms[b->id]; }
+                }
+                newIdom = a;
+            }
+            if (idoms[block->id] != newIdom) {
+                idoms[block->id] = newIdom;
+                changed = true;
+            }
+        }
+    }
+}
+
+bool DominatorTree::reachable(IRBlock *block) {
+    return order[block->id] >= 0;
+}
+
+bool DominatorTree::dominates(IRBlock *a, IRBlock *b) {
+    if (!reachable(a) || !reachable(b)) { return false; }
+    while (order[b->id] > order[a->id]) {
+        b = idoms[b->id];
+    }
+    return a == b;
+}
+
+IRBlock *DominatorTree::idom(IRBlock *block) {
+    return reachable(block) ? idoms[block->id] : nullptr;
+}
@@ -0,0 +1,657 @@
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "ast/ast.hpp"
+#include "ir/ir.hpp"
+
+typedef StackFrame::Reservation Reservation;
+
+InstructionSelector::InstructionSelector(CompileState *cs, IRFunction &fn,
+                                         FnOutput &output)
+        : cs(cs),
+          fn(fn),
+          output(output),
+          intType(cs->types.get(BuiltinType::Int)) {}
+
+unsigned InstructionSelector::accessSize(IRInstr *memOp) {
+    return memOp->type->size() == 1 ? 1 : 8;
+}
+
+// ldr/str take a signed 9-bit offset, or an unsigned 12-bit one scaled by
+// the size of the access
+static bool fitsOffset(long offset, unsigned size) {
+    return (offset >= -256 && offset <= 255)
+        || (offset >= 0 && offset % size == 0 && offset / size < 4096);
+}
+
+// Frame objects are addressed from sp once the frame is laid out, with
+// scaled offsets that reach the whole of most frames, and emitAddress
+// falls back on a register for the rest
+static bool fitsFrameOffset(long offset, unsigned size) {
+    return offset % size == 0;
+}
+
+static bool isAddress(IRInstr *instr) {
+    return instr->opcode == IROpcode::BinaryOp
+        && instr->op == BuiltinOperator::Plus
+        && instr->type->kind == TypeNode::Pointer;
+}
+
+// The size of every load and store through addr, if that is all it is used
+// for and they agree, and otherwise 0
+static unsigned addressSize(IRInstr *addr) {
+    unsigned size = 0;
+    for (IRInstr *user : addr->users) {
+        if ((user->opcode != IROpcode::Load && user->opcode != IROpcode::Store)
+                || user->operands[0] != addr
+                || (user->opcode == IROpcode::Store
+                    && user->operands[1] == addr)) {
+            return 0;
+        }
+        const unsigned userSize = user->type->size() == 1 ? 1 : 8;
+        if (size != 0 && size != userSize) { return 0; }
+        size = userSize;
+    }
+    return size;
+}
+
+// Like StackFrame::immediateOperand: a constant first operand is used as
+// the immediate with op reversed
+bool InstructionSelector::immediateOperand(IRInstr *instr,
+                                           BuiltinOperator &op,
+                                           unsigned &immIndex, long &imm) {
+    op = instr->op;
+    long value;
+    if (instr->operands[1]->isConst(value)
+            && StackFrame::fitsImmediate(op, value)) {
+        immIndex = 1;
+        imm = value;
+        return true;
+    }
+    BuiltinOperator swapped;
+    if (instr->operands[0]->isConst(value)
+            && StackFrame::reversed(op, swapped)
+            && StackFrame::fitsImmediate(swapped, value)) {
+        op = swapped;
+        immIndex = 0;
+        imm = value;
+        return true;
+    }
+    return false;
+}
+
+/*
+    frameaddr n                       → [fp, #-offset]
+    frameaddr n + const c             → [fp, #-offset + c]
+    base + const c                    → [base, #c]
+    base + index * 8  (access of 8)   → [base, index, LSL #3]
+    base + index      (access of 1)   → [base, index]
+*/
+bool InstructionSelector::matchAddress(IRInstr *addr, unsigned size,
+                                       AddressMode &mode) {
+    mode = AddressMode();
+    if (addr->opcode == IROpcode::FrameAddr) {
+        mode.frameObject = addr->imm;
+        return fitsFrameOffset(-frameOffsets[addr->imm], size);
+    }
+    if (!isAddress(addr)) { return false; }
+
+    IRInstr *ptr = addr->operands[0], *offset = addr->operands[1];
+    if (ptr->type->kind != TypeNode::Pointer) { std::swap(ptr, offset); }
+    long value;
+    if (offset->isConst(value)) {
+        mode.offset = value;
+        if (ptr->opcode == IROpcode::FrameAddr) {
+            mode.frameObject = ptr->imm;
+            return fitsFrameOffset(value - frameOffsets[ptr->imm], size);
+        }
+        mode.base = ptr;
+        return fitsOffset(value, size);
+    }
+
+    mode.base = ptr;
+    if (size == 8 && offset->opcode == IROpcode::BinaryOp
+            && offset->op == BuiltinOperator::Star) {
+        if (offset->operands[1]->isConst(value) && value == 8) {
+            mode.index = offset->operands[0];
+        } else if (offset->operands[0]->isConst(value) && value == 8) {
+            mode.index = offset->operands[1];
+        }
+        if (mode.index) {
+            mode.shift = 3;
+            return true;
+        }
+    }
+    if (size == 1) {
+        mode.index = offset;
+        return true;
+    }
+    return false;
+}
+
+// Whether user reads its i-th operand without it being in a register
+bool InstructionSelector::absorbs(IRInstr *user, unsigned i) {
+    IRInstr *value = user->operands[i];
+    const bool isConst = value->opcode == IROpcode::Const;
+    AddressMode mode;
+    switch (user->opcode) {
+        case IROpcode::Load:
+        case IROpcode::Store: {
+            if (i != 0) { return isConst; }
+            if (value->opcode == IROpcode::FrameAddr) {
+                return fitsFrameOffset(-frameOffsets[value->imm],
+                                       accessSize(user));
+            }
+            const unsigned size = addressSize(value);
+            return size == accessSize(user) && matchAddress(value, size, mode);
+        }
+        case IROpcode::BinaryOp: {
+            if (folded[user->id] && isAddress(user)) {
+                matchAddress(user, addressSize(user), mode);
+                return value != mode.base && value != mode.index;
+            }
+            if (folded[user->id] && user->op == BuiltinOperator::Star) {
+                // Scales an index, which the addresses using it read
+                IRInstr *addr = user->users.front();
+                matchAddress(addr, addressSize(addr), mode);
+                return value != mode.index;
+            }
+            BuiltinOperator op;
+            unsigned immIndex;
+            long imm;
+            return isConst && immediateOperand(user, op, immIndex, imm)
+                && immIndex == i;
+        }
+        case IROpcode::CondBr: {
+            Condition cond;
+            return isConst
+                || (value->opcode == IROpcode::BinaryOp
+                    && StackFrame::isRelational(value->op, cond)
+                    && value->users.size() == 1
+                    && value->block == user->block);
+        }
+        case IROpcode::Phi:
+        case IROpcode::Call:
+        case IROpcode::Svc:
+        case IROpcode::Ret:
+            return isConst;
+        default:
+            return false;
+    }
+}
+
+// A value is folded if every use of it absorbs it. Users come after the
+// values they use, so walking backwards decides them first.
+void InstructionSelector::chooseFolding() {
+    for (auto block = blocks.rbegin(); block != blocks.rend(); ++block) {
+        for (auto instr = (*block)->instrs.rbegin();
+             instr != (*block)->instrs.rend(); ++instr) {
+            IRInstr *value = *instr;
+            if (!value->hasResult() || value->users.empty()) { continue; }
+            bool fold = true;
+            for (IRInstr *user : value->users) {
+                for (unsigned i = 0; i < user->operands.size() && fold; i++) {
+                    if (user->operands[i] == value) { fold = absorbs(user, i); }
+                }
+                if (!fold) { break; }
+            }
+            folded[value->id] = fold;
+        }
+    }
+}
+
+void InstructionSelector::collectUses(IRInstr *value,
+                                      std::vector<IRInstr *> &reads) {
+    if (!folded[value->id]) {
+        reads.push_back(value);
+        return;
+    }
+    if (value->opcode != IROpcode::BinaryOp) { return; }
+
+    if (isAddress(value)) {
+        AddressMode mode;
+        matchAddress(value, addressSize(value), mode);
+        if (mode.base) { collectUses(mode.base, reads); }
+        if (mode.index) { collectUses(mode.index, reads); }
+        return;
+    }
+    // A comparison folded into a branch
+    BuiltinOperator op;
+    unsigned immIndex = 2;
+    long imm;
+    immediateOperand(value, op, immIndex, imm);
+    for (unsigned i = 0; i < value->operands.size(); i++) {
+        if (i != immIndex) { collectUses(value->operands[i], reads); }
+    }
+}
+
+/* SECTION: Layout */
+
+// A block that only branches on, with nothing to copy for the phis of its
+// target, gets no code: branches to it go straight to the target
+bool InstructionSelector::isEmpty(IRBlock *block) {
+    if (block == blocks.front()) { return false; }
+    IRInstr *term = block->terminator();
+    if (term->opcode != IROpcode::Br || term->blocks[0] == block) {
+        return false;
+    }
+    for (IRInstr *instr : block->instrs) {
+        if (instr != term && instr->opcode != IROpcode::Phi
+                && !folded[instr->id]) {
+            return false;
+        }
+    }
+    for (IRInstr *phi : term->blocks[0]->instrs) {
+        if (phi->opcode != IROpcode::Phi) { break; }
+        IRInstr *input = phi->incoming(block);
+        if (folded[input->id] || locations[input->id] != locations[phi->id]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void InstructionSelector::layOut(MachineFunction &mf) {
+    targets.assign(fn.numBlockIds(), nullptr);
+    for (IRBlock *block : blocks) {
+        std::vector<IRBlock *> path;
+        IRBlock *target = block;
+        while (!targets[target->id] && isEmpty(target)
+               && std::find(path.begin(), path.end(), target) == path.end()) {
+            path.push_back(target);
+            target = target->terminator()->blocks[0];
+        }
+        if (targets[target->id]) {
+            target = targets[target->id];
+        } else if (std::find(path.begin(), path.end(), target) != path.end()) {
+            // A loop of empty blocks is an infinite loop, and is kept
+            for (IRBlock *inLoop : path) { targets[inLoop->id] = inLoop; }
+            continue;
+        } else {
+            targets[target->id] = target;
+        }
+        for (IRBlock *skipped : path) { targets[skipped->id] = target; }
+    }
+
+    labels.assign(fn.numBlockIds(), (int)MachineBasicBlock::NoLabel);
+    for (IRBlock *block : blocks) {
+        if (targets[block->id] != block) { continue; }
+        layout.push_back(block);
+        if (block != blocks.front()) {
+            labels[block->id] = mf.newLabel(fn.fnDef->identifier + "_BB_"
+                                            + std::to_string(block->id));
+        }
+    }
+}
+
+/* SECTION: Emission */
+
+void InstructionSelector::select(MachineFunction &mf, unsigned returnLabel) {
+    this->returnLabel = returnLabel;
+    DominatorTree domTree(fn);
+    for (IRBlock *block : fn.blocks) {
+        if (domTree.reachable(block)) { blocks.push_back(block); }
+    }
+
+    // Frame objects go first below fp, each aligned to its size like the
+    // variables of StackFrame
+    long stackPos = 0;
+    for (const FrameObject &object : fn.frameObjects) {
+        const long align = std::max(object.align, 1l);
+        stackPos += object.size;
+        stackPos = (stackPos + align - 1) / align * align;
+        frameOffsets.push_back(stackPos);
+    }
+
+    folded.assign(fn.numValues(), false);
+    chooseFolding();
+    uses.assign(fn.numValues(), std::vector<IRInstr *>());
+    for (IRBlock *block : blocks) {
+        for (IRInstr *instr : block->instrs) {
+            if (folded[instr->id] || instr->opcode == IROpcode::Phi) {
+                continue;
+            }
+            // A tail call leaves lr as it is, and its value in x0
+            hasCalls |= instr->opcode == IROpcode::Call && !instr->isTailCall;
+            if (instr->opcode == IROpcode::Ret && !instr->operands.empty()
+                    && instr->operands[0]->isTailCall) {
+                continue;
+            }
+            for (IRInstr *operand : instr->operands) {
+                collectUses(operand, uses[instr->id]);
+            }
+        }
+    }
+
+    {
+        TimeScope timeScope(cs->trace, "LinearScan", fn.fnDef->identifier);
+        LinearScan allocator(fn, blocks, intType, folded, uses);
+        allocator.allocate(stackPos);
+        locations = allocator.locations;
+        savedRegs = allocator.calleeSaved;
+        numSpills = allocator.numSpills;
+    }
+    frameSize = stackPos;
+    // sp stays put in the selected code, so the frame record is only there
+    // for calls
+    frameTop = FrameLayout::size(savedRegs.size(), (frameSize + 15) / 16 * 16,
+                                 hasCalls);
+
+    layOut(mf);
+    for (std::size_t i = 0; i < layout.size(); i++) {
+        IRBlock *block = layout[i];
+        IRBlock *next = i + 1 < layout.size() ? layout[i + 1] : nullptr;
+        if (i > 0) { mf.startBlock(labels[block->id]); }
+        for (IRInstr *instr : block->instrs) {
+            if (!folded[instr->id]) { emitInstr(mf, instr, next); }
+        }
+    }
+}
+
+// Where value is, loading it into scratch unless it is in a register
+Reservation InstructionSelector::operand(MachineFunction &mf, IRInstr *value,
+                                         Register scratch) {
+    if (!folded[value->id] && locations[value->id].kind == Reservation::Reg) {
+        return locations[value->id];
+    }
+    Reservation res(intType, scratch);
+    emitCopy(mf, value, res);
+    return res;
+}
+
+void InstructionSelector::emitCopy(MachineFunction &mf, IRInstr *value,
+                                   Reservation to) {
+    if (folded[value->id]) {
+        to.emitPutValue(mf, value->imm);
+    } else {
+        locations[value->id].emitCopyTo(mf, to);
+    }
+}
+
+// The phis of the successor take their values from this block all at once,
+// so a copy waits until nothing still reads its destination. Copies that
+// wait on each other go through x17.
+void InstructionSelector::emitPhiCopies(MachineFunction &mf,
+                                        IRBlock *block) {
+    struct Move {
+        Reservation from, to;
+    };
+    std::vector<Move> moves;
+    std::vector<IRInstr *> constants;
+    IRBlock *succ = block->terminator()->blocks[0];
+    for (IRInstr *phi : succ->instrs) {
+        if (phi->opcode != IROpcode::Phi) { break; }
+        IRInstr *input = phi->incoming(block);
+        if (folded[input->id]) {
+            constants.push_back(phi);
+        } else if (locations[input->id] != locations[phi->id]) {
+            moves.push_back(Move{locations[input->id], locations[phi->id]});
+        }
+    }
+
+    while (!moves.empty()) {
+        bool progress = false;
+        for (std::size_t i = 0; i < moves.size() && !progress; i++) {
+            bool blocked = false;
+            for (std::size_t j = 0; j < moves.size(); j++) {
+                blocked |= j != i && moves[j].from == moves[i].to;
+            }
+            if (!blocked) {
+                moves[i].from.emitCopyTo(mf, moves[i].to);
+                moves.erase(moves.begin() + i);
+                progress = true;
+            }
+        }
+        if (!progress) {
+            Reservation saved = moves.front().to;
+            Reservation temp(intType, Register::x17);
+            saved.emitCopyTo(mf, temp);
+            for (Move &move : moves) {
+                if (move.from == saved) { move.from = temp; }
+            }
+        }
+    }
+    for (IRInstr *phi : constants) {
+        locations[phi->id].emitPutValue(mf, phi->incoming(block)->imm);
+    }
+}
+
+MOperand InstructionSelector::emitAddress(MachineFunction &mf,
+                                          IRInstr *memOp) {
+    IRInstr *addr = memOp->operands[0];
+    StackFrame::Address address;
+    if (!folded[addr->id]) {
+        address.base = locations[addr->id];
+        return StackFrame::emitAddress(mf, address);
+    }
+
+    AddressMode mode;
+    matchAddress(addr, accessSize(memOp), mode);
+    if (mode.frameObject >= 0) {
+        const long offset = mode.offset - frameOffsets[mode.frameObject];
+        if (fitsOffset(frameTop + offset, accessSize(memOp))) {
+            return mMem(Register::fp, offset);
+        }
+        // Out of reach of sp once FrameLayout rebases it
+        mf.emit(Opcode::Sub, mReg(Register::x16), mReg(Register::fp),
+                mImm(-offset));
+        return mMem(Register::x16);
+    }
+    address.base = locations[mode.base->id];
+    if (mode.index) { address.index = locations[mode.index->id]; }
+    address.offset = mode.offset;
+    address.shift = mode.shift;
+    return StackFrame::emitAddress(mf, address);
+}
+
+void InstructionSelector::emitInstr(MachineFunction &mf, IRInstr *instr,
+                                    IRBlock *next) {
+    Reservation dst;
+    if (instr->hasResult()) { dst = locations[instr->id]; }
+    Reservation tmp = dst.valid && dst.kind == Reservation::Reg
+        ? dst : Reservation(intType, Register::x16);
+
+    switch (instr->opcode) {
+        case IROpcode::Const:
+            dst.emitPutValue(mf, instr->imm);
+            break;
+        case IROpcode::Param:
+            Reservation(intType, (Register)instr->imm).emitCopyTo(mf, dst);
+            break;
+        case IROpcode::Phi:
+            break;
+        case IROpcode::BinaryOp:
+            emitBinaryOp(mf, instr);
+            break;
+        case IROpcode::UnaryOp:
+            StackFrame::emitUnaryOp(mf, instr->op, dst,
+                                    locations[instr->operands[0]->id]);
+            break;
+        case IROpcode::Trunc:
+            StackFrame::emitBinaryOpImm(mf, BuiltinOperator::BitAnd, dst,
+                                        locations[instr->operands[0]->id],
+                                        0xff);
+            break;
+        case IROpcode::Load: {
+            MOperand mem = emitAddress(mf, instr);
+            if (accessSize(instr) == 1) {
+                mf.emit(Opcode::Ldrb, mReg(tmp.location.reg, RegWidth::W),
+                        mem);
+            } else {
+                mf.emit(Opcode::Ldr, mReg(tmp.location.reg), mem);
+            }
+            tmp.emitCopyTo(mf, dst);
+            break;
+        }
+        case IROpcode::Store: {
+            MOperand mem = emitAddress(mf, instr);
+            Reservation src = operand(mf, instr->operands[1], Register::x17);
+            if (accessSize(instr) == 1) {
+                mf.emit(Opcode::Strb, mReg(src.location.reg, RegWidth::W),
+                        mem);
+            } else {
+                mf.emit(Opcode::Str, mReg(src.location.reg), mem);
+            }
+            break;
+        }
+        case IROpcode::FrameAddr: {
+            // Any offset, as FrameLayout rebases it
+            mf.emit(Opcode::Sub, mReg(tmp.location.reg), mReg(Register::fp),
+                    mImm(frameOffsets[instr->imm]));
+            tmp.emitCopyTo(mf, dst);
+            break;
+        }
+        case IROpcode::StaticAddr: {
+            const std::string *dataLabel = &instr->staticData->label();
+            mf.emit(Opcode::Adrp, mReg(tmp.location.reg),
+                    mSymbol(dataLabel, MOperand::Page));
+            mf.emit(Opcode::Add, mReg(tmp.location.reg),
+                    mReg(tmp.location.reg),
+                    mSymbol(dataLabel, MOperand::PageOff));
+            tmp.emitCopyTo(mf, dst);
+            break;
+        }
+        case IROpcode::Call:
+            emitCall(mf, instr);
+            break;
+        case IROpcode::Svc:
+            for (unsigned i = 1; i < instr->operands.size(); i++) {
+                emitCopy(mf, instr->operands[i],
+                         Reservation(intType, (Register)(i - 1)));
+            }
+            emitCopy(mf, instr->operands[0],
+                     Reservation(intType, Register::x16));
+            mf.emit(Opcode::Svc, mImm(0));
+            Reservation(intType, Register::x0).emitCopyTo(mf, dst);
+            break;
+        case IROpcode::Br:
+            emitPhiCopies(mf, instr->block);
+            emitBranch(mf, instr->blocks[0], next);
+            break;
+        case IROpcode::CondBr:
+            emitCondBr(mf, instr, next);
+            break;
+        case IROpcode::Ret: {
+            // The callee of a tail call returns for us
+            std::vector<IRInstr *> &instrs = instr->block->instrs;
+            if (instrs.size() >= 2
+                    && instrs[instrs.size() - 2]->isTailCall) {
+                break;
+            }
+            if (!instr->operands.empty()) {
+                emitCopy(mf, instr->operands[0],
+                         Reservation(intType, Register::x0));
+            }
+            mf.emit(Opcode::B, mLabel(returnLabel));
+            break;
+        }
+    }
+}
+
+void InstructionSelector::emitBinaryOp(MachineFunction &mf, IRInstr *instr) {
+    Reservation dst = locations[instr->id];
+    BuiltinOperator op;
+    unsigned immIndex;
+    long imm;
+    if (immediateOperand(instr, op, immIndex, imm)) {
+        StackFrame::emitBinaryOpImm(
+            mf, op, dst, locations[instr->operands[1 - immIndex]->id], imm);
+        return;
+    }
+
+    Reservation opr1 = locations[instr->operands[0]->id];
+    Reservation opr2 = locations[instr->operands[1]->id];
+    if (dst.kind == Reservation::Reg && opr1.kind != Reservation::Reg
+            && opr2 == dst) {
+        // opr1 would be loaded into dst over opr2
+        Reservation x16(intType, Register::x16);
+        StackFrame::emitBinaryOp(mf, instr->op, x16, opr1, opr2);
+        x16.emitCopyTo(mf, dst);
+        return;
+    }
+    StackFrame::emitBinaryOp(mf, instr->op, dst, opr1, opr2);
+}
+
+void InstructionSelector::emitCall(MachineFunction &mf, IRInstr *instr) {
+    for (auto &builtin : BUILTIN_FNS) {
+        if (builtin.second == *instr->callee) {
+            output.usedBuiltinFns.insert(builtin.first);
+        }
+    }
+    for (unsigned i = 0; i < instr->operands.size(); i++) {
+        emitCopy(mf, instr->operands[i], Reservation(intType, (Register)i));
+    }
+    // FrameLayout::emit puts the epilogue before the branch
+    if (instr->isTailCall) {
+        mf.emit(Opcode::B, mSymbol(instr->callee));
+        return;
+    }
+    mf.emit(Opcode::Bl, mSymbol(instr->callee));
+    if (instr->hasResult()) {
+        Reservation(intType, Register::x0).emitCopyTo(mf,
+                                                      locations[instr->id]);
+    }
+}
+
+// Branches to whichever target doesn't follow, and falls through to the
+// other
+void InstructionSelector::emitCondBr(MachineFunction &mf, IRInstr *instr,
+                                     IRBlock *next) {
+    IRInstr *cond = instr->operands[0];
+    IRBlock *ifTrue = targets[instr->blocks[0]->id];
+    IRBlock *ifFalse = targets[instr->blocks[1]->id];
+    long value;
+    if (cond->isConst(value)) {
+        emitBranch(mf, value != 0 ? ifTrue : ifFalse, next);
+        return;
+    }
+
+    bool branchIf = true;
+    IRBlock *target = ifTrue, *other = ifFalse;
+    if (ifTrue == next) {
+        branchIf = false;
+        std::swap(target, other);
+    }
+    MOperand label = mLabel(labels[target->id]);
+
+    if (!folded[cond->id]) {
+        Reservation res = operand(mf, cond, Register::x16);
+        mf.emit(branchIf ? Opcode::Cbnz : Opcode::Cbz,
+                mReg(res.location.reg), label);
+        emitBranch(mf, other, next);
+        return;
+    }
+
+    BuiltinOperator op;
+    unsigned immIndex;
+    long imm;
+    const bool useImm = immediateOperand(cond, op, immIndex, imm);
+    Condition relation;
+    StackFrame::isRelational(op, relation);
+    IRInstr *lhs = cond->operands[useImm ? 1 - immIndex : 0];
+    Reservation l = operand(mf, lhs, Register::x16);
+    if (useImm && imm == 0
+            && (relation == Condition::Eq || relation == Condition::Ne)) {
+        const bool ifZero = (relation == Condition::Eq) == branchIf;
+        mf.emit(ifZero ? Opcode::Cbz : Opcode::Cbnz, mReg(l.location.reg),
+                label);
+    } else {
+        if (useImm) {
+            mf.emit(Opcode::Cmp, mReg(l.location.reg), mImm(imm));
+        } else {
+            Reservation r = operand(mf, cond->operands[1], Register::x17);
+            mf.emit(Opcode::Cmp, mReg(l.location.reg), mReg(r.location.reg));
+        }
+        mf.emit(Opcode::BCond,
+                mCond(branchIf ? relation : inverse(relation)), label);
+    }
+    emitBranch(mf, other, next);
+}
+
+void InstructionSelector::emitBranch(MachineFunction &mf, IRBlock *target,
+                                     IRBlock *next) {
+    target = targets[target->id];
+    if (target != next) {
+        mf.emit(Opcode::B, mLabel(labels[target->id]));
+    }
+}
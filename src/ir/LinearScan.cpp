@@ -0,0 +1,328 @@
+#include <algorithm>
+#include <vector>
+#include "ast/ast.hpp"
+#include "ir/ir.hpp"
+
+// x8 is free as qcc never returns structs indirectly. x16 and x17 are the
+// scratch registers of code generation, and x0-x7 are for arguments.
+static const Register CALLER_SAVED[] = {
+    Register::x8, Register::x9, Register::x10, Register::x11,
+    Register::x12, Register::x13, Register::x14, Register::x15,
+};
+static const Register CALLEE_SAVED[] = {
+    Register::x19, Register::x20, Register::x21, Register::x22,
+    Register::x23, Register::x24, Register::x25, Register::x26,
+    Register::x27, Register::x28,
+};
+
+static bool isCalleeSaved(int reg) {
+    return reg >= (int)Register::x19 && reg <= (int)Register::x28;
+}
+
+/* SECTION: Intervals */
+
+bool LinearScan::Interval::covers(unsigned pos) const {
+    for (const Range &range : ranges) {
+        if (pos < range.from) { return false; }
+        if (pos <= range.to) { return true; }
+    }
+    return false;
+}
+
+bool LinearScan::Interval::intersects(const Interval &other) const {
+    std::size_t i = 0, j = 0;
+    while (i < ranges.size() && j < other.ranges.size()) {
+        const Range &a = ranges[i], &b = other.ranges[j];
+        if (a.to < b.from) {
+            i++;
+        } else if (b.to < a.from) {
+            j++;
+        } else {
+            return true;
+        }
+    }
+    return false;
+}
+
+LinearScan::LinearScan(IRFunction &fn, const std::vector<IRBlock *> &blocks,
+                       TypeNode *intType, const std::vector<bool> &folded,
+                       const std::vector<std::vector<IRInstr *>> &uses)
+        : locations(fn.numValues()),
+          fn(fn),
+          blocks(blocks),
+          intType(intType),
+          folded(folded),
+          uses(uses),
+          intervals(fn.numValues()),
+          blockFrom(fn.numBlockIds()),
+          blockTo(fn.numBlockIds()),
+          positions(fn.numValues()) {}
+
+bool LinearScan::needsLocation(IRInstr *value) {
+    return value->hasResult() && !folded[value->id];
+}
+
+// Instructions are numbered 0, 2, 4, ... in the order they are emitted. An
+// instruction at p reads its operands at p and defines its value at p + 1,
+// so an operand's register may be reused for the result. The copies for
+// phis happen at the end of each predecessor, between its terminator at t
+// and t + 1, the end of the block.
+void LinearScan::number() {
+    unsigned pos = 0;
+    for (IRBlock *block : blocks) {
+        blockFrom[block->id] = pos;
+        for (IRInstr *instr : block->instrs) {
+            positions[instr->id] = pos;
+            intervals[instr->id].value = instr;
+            if (instr->opcode == IROpcode::Call) {
+                callPositions.push_back(pos);
+            }
+            pos += 2;
+        }
+        blockTo[block->id] = pos - 1;
+    }
+}
+
+void LinearScan::addRange(IRInstr *value, unsigned from, unsigned to) {
+    std::vector<Range> &ranges = intervals[value->id].ranges;
+
+    // Ranges are mostly added in reverse, so search from the front
+    std::size_t i = 0;
+    while (i < ranges.size() && ranges[i].to + 1 < from) { i++; }
+    std::size_t j = i;
+    while (j < ranges.size() && ranges[j].from <= to + 1) {
+        from = std::min(from, ranges[j].from);
+        to = std::max(to, ranges[j].to);
+        j++;
+    }
+    ranges.erase(ranges.begin() + i, ranges.begin() + j);
+    ranges.insert(ranges.begin() + i, Range{from, to});
+}
+
+typedef std::vector<unsigned long> LiveSet;
+
+static bool contains(const LiveSet &set, unsigned id) {
+    return set[id / 64] >> (id % 64) & 1;
+}
+
+static void insert(LiveSet &set, unsigned id) {
+    set[id / 64] |= 1ul << (id % 64);
+}
+
+static void remove(LiveSet &set, unsigned id) {
+    set[id / 64] &= ~(1ul << (id % 64));
+}
+
+void LinearScan::buildIntervals() {
+    const std::size_t words = (fn.numValues() + 63) / 64;
+
+    // Values live into each block, not counting its phis. The inputs of a
+    // successor's phis are used at the end of a block instead.
+    std::vector<LiveSet> liveIn(fn.numBlockIds(), LiveSet(words, 0));
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (auto it = blocks.rbegin(); it != blocks.rend(); ++it) {
+            IRBlock *block = *it;
+            LiveSet live(words, 0);
+            for (IRBlock *succ : block->succs()) {
+                for (std::size_t i = 0; i < words; i++) {
+                    live[i] |= liveIn[succ->id][i];
+                }
+                for (IRInstr *phi : succ->instrs) {
+                    if (phi->opcode != IROpcode::Phi) { break; }
+                    IRInstr *input = phi->incoming(block);
+                    if (needsLocation(input)) { insert(live, input->id); }
+                }
+            }
+            for (auto instr = block->instrs.rbegin();
+                 instr != block->instrs.rend(); ++instr) {
+                if ((*instr)->hasResult()) { remove(live, (*instr)->id); }
+                if ((*instr)->opcode == IROpcode::Phi) { continue; }
+                for (IRInstr *value : uses[(*instr)->id]) {
+                    insert(live, value->id);
+                }
+            }
+            if (live != liveIn[block->id]) {
+                liveIn[block->id].swap(live);
+                changed = true;
+            }
+        }
+    }
+
+    for (auto it = blocks.rbegin(); it != blocks.rend(); ++it) {
+        IRBlock *block = *it;
+        const unsigned from = blockFrom[block->id], to = blockTo[block->id];
+        LiveSet live(words, 0);
+        for (IRBlock *succ : block->succs()) {
+            for (std::size_t i = 0; i < words; i++) {
+                live[i] |= liveIn[succ->id][i];
+            }
+        }
+        for (unsigned id = 0; id < fn.numValues(); id++) {
+            if (live[id / 64] == 0) {
+                id = id / 64 * 64 + 63;
+                continue;
+            }
+            if (contains(live, id)) { addRange(intervals[id].value, from, to); }
+        }
+
+        // The phi copies, just before the block ends
+        const unsigned term = to - 1;
+        for (IRBlock *succ : block->succs()) {
+            for (IRInstr *phi : succ->instrs) {
+                if (phi->opcode != IROpcode::Phi) { break; }
+                IRInstr *input = phi->incoming(block);
+                if (needsLocation(input)) {
+                    addRange(input, from, term);
+                    insert(live, input->id);
+                    intervals[phi->id].hints.push_back(input);
+                    intervals[input->id].hints.push_back(phi);
+                }
+                addRange(phi, term + 1, term + 1);
+            }
+        }
+
+        for (auto instr = block->instrs.rbegin();
+             instr != block->instrs.rend(); ++instr) {
+            const unsigned pos = positions[(*instr)->id];
+            if (needsLocation(*instr)) {
+                // Phis are defined as the block starts
+                const unsigned def = (*instr)->opcode == IROpcode::Phi
+                    ? from : pos + 1;
+                Interval &interval = intervals[(*instr)->id];
+                if (contains(live, (*instr)->id)) {
+                    interval.ranges.front().from = def;
+                } else {
+                    addRange(*instr, def, def);
+                }
+                remove(live, (*instr)->id);
+            }
+            if ((*instr)->opcode == IROpcode::Phi) { continue; }
+            for (IRInstr *value : uses[(*instr)->id]) {
+                addRange(value, from, pos);
+                insert(live, value->id);
+            }
+        }
+    }
+
+    for (Interval &interval : intervals) {
+        for (const Range &range : interval.ranges) {
+            auto call = std::lower_bound(callPositions.begin(),
+                                         callPositions.end(), range.from);
+            if (call != callPositions.end() && *call + 1 <= range.to) {
+                interval.crossesCall = true;
+                break;
+            }
+        }
+    }
+}
+
+/* SECTION: Allocation */
+
+int LinearScan::chooseRegister(Interval &current,
+                               std::vector<Interval *> &active,
+                               std::vector<Interval *> &inactive) {
+    bool busy[32] = {};
+    for (Interval *interval : active) {
+        busy[interval->reg] = true;
+    }
+    for (Interval *interval : inactive) {
+        if (interval->intersects(current)) { busy[interval->reg] = true; }
+    }
+
+    for (IRInstr *hint : current.hints) {
+        const int reg = intervals[hint->id].reg;
+        if (reg >= 0 && !busy[reg]
+                && (!current.crossesCall || isCalleeSaved(reg))) {
+            return reg;
+        }
+    }
+    if (!current.crossesCall) {
+        for (Register reg : CALLER_SAVED) {
+            if (!busy[(int)reg]) { return (int)reg; }
+        }
+    }
+    for (Register reg : CALLEE_SAVED) {
+        if (!busy[(int)reg]) { return (int)reg; }
+    }
+    return -1;
+}
+
+void LinearScan::allocate(long &stackPos) {
+    number();
+    buildIntervals();
+
+    std::vector<Interval *> unhandled;
+    for (Interval &interval : intervals) {
+        if (!interval.ranges.empty()) { unhandled.push_back(&interval); }
+    }
+    std::stable_sort(unhandled.begin(), unhandled.end(),
+                     [](Interval *a, Interval *b) {
+                         return a->start() < b->start();
+                     });
+
+    std::vector<Interval *> active, inactive, spilled;
+    for (Interval *current : unhandled) {
+        const unsigned pos = current->start();
+        for (std::size_t i = 0; i < active.size(); i++) {
+            if (active[i]->end() < pos || !active[i]->covers(pos)) {
+                if (active[i]->end() >= pos) { inactive.push_back(active[i]); }
+                active.erase(active.begin() + i--);
+            }
+        }
+        for (std::size_t i = 0; i < inactive.size(); i++) {
+            if (inactive[i]->end() < pos || inactive[i]->covers(pos)) {
+                if (inactive[i]->end() >= pos) { active.push_back(inactive[i]); }
+                inactive.erase(inactive.begin() + i--);
+            }
+        }
+
+        current->reg = chooseRegister(*current, active, inactive);
+        if (current->reg < 0) {
+            // Spill whichever ends last, as it holds its register longest
+            Interval *victim = nullptr;
+            for (Interval *interval : active) {
+                if (current->crossesCall && !isCalleeSaved(interval->reg)) {
+                    continue;
+                }
+                bool taken = false;
+                for (Interval *other : inactive) {
+                    taken |= other->reg == interval->reg
+                        && other->intersects(*current);
+                }
+                if (!taken && (!victim || interval->end() > victim->end())) {
+                    victim = interval;
+                }
+            }
+            if (victim && victim->end() > current->end()) {
+                current->reg = victim->reg;
+                victim->reg = -1;
+                active.erase(std::find(active.begin(), active.end(), victim));
+                spilled.push_back(victim);
+            } else {
+                spilled.push_back(current);
+            }
+        }
+        if (current->reg >= 0) { active.push_back(current); }
+    }
+
+    stackPos = (stackPos + 7) / 8 * 8;
+    for (Interval *interval : spilled) {
+        stackPos += 8;
+        locations[interval->value->id] = StackFrame::Reservation(intType,
+                                                                  stackPos);
+        numSpills++;
+    }
+    for (Interval &interval : intervals) {
+        if (interval.reg < 0) { continue; }
+        locations[interval.value->id] = StackFrame::Reservation(
+            intType, (Register)interval.reg);
+        if (isCalleeSaved(interval.reg)) {
+            calleeSaved.push_back((Register)interval.reg);
+        }
+    }
+    std::sort(calleeSaved.begin(), calleeSaved.end());
+    calleeSaved.erase(std::unique(calleeSaved.begin(), calleeSaved.end()),
+                      calleeSaved.end());
+}
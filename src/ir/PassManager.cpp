@@ -0,0 +1,45 @@
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include "ast/ast.hpp"
+#include "ir/ir.hpp"
+
+PassManager::PassManager(CompileState *cs) : cs(cs) {}
+
+void PassManager::add(IRPass *pass) {
+    passes.emplace_back(pass);
+}
+
+void PassManager::addStandardPasses() {
+    if (cs->optLevel >= 1) {
+        add(new SimplifyCFG());
+        add(new DeadCodeElimination());
+        add(new TailCallElimination());
+        // Branches on what became constants, and blocks left empty
+        add(new SimplifyCFG());
+    }
+    // Instruction selection puts the copies for phis at the end of each
+    // predecessor
+    add(new SplitCriticalEdges());
+}
+
+void PassManager::run(IRFunction &fn) {
+    verify(fn, "IRBuilder");
+    for (std::unique_ptr<IRPass> &pass : passes) {
+        {
+            TimeScope timeScope(cs->trace, pass->name(),
+                                fn.fnDef->identifier);
+            pass->run(fn);
+        }
+        verify(fn, pass->name());
+    }
+}
+
+void PassManager::verify(IRFunction &fn, const char *after) {
+    if (!cs->verifyIR) { return; }
+    std::string error;
+    if (IRVerifier(fn).verify(error)) { return; }
+    std::cerr << "COMPILER ERROR: Invalid IR for " << fn.fnDef->identifier
+              << " after " << after << ": " << error << '\n' << fn;
+    exit(EXIT_FAILURE);
+}
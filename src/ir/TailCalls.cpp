@@ -0,0 +1,172 @@
+#include <algorithm>
+#include <vector>
+#include "ast/ast.hpp"
+#include "ir/ir.hpp"
+
+// The call just before a ret that returns its value, or nothing
+static IRInstr *returnedCall(IRBlock *block) {
+    IRInstr *ret = block->terminator();
+    if (ret->opcode != IROpcode::Ret || block->instrs.size() < 2) {
+        return nullptr;
+    }
+    IRInstr *call = block->instrs[block->instrs.size() - 2];
+    if (call->opcode != IROpcode::Call) { return nullptr; }
+    if (!ret->operands.empty() && ret->operands[0] != call) { return nullptr; }
+    for (IRInstr *user : call->users) {
+        if (user != ret) { return nullptr; }
+    }
+    return call;
+}
+
+/*
+    A block that only returns, what flows into it or nothing, is copied into
+    each predecessor whose last act is a call that flows into it, so that
+    the call is returned at once there:
+
+    bb2:                                  bb2:
+        %7:int = call f, %6                   %7:int = call f, %6
+        br bb4                                ret %7
+    bb4:  ; preds: bb1 bb2
+        %8:int = phi [%3, bb1], [%7, bb2]
+        ret %8
+*/
+bool TailCallElimination::duplicateReturns(IRFunction &fn) {
+    bool changed = false;
+    std::vector<IRBlock *> blocks = fn.blocks;
+    for (IRBlock *block : blocks) {
+        IRInstr *ret = block->terminator();
+        if (ret->opcode != IROpcode::Ret) { continue; }
+        IRInstr *phi = nullptr;
+        if (!ret->operands.empty()) {
+            phi = ret->operands[0];
+            if (block->instrs.size() != 2 || block->instrs[0] != phi
+                    || phi->opcode != IROpcode::Phi || phi->users.size() != 1) {
+                continue;
+            }
+        } else if (block->instrs.size() != 1) {
+            continue;
+        }
+
+        std::vector<IRBlock *> preds = block->preds;
+        if (preds.empty()) { continue; }
+        for (IRBlock *pred : preds) {
+            std::vector<IRInstr *> &instrs = pred->instrs;
+            if (instrs.size() < 2
+                    || pred->terminator()->opcode != IROpcode::Br) {
+                continue;
+            }
+            IRInstr *call = instrs[instrs.size() - 2];
+            if (call->opcode != IROpcode::Call
+                    || call->users.size() != (phi ? 1 : 0)
+                    || (phi && phi->incoming(pred) != call)) {
+                continue;
+            }
+
+            pred->erase(pred->terminator());
+            block->preds.erase(std::find(block->preds.begin(),
+                                         block->preds.end(), pred));
+            if (phi) { phi->removeIncoming(pred); }
+            IRInstr *newRet = fn.create(IROpcode::Ret, nullptr);
+            if (phi) { newRet->addOperand(call); }
+            pred->append(newRet);
+            changed = true;
+        }
+        if (block->preds.empty()) { fn.eraseBlock(block); }
+    }
+    return changed;
+}
+
+/*
+    A call whose value is returned at once needs nothing of the caller's
+    frame afterwards, unless the callee was given a pointer into it, so
+    functions with frame objects are left alone. Calls to other functions
+    become branches once the frame is torn down. Calls to the function
+    itself become a loop, with a block after the entry where phis take the
+    arguments in place of the parameters:
+
+    bb0:                                  bb0:
+        %1:int = param 0                      %1:int = param 0
+        ...                                   br bb5
+        %7:int = call f, %6               bb5:  ; preds: bb0 bb3
+        ret %7                                %8:int = phi [%1, bb0], [%6, bb3]
+                                              ...
+                                              br bb5
+*/
+bool TailCallElimination::run(IRFunction &fn) {
+    if (!fn.frameObjects.empty()) { return false; }
+
+    std::vector<IRInstr *> selfCalls;
+    bool changed = duplicateReturns(fn);
+    for (IRBlock *block : fn.blocks) {
+        IRInstr *call = returnedCall(block);
+        if (!call) { continue; }
+        if (*call->callee == fn.fnDef->identifier) {
+            selfCalls.push_back(call);
+        } else {
+            call->isTailCall = true;
+            changed = true;
+        }
+    }
+    if (selfCalls.empty()) { return changed; }
+
+    IRBlock *header = loopHeader(fn);
+    std::vector<IRInstr *> phis;
+    for (IRInstr *phi : header->instrs) {
+        if (phi->opcode != IROpcode::Phi) { break; }
+        phis.push_back(phi);
+    }
+    for (IRInstr *call : selfCalls) {
+        IRBlock *block = call->block;
+        block->erase(block->terminator());
+        std::vector<IRInstr *> args = call->operands;
+        block->erase(call);
+
+        IRInstr *br = fn.create(IROpcode::Br, nullptr);
+        br->blocks.push_back(header);
+        block->append(br);
+        header->preds.push_back(block);
+        for (IRInstr *phi : phis) {
+            phi->addOperand(args[phi->operands[0]->imm]);
+            phi->blocks.push_back(block);
+        }
+    }
+    return true;
+}
+
+// Moves everything but the parameters out of the entry block into a new
+// block after it, where each parameter is replaced by a phi of itself
+IRBlock *TailCallElimination::loopHeader(IRFunction &fn) {
+    IRBlock *entry = fn.blocks.front();
+    IRBlock *header = fn.createBlock();
+    fn.blocks.insert(fn.blocks.begin() + 1, header);
+
+    std::vector<IRInstr *> params, rest;
+    for (IRInstr *instr : entry->instrs) {
+        (instr->opcode == IROpcode::Param ? params : rest).push_back(instr);
+    }
+    entry->instrs = params;
+    for (IRInstr *instr : rest) {
+        header->append(instr);
+    }
+    for (IRBlock *succ : header->succs()) {
+        std::replace(succ->preds.begin(), succ->preds.end(), entry, header);
+        for (IRInstr *phi : succ->instrs) {
+            if (phi->opcode != IROpcode::Phi) { break; }
+            std::replace(phi->blocks.begin(), phi->blocks.end(), entry,
+                         header);
+        }
+    }
+    IRInstr *br = fn.create(IROpcode::Br, nullptr);
+    br->blocks.push_back(header);
+    entry->append(br);
+    header->preds.push_back(entry);
+
+    for (IRInstr *param : params) {
+        IRInstr *phi = fn.create(IROpcode::Phi, param->type);
+        header->insertAtStart(phi);
+        param->replaceAllUsesWith(phi);
+        phi->addOperand(param);
+        phi->blocks.push_back(entry);
+    }
+    return header;
+}
@@ -0,0 +1,199 @@
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "ast/ast.hpp"
+#include "ir/ir.hpp"
+
+IRVerifier::IRVerifier(IRFunction &fn) : fn(fn) {}
+
+template <typename T>
+static unsigned count(const std::vector<T *> &list, T *item) {
+    return std::count(list.begin(), list.end(), item);
+}
+
+static unsigned expectedOperands(IRInstr *instr, bool &exact) {
+    exact = true;
+    switch (instr->opcode) {
+        case IROpcode::Const:
+        case IROpcode::Param:
+        case IROpcode::FrameAddr:
+        case IROpcode::StaticAddr:
+        case IROpcode::Br:
+            return 0;
+        case IROpcode::UnaryOp:
+        case IROpcode::Trunc:
+        case IROpcode::Load:
+        case IROpcode::CondBr:
+            return 1;
+        case IROpcode::BinaryOp:
+        case IROpcode::Store:
+            return 2;
+        case IROpcode::Svc:
+            exact = false;
+            return 1;
+        case IROpcode::Ret:
+        case IROpcode::Phi:
+        case IROpcode::Call:
+            exact = false;
+            return 0;
+    }
+    return 0;
+}
+
+bool IRVerifier::verify(std::string &error) {
+    std::ostringstream os;
+    if (fn.blocks.empty()) {
+        error = "no entry block";
+        return false;
+    }
+    if (!fn.blocks.front()->preds.empty()) {
+        os << "entry block bb" << fn.blocks.front()->id
+           << " has predecessors";
+        error = os.str();
+        return false;
+    }
+
+    DominatorTree domTree(fn);
+    for (IRBlock *block : fn.blocks) {
+        os << "bb" << block->id << ": ";
+        const std::size_t prefix = os.str().size();
+
+        IRInstr *term = block->terminator();
+        if (!term) {
+            os << "does not end in a terminator";
+        }
+
+        // Edges match in both directions
+        for (IRBlock *succ : term ? block->succs() : std::vector<IRBlock *>()) {
+            if (count(fn.blocks, succ) != 1) {
+                os << "branches to bb" << succ->id << ", which is not placed";
+            } else if (count(succ->preds, block) != 1) {
+                os << "is not listed once among the predecessors of its "
+                      "successor bb" << succ->id;
+            }
+            if (os.str().size() != prefix) { break; }
+        }
+        for (IRBlock *pred : block->preds) {
+            if (os.str().size() != prefix) { break; }
+            if (count(fn.blocks, pred) != 1) {
+                os << "has predecessor bb" << pred->id << ", which is not placed";
+            } else if (count(pred->succs(), block) != 1) {
+                os << "has predecessor bb" << pred->id
+                   << ", which doesn't branch to it";
+            }
+        }
+
+        bool pastPhis = false;
+        for (std::size_t i = 0; i < block->instrs.size(); i++) {
+            if (os.str().size() != prefix) { break; }
+            IRInstr *instr = block->instrs[i];
+
+            if (instr->block != block) {
+                os << '%' << instr->id << " belongs to another block";
+                break;
+            }
+            if (instr->isTerminator() && i + 1 != block->instrs.size()) {
+                os << "terminator %" << instr->id << " is not last";
+                break;
+            }
+            if (instr->opcode == IROpcode::Phi) {
+                if (pastPhis) {
+                    os << "phi %" << instr->id << " follows other instructions";
+                    break;
+                }
+                if (instr->operands.size() != instr->blocks.size()
+                        || instr->blocks.size() != block->preds.size()) {
+                    os << "phi %" << instr->id
+                       << " doesn't have one value per predecessor";
+                    break;
+                }
+                for (IRBlock *pred : block->preds) {
+                    if (count(instr->blocks, pred) != 1) {
+                        os << "phi %" << instr->id
+                           << " has no single value from bb" << pred->id;
+                        break;
+                    }
+                }
+            } else {
+                pastPhis = true;
+            }
+
+            bool exact;
+            const unsigned expected = expectedOperands(instr, exact);
+            if (exact ? instr->operands.size() != expected
+                      : instr->operands.size() < expected) {
+                os << '%' << instr->id << " has " << instr->operands.size()
+                   << " operands";
+                break;
+            }
+            if (instr->isTailCall
+                    && !(i + 2 == block->instrs.size()
+                         && block->instrs[i + 1]->opcode == IROpcode::Ret
+                         && instr->users.size()
+                             == block->instrs[i + 1]->operands.size())) {
+                os << "tail call %" << instr->id
+                   << " isn't returned at once";
+                break;
+            }
+            if ((instr->opcode == IROpcode::Br && instr->blocks.size() != 1)
+                    || (instr->opcode == IROpcode::CondBr
+                        && instr->blocks.size() != 2)) {
+                os << "branch %" << instr->id << " has "
+                   << instr->blocks.size() << " targets";
+                break;
+            }
+
+            for (std::size_t j = 0; j < instr->operands.size(); j++) {
+                IRInstr *operand = instr->operands[j];
+                if (!operand->block) {
+                    os << '%' << instr->id << " uses %" << operand->id
+                       << ", which was removed";
+                } else if (!operand->hasResult()) {
+                    os << '%' << instr->id << " uses %" << operand->id
+                       << ", which has no value";
+                } else if (count(operand->users, instr)
+                           != count(instr->operands, operand)) {
+                    os << "the users of %" << operand->id
+                       << " don't match its uses by %" << instr->id;
+                } else if (instr->opcode == IROpcode::Phi) {
+                    // Flows in along the edge, so it must be available at
+                    // the end of the predecessor
+                    IRBlock *pred = instr->blocks[j];
+                    if (domTree.reachable(pred)
+                            && !domTree.dominates(operand->block, pred)) {
+                        os << "phi %" << instr->id << " takes %"
+                           << operand->id << " from bb" << pred->id
+                           << ", which it doesn't dominate";
+                    }
+                } else if (domTree.reachable(block)) {
+                    IRBlock *def = operand->block;
+                    bool dominates = def == block
+                        ? std::find(block->instrs.begin(),
+                                    block->instrs.begin() + i, operand)
+                              != block->instrs.begin() + i
+                        : domTree.dominates(def, block);
+                    if (!dominates) {
+                        os << '%' << instr->id << " uses %" << operand->id
+                           << " before it is defined";
+                    }
+                }
+                if (os.str().size() != prefix) { break; }
+            }
+            for (IRInstr *user : instr->users) {
+                if (os.str().size() != prefix) { break; }
+                if (count(user->operands, instr) == 0) {
+                    os << '%' << user->id << " is a user of %" << instr->id
+                       << " but doesn't use it";
+                }
+            }
+        }
+
+        if (os.str().size() != prefix) {
+            error = os.str();
+            return false;
+        }
+        os.str("");
+    }
+    return true;
+}
@@ -0,0 +1,449 @@
+#pragma once
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "CompileState.hpp"
+
+/*
+  Mid-level IR: each function is a control-flow graph of basic blocks of
+  three-address instructions in SSA form. Every instruction that produces a
+  value is that value, typed with the TypeNode of the expression it came
+  from. Control flow joins merge values with phis, which come first in their
+  block; every block ends in exactly one terminator (br, condbr or ret).
+
+  IRBuilder lowers a FnDefNode to IR, PassManager runs the optimization
+  passes over it, and InstructionSelector turns it into machine code.
+*/
+
+class IRBlock;
+class IRFunction;
+
+enum class IROpcode {
+    Const,       // imm
+    Param,       // imm: index of the parameter
+    Phi,         // operands[i] flows in from blocks[i]
+    BinaryOp,    // op; relational operators give 0 or 1
+    UnaryOp,     // op: Minus or BitNot
+    Trunc,       // Low byte of the operand, as stored to a char variable
+    Load,        // operands: address
+    Store,       // operands: address, value; type: of the value stored
+    FrameAddr,   // imm: frame object
+    StaticAddr,  // staticData
+    Call,        // callee; operands: arguments
+    Svc,         // operands: syscall number, arguments
+    Br,          // blocks: target
+    CondBr,      // operands: condition; blocks: if nonzero, if zero
+    Ret,         // operands: value, unless the function returns nothing
+};
+
+class IRInstr {
+public:
+    IROpcode opcode;
+    unsigned id;                 // Unique in the function, numbers values
+    TypeNode *type;              // Of the result (or of the value stored)
+    IRBlock *block = nullptr;    // Null once removed from its block
+    std::vector<IRInstr *> operands;
+    std::vector<IRBlock *> blocks;   // Phi: incoming; Br/CondBr: successors
+    std::vector<IRInstr *> users;    // One entry per use
+    BuiltinOperator op = BuiltinOperator::Plus;  // BinaryOp/UnaryOp
+    long imm = 0;                                // Const/Param/FrameAddr
+    const std::string *callee = nullptr;         // Call
+    bool isTailCall = false;  // Call: returned at once, so a branch
+    StaticData *staticData = nullptr;            // StaticAddr
+
+    IRInstr(IROpcode opcode, unsigned id, TypeNode *type);
+
+    bool hasResult() const;
+    bool isTerminator() const;
+    bool hasSideEffects() const;
+    bool isConst(long &value) const;
+
+    void addOperand(IRInstr *value);
+    void setOperand(unsigned i, IRInstr *value);
+    void removeOperand(unsigned i);
+    void dropOperands();
+    void replaceAllUsesWith(IRInstr *value);
+    // Phi only: the value flowing in from pred
+    IRInstr *incoming(IRBlock *pred);
+    void removeIncoming(IRBlock *pred);
+};
+
+class IRBlock {
+public:
+    unsigned id;
+    std::vector<IRInstr *> instrs;
+    // Distinct predecessors, in no particular order
+    std::vector<IRBlock *> preds;
+
+    IRBlock(unsigned id);
+    IRInstr *terminator();
+    // Distinct successors, from the terminator
+    std::vector<IRBlock *> succs();
+    void append(IRInstr *instr);
+    // After the phis
+    void insertAtStart(IRInstr *instr);
+    void insertBeforeTerminator(IRInstr *instr);
+    // Unlinks instr from its block and its operands; it must have no users
+    void erase(IRInstr *instr);
+    // Points the terminator's edges to from at to instead, keeping preds up
+    // to date. The phis of from and to are left to the caller.
+    void replaceSuccessor(IRBlock *from, IRBlock *to);
+};
+
+// An array or a variable whose address is taken, which lives in the frame
+struct FrameObject {
+    long size;
+    long align;
+};
+
+class IRFunction {
+public:
+    FnDefNode *fnDef;
+    std::vector<IRBlock *> blocks;  // In layout order, entry first
+    std::vector<FrameObject> frameObjects;
+
+    IRFunction(FnDefNode *fnDef);
+    IRFunction(const IRFunction &) = delete;
+    IRFunction &operator=(const IRFunction &) = delete;
+
+    IRInstr *create(IROpcode opcode, TypeNode *type);
+    // Not placed in the layout until it is inserted into blocks
+    IRBlock *createBlock();
+    // Removes block from the layout; it must have no predecessors
+    void eraseBlock(IRBlock *block);
+    unsigned numValues() const;
+    unsigned numBlockIds() const;
+
+private:
+    std::vector<std::unique_ptr<IRInstr>> instrPool;
+    std::vector<std::unique_ptr<IRBlock>> blockPool;
+};
+
+std::ostream &operator<<(std::ostream &os, IRInstr &instr);
+std::ostream &operator<<(std::ostream &os, IRFunction &fn);
+
+// Immediate dominators by the iterative algorithm of Cooper, Harvey and
+// Kennedy. Blocks unreachable from the entry have no dominator.
+class DominatorTree {
+public:
+    DominatorTree(IRFunction &fn);
+    bool reachable(IRBlock *block);
+    bool dominates(IRBlock *a, IRBlock *b);
+    IRBlock *idom(IRBlock *block);
+    // Reachable blocks, each before its successors except along back edges
+    const std::vector<IRBlock *> &reversePostorder() { return rpo; }
+
+private:
+    std::vector<IRBlock *> rpo;
+    std::vector<int> order;     // Indexed by block id, -1 if unreachable
+    std::vector<IRBlock *> idoms;  // Indexed by block id
+};
+
+/* SECTION: Construction */
+
+// Builds SSA form directly from the AST, by the algorithm of Braun et al.,
+// "Simple and Efficient Construction of Static Single Assignment Form".
+// Variables whose address is taken live in the frame instead, as do arrays.
+//
+// Calls to small functions, functions called from only one place and
+// functions marked inline are inlined as they are lowered: the callee's
+// variables get slots after the caller's, its parameters are assigned the
+// arguments, and its returns assign a result variable and branch to the end
+// of the call.
+class IRBuilder {
+public:
+    IRBuilder(CompileState *cs, FnDefNode *fnDef, IRFunction &fn);
+    void build();
+
+    // The functions that calls in fnDef may inline, directly or through
+    // other inlined functions, in the order they are first called
+    static void inlineCandidates(CompileState *cs, FnDefNode *fnDef,
+                                 std::vector<FnDefNode *> &candidates);
+
+private:
+    struct BlockState {
+        std::vector<IRInstr *> defs;  // Current value of each variable
+        std::vector<std::pair<unsigned, IRInstr *>> incompletePhis;
+        bool sealed = false;
+    };
+
+    // A call whose callee is being lowered in place
+    struct Inlining {
+        FnDefNode *callee;
+        unsigned slotBase;    // Of the callee's slot 0
+        unsigned resultSlot;  // Assigned by its returns
+        IRBlock *exit;        // Where its returns branch to
+    };
+
+    CompileState *cs;
+    FnDefNode *fnDef;
+    IRFunction &fn;
+    TypeNode *intType;
+    IRBlock *current = nullptr;
+    std::vector<BlockState> states;     // Indexed by block id
+    // Indexed by variable: the caller's slots, then those of inlined calls
+    std::vector<TypeNode *> varTypes;
+    std::vector<int> frameSlots;        // Frame object of each variable, or -1
+    std::vector<TypeNode *> addrTypes;  // Type of &x, for frame variables
+    std::vector<IRInstr *> forwarded;   // Replacement of each removed phi
+    // Latch and exit blocks of the enclosing while loops
+    std::vector<std::pair<IRBlock *, IRBlock *>> loops;
+    std::vector<Inlining> inlined;      // Innermost last
+    unsigned slotBase = 0;              // Of the function being lowered
+    unsigned inlinedCost = 0;
+
+    IRBlock *newBlock();
+    void startBlock(IRBlock *block);
+    void sealBlock(IRBlock *block);
+    void addEdge(IRBlock *from, IRBlock *to);
+    IRInstr *emit(IROpcode opcode, TypeNode *type);
+    IRInstr *constant(long value, TypeNode *type);
+    void branch(IRBlock *target);
+    void condBranch(IRInstr *cond, IRBlock *ifTrue, IRBlock *ifFalse);
+
+    void writeVariable(unsigned slot, IRBlock *block, IRInstr *value);
+    IRInstr *readVariable(unsigned slot, IRBlock *block);
+    IRInstr *readVariableRecursive(unsigned slot, IRBlock *block);
+    IRInstr *addPhiOperands(unsigned slot, IRInstr *phi);
+    IRInstr *tryRemoveTrivialPhi(IRInstr *phi);
+    IRInstr *undefined(TypeNode *type);
+    IRInstr *resolve(IRInstr *value);
+
+    // The variable of a slot of the function being lowered
+    unsigned var(unsigned slot) const { return slotBase + slot; }
+    void scanVariables(std::vector<StatementNode *> &block);
+    void scanVariables(ExprNode *expr);
+    void allocateFrameSlots(unsigned from);
+    void assign(unsigned slot, TypeNode *type, IRInstr *value);
+    IRInstr *variable(unsigned slot, TypeNode *type);
+
+    void lowerBlock(std::vector<StatementNode *> &block);
+    void lowerStatement(StatementNode *statement);
+    void lowerIf(IfNode *ifNode);
+    void lowerWhile(WhileNode *whileNode);
+    IRInstr *lowerExpr(ExprNode *expr);
+    IRInstr *lowerFnCall(FnCallNode *fnCall);
+    IRInstr *lowerArray(ExprNode *expr);
+
+    FnDefNode *inlineCallee(FnCallNode *fnCall);
+    IRInstr *inlineCall(FnCallNode *fnCall, FnDefNode *callee);
+};
+
+/* SECTION: Passes */
+
+class IRPass {
+public:
+    virtual ~IRPass() {}
+    virtual const char *name() const = 0;
+    // Returns whether fn changed
+    virtual bool run(IRFunction &fn) = 0;
+};
+
+// Runs passes in order, timing each with the compile's TimeTrace. With
+// -verify-ir, the IR is checked after construction and after every pass.
+class PassManager {
+public:
+    PassManager(CompileState *cs);
+    // Takes ownership of pass
+    void add(IRPass *pass);
+    // The passes for cs->optLevel, ending with what instruction selection
+    // needs
+    void addStandardPasses();
+    void run(IRFunction &fn);
+    void verify(IRFunction &fn, const char *after);
+
+private:
+    CompileState *cs;
+    std::vector<std::unique_ptr<IRPass>> passes;
+};
+
+// Checks the structural invariants of the IR: terminators, phis, edges,
+// use lists, and that every use is dominated by its definition
+class IRVerifier {
+public:
+    IRVerifier(IRFunction &fn);
+    // Describes the first problem found in error
+    bool verify(std::string &error);
+
+private:
+    IRFunction &fn;
+};
+
+// Folds away blocks that only branch on, merges blocks into a predecessor
+// that always flows into them, and turns branches on constants, or to the
+// same block either way, into plain branches
+class SimplifyCFG : public IRPass {
+public:
+    const char *name() const override { return "SimplifyCFG"; }
+    bool run(IRFunction &fn) override;
+
+private:
+    bool foldBranch(IRBlock *block);
+    bool skipEmptyBlock(IRFunction &fn, IRBlock *block);
+    bool mergeIntoPred(IRFunction &fn, IRBlock *block);
+};
+
+// Removes unreachable blocks, stores to the frame that are never read or
+// are overwritten before they can be, instructions whose values nothing
+// needs, and the frame objects left unused
+class DeadCodeElimination : public IRPass {
+public:
+    const char *name() const override { return "DeadCodeElimination"; }
+    bool run(IRFunction &fn) override;
+
+private:
+    bool removeUnreachable(IRFunction &fn);
+    bool removeDeadStores(IRFunction &fn);
+    bool removeDeadInstrs(IRFunction &fn);
+    bool removeUnusedFrameObjects(IRFunction &fn);
+};
+
+// Marks calls whose value is returned at once as tail calls, which branch
+// to the callee, and turns those to the function itself into a loop
+class TailCallElimination : public IRPass {
+public:
+    const char *name() const override { return "TailCallElimination"; }
+    bool run(IRFunction &fn) override;
+
+private:
+    bool duplicateReturns(IRFunction &fn);
+    IRBlock *loopHeader(IRFunction &fn);
+};
+
+// Gives every edge from a block with several successors to a block with
+// phis a block of its own, where instruction selection can put the copies
+// for the phis
+class SplitCriticalEdges : public IRPass {
+public:
+    const char *name() const override { return "SplitCriticalEdges"; }
+    bool run(IRFunction &fn) override;
+};
+
+/* SECTION: Code generation */
+
+// Assigns each value a register or a stack slot by linear scan over live
+// intervals with lifetime holes (Wimmer and Franz, "Linear Scan Register
+// Allocation on SSA Form"), without splitting intervals. Values live across
+// a call get callee-saved registers; the others prefer x8-x15, which need no
+// saving. Values that instruction selection folds into their users get no
+// location. Phis are hinted to share a register with their inputs, so that
+// most copies for them disappear.
+class LinearScan {
+public:
+    // Indexed by value id; invalid for folded values
+    std::vector<StackFrame::Reservation> locations;
+    std::vector<Register> calleeSaved;  // Used, so saved by the prologue
+    unsigned long numSpills = 0;
+
+    // blocks are the reachable ones in the order they are emitted, and uses
+    // gives the values each instruction other than a phi reads where it is
+    LinearScan(IRFunction &fn, const std::vector<IRBlock *> &blocks,
+               TypeNode *intType, const std::vector<bool> &folded,
+               const std::vector<std::vector<IRInstr *>> &uses);
+    // Spill slots are placed below stackPos, which is then past them
+    void allocate(long &stackPos);
+
+private:
+    struct Range {
+        unsigned from, to;  // Inclusive
+    };
+    struct Interval {
+        IRInstr *value = nullptr;
+        std::vector<Range> ranges;  // Sorted and disjoint
+        int reg = -1;
+        bool crossesCall = false;
+        std::vector<IRInstr *> hints;
+
+        bool covers(unsigned pos) const;
+        bool intersects(const Interval &other) const;
+        unsigned start() const { return ranges.front().from; }
+        unsigned end() const { return ranges.back().to; }
+    };
+
+    IRFunction &fn;
+    const std::vector<IRBlock *> &blocks;
+    TypeNode *intType;
+    const std::vector<bool> &folded;
+    const std::vector<std::vector<IRInstr *>> &uses;
+    std::vector<Interval> intervals;           // Indexed by value id
+    std::vector<unsigned> blockFrom, blockTo;  // Indexed by block id
+    std::vector<unsigned> positions;           // Indexed by value id
+    std::vector<unsigned> callPositions;
+
+    bool needsLocation(IRInstr *value);
+    void number();
+    void buildIntervals();
+    void addRange(IRInstr *value, unsigned from, unsigned to);
+    int chooseRegister(Interval &current, std::vector<Interval *> &active,
+                       std::vector<Interval *> &inactive);
+};
+
+// Lowers IR to machine code, one IR instruction at a time. Constants that
+// fit an instruction's immediate, address arithmetic that fits a load or
+// store's addressing mode and comparisons that only feed a branch are
+// folded into the instructions that use them.
+//
+// The body goes after the block the caller reserved for the prologue, and
+// returns branch to returnLabel, where the caller puts the epilogue.
+class InstructionSelector {
+public:
+    std::vector<Register> savedRegs;  // Callee-saved registers used
+    long frameSize = 0;               // Frame objects and spill slots
+    bool hasCalls = false;
+    unsigned long numSpills = 0;
+
+    InstructionSelector(CompileState *cs, IRFunction &fn, FnOutput &output);
+    void select(MachineFunction &mf, unsigned returnLabel);
+
+private:
+    // The address of a load or store, when its computation is folded in:
+    // [fp, #offset] for a frame object, or [base, #offset] or
+    // [base, index, LSL #shift]
+    struct AddressMode {
+        IRInstr *base = nullptr;
+        IRInstr *index = nullptr;
+        long frameObject = -1;
+        long offset = 0;
+        unsigned shift = 0;
+    };
+
+    CompileState *cs;
+    IRFunction &fn;
+    FnOutput &output;
+    TypeNode *intType;
+    std::vector<IRBlock *> blocks;             // Reachable, in layout order
+    std::vector<bool> folded;                  // Indexed by value id
+    std::vector<std::vector<IRInstr *>> uses;  // Indexed by value id
+    std::vector<StackFrame::Reservation> locations;
+    std::vector<long> frameOffsets;            // Below fp, of each object
+    long frameTop = 0;                         // Above sp, where fp stands
+    std::vector<IRBlock *> layout;             // The blocks given code
+    std::vector<IRBlock *> targets;            // Where each block leads
+    std::vector<int> labels;                   // Indexed by block id
+    unsigned returnLabel;
+
+    static unsigned accessSize(IRInstr *memOp);
+    static bool immediateOperand(IRInstr *instr, BuiltinOperator &op,
+                                 unsigned &immIndex, long &imm);
+    bool matchAddress(IRInstr *addr, unsigned size, AddressMode &mode);
+    bool absorbs(IRInstr *user, unsigned i);
+    void chooseFolding();
+    // What reading value takes, with folded values replaced by their parts
+    void collectUses(IRInstr *value, std::vector<IRInstr *> &reads);
+    bool isEmpty(IRBlock *block);
+    void layOut(MachineFunction &mf);
+
+    StackFrame::Reservation operand(MachineFunction &mf, IRInstr *value,
+                                    Register scratch);
+    void emitCopy(MachineFunction &mf, IRInstr *value,
+                  StackFrame::Reservation to);
+    void emitPhiCopies(MachineFunction &mf, IRBlock *block);
+    MOperand emitAddress(MachineFunction &mf, IRInstr *memOp);
+    void emitInstr(MachineFunction &mf, IRInstr *instr, IRBlock *next);
+    void emitBinaryOp(MachineFunction &mf, IRInstr *instr);
+    void emitCall(MachineFunction &mf, IRInstr *instr);
+    void emitCondBr(MachineFunction &mf, IRInstr *instr, IRBlock *next);
+    void emitBranch(MachineFunction &mf, IRBlock *target, IRBlock *next);
+};
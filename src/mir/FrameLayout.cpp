@@ -0,0 +1,217 @@
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+#include "mir/mir.hpp"
+
+// add and sub take a 12-bit immediate, optionally shifted left by 12, so
+// frames are kept below 16MB
+static const long MAX_FRAME_SIZE = 1l << 24;
+
+// ldr/str take a signed 9-bit offset, or an unsigned 12-bit one scaled by
+// the size of the access
+static bool fitsOffset(long offset, unsigned size) {
+    return (offset >= -256 && offset <= 255)
+        || (offset >= 0 && offset % size == 0 && offset / size < 4096);
+}
+
+static unsigned accessSize(const MachineInstr &instr) {
+    switch (instr.opcode) {
+        case Opcode::Ldrb:
+        case Opcode::Strb:
+            return 1;
+        default:
+            return instr.operands[0].width == RegWidth::W ? 4 : 8;
+    }
+}
+
+// dst = src + imm, in up to two instructions
+static void emitAddImm(std::vector<MachineInstr> &instrs, Register dst,
+                       Register src, long imm) {
+    const Opcode opcode = imm < 0 ? Opcode::Sub : Opcode::Add;
+    const long value = imm < 0 ? -imm : imm;
+    if (value >> 12) {
+        instrs.emplace_back(opcode, mReg(dst), mReg(src), mImm(value >> 12),
+                            mLsl(12));
+        src = dst;
+    }
+    if ((value & 0xfff) != 0 || src != dst) {
+        instrs.emplace_back(opcode, mReg(dst), mReg(src),
+                            mImm(value & 0xfff));
+    }
+}
+
+static void frameTooLarge(MachineFunction &mf) {
+    std::cerr << "COMPILER ERROR: Frame of " << *mf.name
+              << " is too large to address\n";
+    exit(EXIT_FAILURE);
+}
+
+FrameLayout::FrameLayout(std::vector<Register> savedRegs, long localsSize,
+                         bool hasCalls)
+        : savedRegs(savedRegs),
+          localsSize(localsSize),
+          hasCalls(hasCalls) {}
+
+void FrameLayout::emit(MachineFunction &mf, unsigned returnLabel) {
+    // Pushes move sp away from the locals, and fp takes its place, so it
+    // is saved like lr
+    if (movesSp(mf)) { base = Register::fp; }
+    saveFp = hasCalls || base == Register::fp;
+    frameSize = size(savedRegs.size(), localsSize, saveFp);
+    if (frameSize >= MAX_FRAME_SIZE) { frameTooLarge(mf); }
+
+    rebase(mf);
+    emitPrologue(mf.blocks.front().instrs);
+
+    std::vector<MachineInstr> instrs = epilogue();
+    for (MachineBasicBlock &block : mf.blocks) {
+        std::vector<MachineInstr> &body = block.instrs;
+        for (std::size_t i = 0; i < body.size(); i++) {
+            if (body[i].opcode == Opcode::B
+                    && body[i].operands[0].kind == MOperand::Symbol) {
+                body.insert(body.begin() + i, instrs.begin(), instrs.end());
+                i += instrs.size();
+            }
+        }
+    }
+
+    mf.startBlock(returnLabel);
+    for (MachineInstr &instr : instrs) {
+        mf.blocks.back().instrs.push_back(instr);
+    }
+    mf.emit(Opcode::Ret);
+}
+
+long FrameLayout::size(std::size_t numSavedRegs, long localsSize,
+                       bool saveFp) {
+    const long saveAreaSize = (numSavedRegs * 8 + 15) / 16 * 16;
+    return (saveFp ? 16 : 0) + saveAreaSize + localsSize;
+}
+
+// Whether the body writes sp, as the AST's calls do to save the registers
+// holding expressions
+bool FrameLayout::movesSp(MachineFunction &mf) {
+    for (MachineBasicBlock &block : mf.blocks) {
+        for (MachineInstr &instr : block.instrs) {
+            for (unsigned i = 0; i < instr.numOperands; i++) {
+                const MOperand &op = instr.operands[i];
+                if (op.kind == MOperand::Mem && op.reg == Register::sp
+                        && (op.memMode == MOperand::PreIndex
+                            || op.memMode == MOperand::PostIndex)) {
+                    return true;
+                }
+            }
+            const bool writes = instr.opcode == Opcode::Mov
+                || instr.opcode == Opcode::Add || instr.opcode == Opcode::Sub;
+            if (writes && instr.operands[0].kind == MOperand::Reg
+                    && instr.operands[0].reg == Register::sp) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/*
+    The top of the frame is frameSize above base:
+
+    ldr x9, [fp, #-24]      → ldr x9, [sp, #40]     ; frameSize 64
+    sub x9, fp, #24         → add x9, sp, #40
+*/
+void FrameLayout::rebase(MachineFunction &mf) {
+    for (MachineBasicBlock &block : mf.blocks) {
+        std::vector<MachineInstr> instrs;
+        for (MachineInstr &instr : block.instrs) {
+            if (instr.opcode == Opcode::Sub
+                    && instr.operands[1].kind == MOperand::Reg
+                    && instr.operands[1].reg == Register::fp
+                    && instr.operands[2].kind == MOperand::Imm) {
+                emitAddImm(instrs, instr.operands[0].reg, base,
+                           frameSize - instr.operands[2].imm);
+                continue;
+            }
+            for (unsigned i = 0; i < instr.numOperands; i++) {
+                MOperand &op = instr.operands[i];
+                if (op.kind != MOperand::Mem || op.reg != Register::fp
+                        || (op.memMode != MOperand::Base
+                            && op.memMode != MOperand::Offset)) {
+                    continue;
+                }
+                op.reg = base;
+                op.imm = frameSize + (op.memMode == MOperand::Offset
+                                      ? op.imm : 0);
+                op.memMode = MOperand::Offset;
+                if (!fitsOffset(op.imm, accessSize(instr))) {
+                    frameTooLarge(mf);
+                }
+            }
+            instrs.push_back(instr);
+        }
+        block.instrs.swap(instrs);
+    }
+}
+
+void FrameLayout::emitPrologue(std::vector<MachineInstr> &prologue) {
+    // stp allocates frames that fit its offset along with the frame record
+    if (saveFp && frameSize <= 504) {
+        prologue.emplace_back(Opcode::Stp, mReg(Register::fp),
+                              mReg(Register::lr),
+                              mMem(Register::sp, -frameSize,
+                                   MOperand::PreIndex));
+    } else {
+        if (frameSize > 0) {
+            emitAddImm(prologue, Register::sp, Register::sp, -frameSize);
+        }
+        if (saveFp) {
+            prologue.emplace_back(Opcode::Stp, mReg(Register::fp),
+                                  mReg(Register::lr), mMem(Register::sp));
+        }
+    }
+
+    const long saveOffset = saveFp ? 16 : 0;
+    for (std::size_t i = 0; i < savedRegs.size(); i += 2) {
+        if (i + 1 < savedRegs.size()) {
+            prologue.emplace_back(Opcode::Stp, mReg(savedRegs[i]),
+                                  mReg(savedRegs[i + 1]),
+                                  mMem(Register::sp, saveOffset + i * 8));
+        } else {
+            prologue.emplace_back(Opcode::Str, mReg(savedRegs[i]),
+                                  mMem(Register::sp, saveOffset + i * 8));
+        }
+    }
+    if (saveFp) {
+        prologue.emplace_back(Opcode::Mov, mReg(Register::fp),
+                              mReg(Register::sp));
+    }
+}
+
+std::vector<MachineInstr> FrameLayout::epilogue() {
+    std::vector<MachineInstr> instrs;
+    const long saveOffset = saveFp ? 16 : 0;
+    for (std::size_t i = 0; i < savedRegs.size(); i += 2) {
+        if (i + 1 < savedRegs.size()) {
+            instrs.emplace_back(Opcode::Ldp, mReg(savedRegs[i]),
+                                mReg(savedRegs[i + 1]),
+                                mMem(Register::sp, saveOffset + i * 8));
+        } else {
+            instrs.emplace_back(Opcode::Ldr, mReg(savedRegs[i]),
+                                mMem(Register::sp, saveOffset + i * 8));
+        }
+    }
+
+    if (saveFp && frameSize <= 504) {
+        instrs.emplace_back(Opcode::Ldp, mReg(Register::fp),
+                            mReg(Register::lr),
+                            mMem(Register::sp, frameSize,
+                                 MOperand::PostIndex));
+    } else {
+        if (saveFp) {
+            instrs.emplace_back(Opcode::Ldp, mReg(Register::fp),
+                                mReg(Register::lr), mMem(Register::sp));
+        }
+        if (frameSize > 0) {
+            emitAddImm(instrs, Register::sp, Register::sp, frameSize);
+        }
+    }
+    return instrs;
+}
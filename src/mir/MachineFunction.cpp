@@ -0,0 +1,122 @@
+#include <string>
+#include "mir/mir.hpp"
+#include "util.hpp"
+
+MachineBasicBlock::MachineBasicBlock(int label) : label(label) {}
+
+MachineFunction::MachineFunction(const std::string *name) : name(name) {}
+
+unsigned MachineFunction::newLabel(std::string labelName) {
+    labelNames.push_back(labelName);
+    return labelNames.size() - 1;
+}
+
+MachineBasicBlock &MachineFunction::startBlock(int label) {
+    blocks.emplace_back(label);
+    return blocks.back();
+}
+
+void MachineFunction::emit(Opcode opcode,
+                           MOperand op0, MOperand op1,
+                           MOperand op2, MOperand op3) {
+    if (blocks.empty()) {
+        startBlock();
+    }
+    blocks.back().instrs.emplace_back(opcode, op0, op1, op2, op3);
+}
+
+void MachineFunction::printOperand(AsmWriter &out, MOperand &op) {
+    switch (op.kind) {
+        case MOperand::Reg:
+            if (op.width == RegWidth::X) {
+                switch (op.reg) {
+                    case Register::fp: out << "fp"; return;
+                    case Register::lr: out << "lr"; return;
+                    case Register::sp: out << "sp"; return;
+                    default: break;
+                }
+            }
+            out << (op.width == RegWidth::X ? 'x' : 'w') << (int)op.reg;
+            return;
+        case MOperand::Imm:
+            out << '#' << op.imm;
+            return;
+        case MOperand::Mem: {
+            MOperand base = mReg(op.reg);
+            out << '[';
+            printOperand(out, base);
+            switch (op.memMode) {
+                case MOperand::Base:
+                    out << ']';
+                    break;
+                case MOperand::Offset:
+                    out << ", #" << op.imm << ']';
+                    break;
+                case MOperand::PreIndex:
+                    out << ", #" << op.imm << "]!";
+                    break;
+                case MOperand::PostIndex:
+                    out << "], #" << op.imm;
+                    break;
+                case MOperand::RegOffset: {
+                    MOperand index = mReg(op.index);
+                    out << ", ";
+                    printOperand(out, index);
+                    if (op.imm != 0) { out << ", LSL #" << op.imm; }
+                    out << ']';
+                    break;
+                }
+            }
+            return;
+        }
+        case MOperand::Label:
+            out << labelNames[op.imm];
+            return;
+        case MOperand::Symbol:
+            switch (op.symbolMod) {
+                case MOperand::Function:
+                    out << '_' << *op.symbol;
+                    break;
+                case MOperand::Page:
+                    out << *op.symbol << "@PAGE";
+                    break;
+                case MOperand::PageOff:
+                    out << *op.symbol << "@PAGEOFF";
+                    break;
+            }
+            return;
+        case MOperand::Cond:
+            out << toStr(op.cond);
+            return;
+        case MOperand::Shift:
+            out << (op.shiftOp == MOperand::Lsl ? "LSL #" : "LSR #") << op.imm;
+            return;
+        case MOperand::None:
+            return;
+    }
+}
+
+void MachineFunction::print(AsmWriter &out, unsigned indent) {
+    out.indent(indent) << ".globl _" << *name << '\n';
+    out.indent(indent) << ".p2align 2\n";
+
+    for (MachineBasicBlock &block : blocks) {
+        if (block.label != MachineBasicBlock::NoLabel) {
+            out << labelNames[block.label] << ":\n";
+        }
+        for (MachineInstr &instr : block.instrs) {
+            out.indent(indent) << toStr(instr.opcode);
+            int first = 0;
+            if (instr.opcode == Opcode::BCond) {
+                // b.<cond> <label>
+                out << toStr(instr.operands[first++].cond);
+            }
+            for (int i = first; i < instr.numOperands; i++) {
+                out << (i == first ? " " : ", ");
+                printOperand(out, instr.operands[i]);
+            }
+            out << '\n';
+        }
+    }
+    out << '\n';
+}
@@ -0,0 +1,163 @@
+#include <string>
+#include "mir/mir.hpp"
+
+std::string toStr(Register res, std::string regPrefix) {
+    return regPrefix + std::to_string((int)res);
+}
+
+std::ostream &operator<<(std::ostream &os, Register &reg) {
+    return os << 'x' << (int)reg;
+}
+
+MOperand mReg(Register reg, RegWidth width) {
+    MOperand op;
+    op.kind = MOperand::Reg;
+    op.reg = reg;
+    op.width = width;
+    return op;
+}
+
+MOperand mImm(long imm) {
+    MOperand op;
+    op.kind = MOperand::Imm;
+    op.imm = imm;
+    return op;
+}
+
+MOperand mMem(Register base) {
+    MOperand op;
+    op.kind = MOperand::Mem;
+    op.reg = base;
+    op.memMode = MOperand::Base;
+    return op;
+}
+
+MOperand mMem(Register base, long offset, MOperand::MemMode mode) {
+    MOperand op;
+    op.kind = MOperand::Mem;
+    op.reg = base;
+    op.imm = offset;
+    op.memMode = mode;
+    return op;
+}
+
+MOperand mMem(Register base, Register index, unsigned shift) {
+    MOperand op;
+    op.kind = MOperand::Mem;
+    op.reg = base;
+    op.index = index;
+    op.imm = shift;
+    op.memMode = MOperand::RegOffset;
+    return op;
+}
+
+MOperand mLabel(unsigned label) {
+    MOperand op;
+    op.kind = MOperand::Label;
+    op.imm = label;
+    return op;
+}
+
+MOperand mSymbol(const std::string *symbol, MOperand::SymbolMod mod) {
+    MOperand op;
+    op.kind = MOperand::Symbol;
+    op.symbol = symbol;
+    op.symbolMod = mod;
+    return op;
+}
+
+MOperand mCond(Condition cond) {
+    MOperand op;
+    op.kind = MOperand::Cond;
+    op.cond = cond;
+    return op;
+}
+
+MOperand mLsl(unsigned amount) {
+    MOperand op;
+    op.kind = MOperand::Shift;
+    op.imm = amount;
+    return op;
+}
+
+MOperand mLsr(unsigned amount) {
+    MOperand op;
+    op.kind = MOperand::Shift;
+    op.shiftOp = MOperand::Lsr;
+    op.imm = amount;
+    return op;
+}
+
+MachineInstr::MachineInstr(Opcode opcode,
+                           MOperand op0, MOperand op1,
+                           MOperand op2, MOperand op3)
+        : opcode(opcode),
+          numOperands(0) {
+    for (MOperand op : {op0, op1, op2, op3}) {
+        if (op.kind == MOperand::None) { break; }
+        operands[numOperands++] = op;
+    }
+}
+
+const char *toStr(Opcode opcode) {
+    switch (opcode) {
+        case Opcode::Mov:  return "mov";
+        case Opcode::Movk: return "movk";
+        case Opcode::Add:  return "add";
+        case Opcode::Sub:  return "sub";
+        case Opcode::Mul:  return "mul";
+        case Opcode::Sdiv: return "sdiv";
+        case Opcode::Msub: return "msub";
+        case Opcode::Smulh: return "smulh";
+        case Opcode::Neg:  return "neg";
+        case Opcode::Mvn:  return "mvn";
+        case Opcode::And:  return "and";
+        case Opcode::Orr:  return "orr";
+        case Opcode::Eor:  return "eor";
+        case Opcode::Lsl:  return "lsl";
+        case Opcode::Lsr:  return "lsr";
+        case Opcode::Asr:  return "asr";
+        case Opcode::Cmp:  return "cmp";
+        case Opcode::Cset: return "cset";
+        case Opcode::Ldr:  return "ldr";
+        case Opcode::Ldrb: return "ldrb";
+        case Opcode::Str:  return "str";
+        case Opcode::Strb: return "strb";
+        case Opcode::Ldp:  return "ldp";
+        case Opcode::Stp:  return "stp";
+        case Opcode::Adrp: return "adrp";
+        case Opcode::B:    return "b";
+        case Opcode::BCond: return "b.";
+        case Opcode::Cbz:  return "cbz";
+        case Opcode::Cbnz: return "cbnz";
+        case Opcode::Tbnz: return "tbnz";
+        case Opcode::Bl:   return "bl";
+        case Opcode::Ret:  return "ret";
+        case Opcode::Svc:  return "svc";
+    }
+    return "";
+}
+
+Condition inverse(Condition cond) {
+    switch (cond) {
+        case Condition::Eq: return Condition::Ne;
+        case Condition::Ne: return Condition::Eq;
+        case Condition::Lt: return Condition::Ge;
+        case Condition::Gt: return Condition::Le;
+        case Condition::Le: return Condition::Gt;
+        case Condition::Ge: return Condition::Lt;
+    }
+    return cond;
+}
+
+const char *toStr(Condition cond) {
+    switch (cond) {
+        case Condition::Eq: return "eq";
+        case Condition::Ne: return "ne";
+        case Condition::Lt: return "lt";
+        case Condition::Gt: return "gt";
+        case Condition::Le: return "le";
+        case Condition::Ge: return "ge";
+    }
+    return "";
+}
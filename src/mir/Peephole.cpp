@@ -0,0 +1,255 @@
+#include <sstream>
+#include <string>
+#include "mir/mir.hpp"
+
+static const char *PATTERN_NAMES[] = {
+    "branch", "forward", "move", "pair",
+};
+
+const char *PeepholeOptimizer::patternName(Pattern pattern) {
+    return PATTERN_NAMES[pattern];
+}
+
+bool PeepholeOptimizer::parsePatterns(const std::string &list,
+                                      unsigned &patterns) {
+    patterns = 0;
+    std::istringstream names(list);
+    std::string name;
+    while (std::getline(names, name, ',')) {
+        int pattern = 0;
+        while (pattern < NumPatterns && name != PATTERN_NAMES[pattern]) {
+            pattern++;
+        }
+        if (pattern == NumPatterns) { return false; }
+        patterns |= 1 << pattern;
+    }
+    return true;
+}
+
+PeepholeOptimizer::PeepholeOptimizer(unsigned patterns)
+        : patterns(patterns) {}
+
+void PeepholeOptimizer::run(MachineFunction &mf,
+                            unsigned long counts[NumPatterns]) {
+    // Forwarding turns loads into moves, which may be self-moves, and
+    // leaves the remaining loads and stores adjacent for merging
+    for (MachineBasicBlock &block : mf.blocks) {
+        if (patterns & (1 << StoreToLoad)) {
+            counts[StoreToLoad] += forwardStores(block);
+        }
+        if (patterns & (1 << SelfMove)) {
+            counts[SelfMove] += removeSelfMoves(block);
+        }
+        if (patterns & (1 << PairMerge)) {
+            counts[PairMerge] += mergePairs(block);
+        }
+    }
+    if (patterns & (1 << BranchToNext)) {
+        counts[BranchToNext] += removeBranchesToNext(mf);
+    }
+}
+
+/* SECTION: Helpers */
+
+static bool isReg(const MOperand &op, Register reg) {
+    return op.kind == MOperand::Reg && op.reg == reg;
+}
+
+// [base] or [base, #imm], with the offset in offset
+static bool isSimpleMem(const MOperand &op, long &offset) {
+    if (op.kind != MOperand::Mem) { return false; }
+    switch (op.memMode) {
+        case MOperand::Base: offset = 0; return true;
+        case MOperand::Offset: offset = op.imm; return true;
+        default: return false;
+    }
+}
+
+// 64-bit ldr/str of a register to [base] or [base, #imm]
+static bool isSimpleAccess(const MachineInstr &instr, Opcode opcode,
+                           long &offset) {
+    return instr.opcode == opcode
+        && instr.operands[0].kind == MOperand::Reg
+        && instr.operands[0].width == RegWidth::X
+        && isSimpleMem(instr.operands[1], offset);
+}
+
+static bool writesReg(const MachineInstr &instr, Register reg) {
+    for (unsigned i = 0; i < instr.numOperands; i++) {
+        const MOperand &op = instr.operands[i];
+        if (op.kind == MOperand::Mem && op.reg == reg
+                && (op.memMode == MOperand::PreIndex
+                    || op.memMode == MOperand::PostIndex)) {
+            return true;
+        }
+    }
+    switch (instr.opcode) {
+        case Opcode::Cmp:
+        case Opcode::Str:
+        case Opcode::Strb:
+        case Opcode::Stp:
+        case Opcode::B:
+        case Opcode::BCond:
+        case Opcode::Cbz:
+        case Opcode::Cbnz:
+        case Opcode::Tbnz:
+        case Opcode::Ret:
+            return false;
+        case Opcode::Ldp:
+            return isReg(instr.operands[0], reg)
+                || isReg(instr.operands[1], reg);
+        case Opcode::Bl:
+        case Opcode::Svc:
+            return true;
+        default:
+            return isReg(instr.operands[0], reg);
+    }
+}
+
+/* SECTION: Patterns */
+
+// Control falls through empty blocks, so a branch is redundant if it targets
+// the next non-empty block or any empty block before it
+unsigned long PeepholeOptimizer::removeBranchesToNext(MachineFunction &mf) {
+    unsigned long count = 0;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (std::size_t i = 0; i < mf.blocks.size(); i++) {
+            std::vector<MachineInstr> &instrs = mf.blocks[i].instrs;
+            // Tail calls branch to a symbol
+            if (instrs.empty() || instrs.back().opcode != Opcode::B
+                    || instrs.back().operands[0].kind != MOperand::Label) {
+                continue;
+            }
+            const long target = instrs.back().operands[0].imm;
+            for (std::size_t j = i + 1; j < mf.blocks.size(); j++) {
+                if (mf.blocks[j].label == target) {
+                    instrs.pop_back();
+                    count++;
+                    changed = true;
+                    break;
+                }
+                if (!mf.blocks[j].instrs.empty()) { break; }
+            }
+        }
+    }
+    return count;
+}
+
+// str xA, [b, #o] ... ldr xB, [b, #o] becomes mov xB, xA (or nothing if
+// B is A), as long as nothing in between may write the memory, xA or b
+unsigned long PeepholeOptimizer::forwardStores(MachineBasicBlock &block) {
+    unsigned long count = 0;
+    std::vector<MachineInstr> &instrs = block.instrs;
+    for (std::size_t i = 0; i < instrs.size(); i++) {
+        long storeOffset;
+        if (!isSimpleAccess(instrs[i], Opcode::Str, storeOffset)) { continue; }
+        const Register value = instrs[i].operands[0].reg;
+        const Register base = instrs[i].operands[1].reg;
+
+        for (std::size_t j = i + 1; j < instrs.size(); j++) {
+            MachineInstr &instr = instrs[j];
+            long loadOffset;
+            if (isSimpleAccess(instr, Opcode::Ldr, loadOffset)
+                    && instr.operands[1].reg == base
+                    && loadOffset == storeOffset) {
+                const Register dst = instr.operands[0].reg;
+                count++;
+                if (dst == value) {
+                    instrs.erase(instrs.begin() + j);
+                    j--;
+                    continue;
+                }
+                instr = MachineInstr(Opcode::Mov, mReg(dst), mReg(value));
+                if (dst == base) { break; }
+                continue;
+            }
+
+            bool mayStore = instr.opcode == Opcode::Str
+                         || instr.opcode == Opcode::Strb
+                         || instr.opcode == Opcode::Stp
+                         || instr.opcode == Opcode::Bl
+                         || instr.opcode == Opcode::Svc;
+            bool isBranch = instr.opcode == Opcode::B
+                         || instr.opcode == Opcode::BCond
+                         || instr.opcode == Opcode::Cbz
+                         || instr.opcode == Opcode::Cbnz
+                         || instr.opcode == Opcode::Tbnz;
+            if (mayStore || isBranch
+                    || writesReg(instr, value) || writesReg(instr, base)) {
+                break;
+            }
+        }
+    }
+    return count;
+}
+
+unsigned long PeepholeOptimizer::removeSelfMoves(MachineBasicBlock &block) {
+    unsigned long count = 0;
+    std::vector<MachineInstr> &instrs = block.instrs;
+    for (std::size_t i = 0; i < instrs.size(); i++) {
+        // mov wN, wN clears the upper half, so only 64-bit moves are no-ops
+        const MachineInstr &instr = instrs[i];
+        if (instr.opcode == Opcode::Mov
+                && instr.operands[0].kind == MOperand::Reg
+                && instr.operands[1].kind == MOperand::Reg
+                && instr.operands[0].reg == instr.operands[1].reg
+                && instr.operands[0].width == RegWidth::X
+                && instr.operands[1].width == RegWidth::X) {
+            instrs.erase(instrs.begin() + i);
+            i--;
+            count++;
+        }
+    }
+    return count;
+}
+
+// ldr/str of [b, #o] and [b, #o+8], in either order, become one ldp/stp
+unsigned long PeepholeOptimizer::mergePairs(MachineBasicBlock &block) {
+    unsigned long count = 0;
+    std::vector<MachineInstr> &instrs = block.instrs;
+    for (std::size_t i = 0; i + 1 < instrs.size(); i++) {
+        MachineInstr &first = instrs[i];
+        MachineInstr &second = instrs[i + 1];
+        const Opcode opcode = first.opcode;
+        long firstOffset, secondOffset;
+        if ((opcode != Opcode::Ldr && opcode != Opcode::Str)
+                || !isSimpleAccess(first, opcode, firstOffset)
+                || !isSimpleAccess(second, opcode, secondOffset)
+                || first.operands[1].reg != second.operands[1].reg) {
+            continue;
+        }
+        const Register base = first.operands[1].reg;
+        const Register firstReg = first.operands[0].reg;
+        const Register secondReg = second.operands[0].reg;
+
+        if (opcode == Opcode::Ldr) {
+            // The first load mustn't change the second's address, and ldp
+            // can't load both halves into one register
+            if (firstReg == base || firstReg == secondReg) { continue; }
+        }
+
+        long offset;
+        MOperand low, high;
+        if (secondOffset == firstOffset + 8) {
+            offset = firstOffset;
+            low = first.operands[0];
+            high = second.operands[0];
+        } else if (secondOffset == firstOffset - 8) {
+            offset = secondOffset;
+            low = second.operands[0];
+            high = first.operands[0];
+        } else {
+            continue;
+        }
+        // ldp/stp take a signed 7-bit offset, scaled by 8
+        if (offset % 8 != 0 || offset < -512 || offset > 504) { continue; }
+
+        first = MachineInstr(opcode == Opcode::Ldr ? Opcode::Ldp : Opcode::Stp,
+                             low, high, mMem(base, offset));
+        instrs.erase(instrs.begin() + i + 1);
+        count++;
+    }
+    return count;
+}
@@ -0,0 +1,206 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+class AsmWriter;
+
+/*
+  Register Conventions:
+    x0-x7    procedure arguments
+    x8       indirect return value address
+    x9-x15   caller-saved (local variables)
+    x16-x17  intra-procedure-call scratch register
+    x18      platform register (don't use)
+    x19-x28  callee-saved
+    x29      fp
+    x30      lr
+    x31      sp
+*/
+enum class Register {
+    x0 = 0, x1, x2, x3, x4, x5, x6, x7,
+    x8,
+    x9, x10, x11, x12, x13, x14, x15,
+    x16, ip0 = x16, x17, ip1 = x17,
+    x18, pr = x18,
+    x19, x20, x21, x22, x23, x24, x25, x26, x27, x28,
+    x29, fp = x29,
+    x30, lr = x30,
+    x31, sp = x31,
+};
+std::string toStr(Register res, std::string regPrefix = "x");
+std::ostream &operator<<(std::ostream &os, Register &reg);
+
+enum class Opcode {
+    Mov, Movk,
+    Add, Sub, Mul, Sdiv, Msub, Smulh, Neg, Mvn, And, Orr, Eor,
+    Lsl, Lsr, Asr,
+    Cmp, Cset,
+    Ldr, Ldrb, Str, Strb, Ldp, Stp,
+    Adrp,
+    B, BCond, Cbz, Cbnz, Tbnz, Bl, Ret, Svc,
+};
+
+enum class Condition {
+    Eq, Ne, Lt, Gt, Le, Ge,
+};
+Condition inverse(Condition cond);
+
+enum class RegWidth {
+    X, W,
+};
+
+struct MOperand {
+    enum Kind : unsigned char {
+        None, Reg, Imm, Mem, Label, Symbol, Cond, Shift,
+    } kind = None;
+
+    // Mem: [base], [base, #imm], [base, #imm]!, [base], #imm or
+    // [base, index, LSL #imm]
+    enum MemMode : unsigned char {
+        Base, Offset, PreIndex, PostIndex, RegOffset,
+    };
+    // Symbol: _name, name@PAGE or name@PAGEOFF
+    enum SymbolMod : unsigned char {
+        Function, Page, PageOff,
+    };
+    // Shift: LSL #imm or LSR #imm
+    enum ShiftOp : unsigned char {
+        Lsl, Lsr,
+    };
+
+    Register reg = Register::x0;     // Reg/Mem
+    Register index = Register::x0;   // Mem (RegOffset)
+    RegWidth width = RegWidth::X;    // Reg
+    MemMode memMode = Base;          // Mem
+    SymbolMod symbolMod = Function;  // Symbol
+    ShiftOp shiftOp = Lsl;           // Shift
+    Condition cond = Condition::Eq;  // Cond
+    long imm = 0;                    // Imm/Mem/Label/Shift
+    const std::string *symbol = nullptr;  // Symbol
+};
+
+MOperand mReg(Register reg, RegWidth width = RegWidth::X);
+MOperand mImm(long imm);
+MOperand mMem(Register base);
+MOperand mMem(Register base, long offset,
+              MOperand::MemMode mode = MOperand::Offset);
+MOperand mMem(Register base, Register index, unsigned shift);
+MOperand mLabel(unsigned label);
+MOperand mSymbol(const std::string *symbol,
+                 MOperand::SymbolMod mod = MOperand::Function);
+MOperand mCond(Condition cond);
+MOperand mLsl(unsigned amount);
+MOperand mLsr(unsigned amount);
+
+class MachineInstr {
+public:
+    Opcode opcode;
+    unsigned char numOperands;
+    MOperand operands[4];
+
+    MachineInstr(Opcode opcode,
+                 MOperand op0 = MOperand(), MOperand op1 = MOperand(),
+                 MOperand op2 = MOperand(), MOperand op3 = MOperand());
+};
+
+class MachineBasicBlock {
+public:
+    static const int NoLabel = -1;
+    int label;
+    std::vector<MachineInstr> instrs;
+
+    MachineBasicBlock(int label);
+};
+
+class MachineFunction {
+public:
+    const std::string *name;
+    std::vector<MachineBasicBlock> blocks;
+    std::vector<std::string> labelNames;
+
+    MachineFunction(const std::string *name);
+    unsigned newLabel(std::string labelName);
+    MachineBasicBlock &startBlock(int label = MachineBasicBlock::NoLabel);
+    void emit(Opcode opcode,
+              MOperand op0 = MOperand(), MOperand op1 = MOperand(),
+              MOperand op2 = MOperand(), MOperand op3 = MOperand());
+
+    void print(AsmWriter &out, unsigned indent);
+
+private:
+    void printOperand(AsmWriter &out, MOperand &op);
+};
+
+/*
+  The frame of a function, laid out once its body is complete:
+
+    sp + 0    fp and lr, if the function makes calls or moves sp
+              callee-saved registers, padded to 16 bytes
+              locals, up to the top of the frame
+
+  The body addresses its locals down from the top of the frame, as
+  [fp, #-offset] and sub xN, fp, #offset whatever their size. They are
+  rebased to unsigned offsets from sp, or from fp, set to sp after the
+  prologue, if the body pushes onto the stack, so that leaf functions need
+  neither fp nor a frame record.
+*/
+class FrameLayout {
+public:
+    FrameLayout(std::vector<Register> savedRegs, long localsSize,
+                bool hasCalls);
+    // Rebases the body and fills in the prologue, in the entry block, and
+    // the epilogue at returnLabel and before each tail call (a b to a
+    // function)
+    void emit(MachineFunction &mf, unsigned returnLabel);
+    // How far the top of the frame is above sp after the prologue
+    static long size(std::size_t numSavedRegs, long localsSize,
+                     bool saveFp);
+
+private:
+    std::vector<Register> savedRegs;
+    long localsSize;
+    bool hasCalls;
+    bool saveFp = false;            // Whether there is a frame record
+    Register base = Register::sp;   // Of the locals after the prologue
+    long frameSize = 0;
+
+    static bool movesSp(MachineFunction &mf);
+    void rebase(MachineFunction &mf);
+    void emitPrologue(std::vector<MachineInstr> &prologue);
+    std::vector<MachineInstr> epilogue();
+};
+
+// Local rewrites of redundant instruction sequences. Runs on each function
+// once it is complete, before it is printed.
+class PeepholeOptimizer {
+public:
+    enum Pattern {
+        BranchToNext,  // b to the block that follows anyway
+        StoreToLoad,   // ldr from where a register was just stored: mov
+        SelfMove,      // mov xN, xN
+        PairMerge,     // ldr/str of adjacent slots: ldp/stp
+        NumPatterns,
+    };
+    static const unsigned AllPatterns = (1 << NumPatterns) - 1;
+
+    static const char *patternName(Pattern pattern);
+    // Parses a comma-separated list of pattern names into a pattern mask
+    static bool parsePatterns(const std::string &list, unsigned &patterns);
+
+    explicit PeepholeOptimizer(unsigned patterns = AllPatterns);
+    // Adds the number of rewrites of each pattern to counts
+    void run(MachineFunction &mf, unsigned long counts[NumPatterns]);
+
+private:
+    unsigned patterns;
+
+    unsigned long removeBranchesToNext(MachineFunction &mf);
+    unsigned long forwardStores(MachineBasicBlock &block);
+    unsigned long removeSelfMoves(MachineBasicBlock &block);
+    unsigned long mergePairs(MachineBasicBlock &block);
+};
+
+const char *toStr(Opcode opcode);
+const char *toStr(Condition cond);
@@ -4,16 +4,17 @@
 
 Driver::Driver(std::string execName, CompileState *cs)
         : execName(execName),
-          cs(cs),
           traceParsing(false),
-          traceScanning(false) {}
+          traceScanning(false),
+          cs(cs) {}
 
 int Driver::parse(const std::string &f) {
+    TimeScope timeScope(cs->trace, "Parse", f);
     file = f;
     location.initialize(&file);
 
     scan_begin();
-    yy::parser parse(*this);
+    yy::parser parse(*this, scanner);
     parse.set_debug_level(traceParsing);
     int res = parse();
     scan_end();
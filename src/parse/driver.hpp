@@ -5,8 +5,9 @@
 #include "qcc.y.hpp"
 #include "ast/ast.hpp"
 #include "CompileState.hpp"
+#include "util.hpp"
 
-#define YY_DECL yy::parser::symbol_type yylex(Driver &drv)
+#define YY_DECL yy::parser::symbol_type yylex(Driver &drv, yyscan_t yyscanner)
 YY_DECL;
 
 class Driver {
@@ -16,6 +17,8 @@ public:
     bool traceScanning;
     yy::location location;
     std::string file;
+    SourceBuffer source;
+    yyscan_t scanner = nullptr;
     CompileState *cs;
 
     std::vector<FnDefNode *> fnDefNodes;
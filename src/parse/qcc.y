@@ -18,15 +18,18 @@
     #include <vector>
     #include "ast/ast.hpp"
     class Driver;
+    typedef void *yyscan_t;
 }
 
 %param {Driver &drv}
+%param {yyscan_t scanner}
 %code {
     #include "parse/driver.hpp"
     typedef std::vector<StatementNode *> Block;
 }
 
 %token ASSIGN COMMA LBRACE RBRACE SEMICOLON RETURN IF WHILE BREAK CONTINUE
+%token INLINE
 %precedence PREC_THEN
 %precedence ELSE
 %left <BuiltinOperator> OP_BIT_OR
@@ -41,10 +44,10 @@
 %precedence LPAREN RPAREN
 
 %token <BuiltinType> BUILTIN_TYPE
-%token <std::string> IDENTIFIER
+%token <Symbol *> IDENTIFIER
 %token <long> INT_LITERAL
 %token <char> CHAR_LITERAL
-%token <std::string> STRING_LITERAL
+%token <StringView> STRING_LITERAL
 
 %type <FnDeclNode *> fnDecl fnSignature
 %type <FnDefNode *> fnDef
@@ -69,14 +72,11 @@
 %start file;
 file
     :
-    | file fnDecl {
-        delete drv.cs->varTypes;
-        drv.cs->varTypes = new std::unordered_map<std::string, TypeNode *>();
-    }
+    | file fnDecl { drv.cs->clearVars(); }
     | file fnDef {
         drv.fnDefNodes.push_back($2);
-        delete drv.cs->varTypes;
-        drv.cs->varTypes = new std::unordered_map<std::string, TypeNode *>();
+        drv.cs->clearVars();
+        drv.cs->staticData.clear();
       }
     ;
 
@@ -86,37 +86,47 @@ fnDecl
 
 fnSignature
     : type IDENTIFIER LPAREN RPAREN {
-        $$ = new FnDeclNode($1, $2);
+        $$ = drv.cs->arena.create<FnDeclNode>($1, $2->name);
         drv.cs->addFnDecl($$);
       }
     | type IDENTIFIER LPAREN paramList RPAREN {
-        $$ = new FnDeclNode($1, $2, *$4);
+        $$ = drv.cs->arena.create<FnDeclNode>($1, $2->name, *$4);
         drv.cs->addFnDecl($$);
-        delete $4;
       }
     ;
 
 fnDef
     : fnSignature blockWithBraces {
-        $$ = new FnDefNode(*$1, *$2);
+        if (drv.cs->optLevel >= 1) {
+            ConstantFolder(drv.cs).foldBlock(*$2);
+        }
+        $$ = drv.cs->arena.create<FnDefNode>(*$1, *$2,
+                                             drv.cs->varTypes.size(),
+                                             drv.cs->staticData);
         drv.cs->addFnDef($$);
-        delete $2;
       }
+    | INLINE fnDef { $$ = $2; $$->isInline = true; }
     ;
 
 type
-    : BUILTIN_TYPE { $$ = new TypeNode($1); }
+    : BUILTIN_TYPE { $$ = drv.cs->types.get($1); }
     /* | IDENTIFIER { $$ = new TypeNode($1); } */
-    | type OP_STAR { $$ = new TypeNode($1); }
+    | type OP_STAR { $$ = drv.cs->types.pointerTo($1); }
     ;
 
 paramList
-    : param { $$ = new std::vector<ParamNode *>(); $$->push_back($1); }
+    : param {
+        $$ = drv.cs->arena.create<std::vector<ParamNode *>>();
+        $$->push_back($1);
+      }
     | paramList COMMA param { $1->push_back($3); $$ = $1; }
     ;
 
 param
-    : type IDENTIFIER { $$ = new ParamNode($1, $2); drv.cs->setVarType($2, $1); }
+    : type IDENTIFIER {
+        unsigned slot = drv.cs->declareVar($2, $1);
+        $$ = drv.cs->arena.create<ParamNode>($1, $2, slot);
+      }
     ;
 
 blockWithBraces
@@ -124,7 +134,7 @@ blockWithBraces
     ;
 
 block
-    : { $$ = new std::vector<StatementNode *>(); }
+    : { $$ = drv.cs->arena.create<Block>(); }
     | block statement { $1->push_back($2); $$ = $1; }
     ;
 
@@ -133,67 +143,89 @@ statement
     | initialization SEMICOLON { $$ = $1; }
     | assignment SEMICOLON { $$ = $1; }
     | return SEMICOLON { $$ = $1; }
-    | fnCall SEMICOLON { $$ = new StatementNode($1); }
+    | fnCall SEMICOLON { $$ = drv.cs->arena.create<StatementNode>($1); }
     | if { $$ = $1; }
     | while { $$ = $1; }
-    | BREAK SEMICOLON { $$ = new BreakNode(); }
-    | CONTINUE SEMICOLON { $$ = new ContinueNode(); }
+    | BREAK SEMICOLON { $$ = drv.cs->arena.create<BreakNode>(); }
+    | CONTINUE SEMICOLON { $$ = drv.cs->arena.create<ContinueNode>(); }
     ;
 
 declaration
-    : type IDENTIFIER { $$ = new StatementNode($1, $2); drv.cs->setVarType($2, $1); }
+    : type IDENTIFIER {
+        unsigned slot = drv.cs->declareVar($2, $1);
+        $$ = drv.cs->arena.create<StatementNode>($1, $2, slot);
+      }
     ;
 
 initialization
-    : type IDENTIFIER ASSIGN expr { $$ = new StatementNode($1, $2, $4); drv.cs->setVarType($2, $1); }
-    | type IDENTIFIER ASSIGN array { $$ = new StatementNode($1, $2, $4); drv.cs->setVarType($2, $1); }
+    : type IDENTIFIER ASSIGN expr {
+        unsigned slot = drv.cs->declareVar($2, $1);
+        $$ = drv.cs->arena.create<StatementNode>($1, $2, slot, $4);
+      }
+    | type IDENTIFIER ASSIGN array {
+        unsigned slot = drv.cs->declareVar($2, $1);
+        $$ = drv.cs->arena.create<StatementNode>($1, $2, slot, $4);
+      }
     ;
 
 assignment
-    : accessor ASSIGN expr { $$ = new StatementNode($1, $3); }
+    : accessor ASSIGN expr { $$ = drv.cs->arena.create<StatementNode>($1, $3); }
     ;
 
 return
-    : RETURN expr { $$ = new StatementNode($2); }
-    | RETURN      { $$ = new StatementNode(new ExprNode()); }
+    : RETURN expr { $$ = drv.cs->arena.create<StatementNode>($2); }
+    | RETURN {
+        $$ = drv.cs->arena.create<StatementNode>(
+            drv.cs->arena.create<ExprNode>(drv.cs));
+      }
     ;
 
 fnCall
-    : IDENTIFIER LPAREN argList RPAREN { $$ = new FnCallNode($1, drv.cs->getFnDecl($1), *$3); delete $3; }
-    | IDENTIFIER LPAREN RPAREN { $$ = new FnCallNode($1, drv.cs->getFnDecl($1)); }
+    : IDENTIFIER LPAREN argList RPAREN {
+        $$ = drv.cs->arena.create<FnCallNode>(
+            $1->name, drv.cs->getFnDecl($1->name), *$3);
+        drv.cs->numCalls[$1->name]++;
+      }
+    | IDENTIFIER LPAREN RPAREN {
+        $$ = drv.cs->arena.create<FnCallNode>(
+            $1->name, drv.cs->getFnDecl($1->name));
+        drv.cs->numCalls[$1->name]++;
+      }
     ;
 
 if
     : IF LPAREN expr RPAREN statementBlock {
-        $$ = new IfNode($3, *$5);
-        delete $5;
+        $$ = drv.cs->arena.create<IfNode>($3, *$5);
       } %prec PREC_THEN
     | IF LPAREN expr RPAREN statementBlock ELSE statementBlock {
-        $$ = new IfNode($3, *$5, *$7);
-        delete $5;
-        delete $7;
+        $$ = drv.cs->arena.create<IfNode>($3, *$5, *$7);
       }
     ;
 
 while
     : WHILE LPAREN expr RPAREN statementBlock {
-        $$ = new WhileNode($3, *$5);
-        delete $5;
+        $$ = drv.cs->arena.create<WhileNode>($3, *$5);
       }
 
 statementBlock
-    : statement { $$ = new std::vector<StatementNode *>{$1}; }
+    : statement { $$ = drv.cs->arena.create<Block>(1, $1); }
     | blockWithBraces { $$ = $1; }
     ;
 
 argList
-    : expr { $$ = new std::vector<ExprNode *>(); $$->push_back($1); }
+    : expr {
+        $$ = drv.cs->arena.create<std::vector<ExprNode *>>();
+        $$->push_back($1);
+      }
     | argList COMMA expr { $1->push_back($3); $$ = $1; }
     ;
 
 array
-    : LBRACE RBRACE { $$ = new ExprNode(new std::vector<ExprNode *>()); }
-    | LBRACE argList RBRACE { $$ = new ExprNode($2); }
+    : LBRACE RBRACE {
+        $$ = drv.cs->arena.create<ExprNode>(
+            drv.cs, drv.cs->arena.create<std::vector<ExprNode *>>());
+      }
+    | LBRACE argList RBRACE { $$ = drv.cs->arena.create<ExprNode>(drv.cs, $2); }
     /* | STRING_LITERAL {
         auto *arr = new std::vector<ExprNode *>();
         for (char c : $1) {
@@ -206,55 +238,67 @@ array
     ;
 
 stringLiteral
-    : STRING_LITERAL { $$ = $1; }
-    | stringLiteral STRING_LITERAL { $$ = $1.substr(0, $1.size() - 1) + $2.substr(1); }
+    : STRING_LITERAL { $$ = $1.str(); }
+    | stringLiteral STRING_LITERAL {
+        $$ = $1;
+        $$.pop_back();
+        $$.append($2.data + 1, $2.size - 1);
+      }
     ;
 
 expr
-    : literal { $$ = new ExprNode($1); }
-    | accessor { $$ = new ExprNode($1); }
-    | fnCall { $$ = new ExprNode($1); }
+    : literal { $$ = drv.cs->arena.create<ExprNode>(drv.cs, $1); }
+    | accessor { $$ = drv.cs->arena.create<ExprNode>($1); }
+    | fnCall { $$ = drv.cs->arena.create<ExprNode>($1); }
     | stringLiteral {
         StaticData *data = drv.cs->addStaticData($1);
-        $$ = new ExprNode(data);
+        $$ = drv.cs->arena.create<ExprNode>(data);
     }
-    | expr OP_PLUS    expr { $$ = new ExprNode($2, $1, $3); }
-    | expr OP_MINUS   expr { $$ = new ExprNode($2, $1, $3); }
-    | expr OP_STAR    expr { $$ = new ExprNode($2, $1, $3); }
-    | expr OP_FSLASH  expr { $$ = new ExprNode($2, $1, $3); }
-    | expr OP_PERCENT expr { $$ = new ExprNode($2, $1, $3); }
-    | expr OP_EQ      expr { $$ = new ExprNode($2, $1, $3); }
-    | expr OP_NE      expr { $$ = new ExprNode($2, $1, $3); }
-    | expr OP_LT      expr { $$ = new ExprNode($2, $1, $3); }
-    | expr OP_GT      expr { $$ = new ExprNode($2, $1, $3); }
-    | expr OP_LE      expr { $$ = new ExprNode($2, $1, $3); }
-    | expr OP_GE      expr { $$ = new ExprNode($2, $1, $3); }
-    | OP_MINUS        expr { $$ = new ExprNode($1, $2); }
-    | OP_NOT          expr { $$ = new ExprNode($1, $2); }
-    | OP_BIT_NOT      expr { $$ = new ExprNode($1, $2); }
-    | expr OP_BIT_AND expr { $$ = new ExprNode($2, $1, $3); }
-    | expr OP_BIT_OR  expr { $$ = new ExprNode($2, $1, $3); }
-    | expr OP_BIT_XOR expr { $$ = new ExprNode($2, $1, $3); }
+    | expr OP_PLUS    expr { $$ = drv.cs->arena.create<ExprNode>(drv.cs, $2, $1, $3); }
+    | expr OP_MINUS   expr { $$ = drv.cs->arena.create<ExprNode>(drv.cs, $2, $1, $3); }
+    | expr OP_STAR    expr { $$ = drv.cs->arena.create<ExprNode>(drv.cs, $2, $1, $3); }
+    | expr OP_FSLASH  expr { $$ = drv.cs->arena.create<ExprNode>(drv.cs, $2, $1, $3); }
+    | expr OP_PERCENT expr { $$ = drv.cs->arena.create<ExprNode>(drv.cs, $2, $1, $3); }
+    | expr OP_EQ      expr { $$ = drv.cs->arena.create<ExprNode>(drv.cs, $2, $1, $3); }
+    | expr OP_NE      expr { $$ = drv.cs->arena.create<ExprNode>(drv.cs, $2, $1, $3); }
+    | expr OP_LT      expr { $$ = drv.cs->arena.create<ExprNode>(drv.cs, $2, $1, $3); }
+    | expr OP_GT      expr { $$ = drv.cs->arena.create<ExprNode>(drv.cs, $2, $1, $3); }
+    | expr OP_LE      expr { $$ = drv.cs->arena.create<ExprNode>(drv.cs, $2, $1, $3); }
+    | expr OP_GE      expr { $$ = drv.cs->arena.create<ExprNode>(drv.cs, $2, $1, $3); }
+    | OP_MINUS        expr { $$ = drv.cs->arena.create<ExprNode>(drv.cs, $1, $2); }
+    | OP_NOT          expr { $$ = drv.cs->arena.create<ExprNode>(drv.cs, $1, $2); }
+    | OP_BIT_NOT      expr { $$ = drv.cs->arena.create<ExprNode>(drv.cs, $1, $2); }
+    | expr OP_BIT_AND expr { $$ = drv.cs->arena.create<ExprNode>(drv.cs, $2, $1, $3); }
+    | expr OP_BIT_OR  expr { $$ = drv.cs->arena.create<ExprNode>(drv.cs, $2, $1, $3); }
+    | expr OP_BIT_XOR expr { $$ = drv.cs->arena.create<ExprNode>(drv.cs, $2, $1, $3); }
     | OP_BIT_AND IDENTIFIER {
-        $$ = new ExprNode($1,
-                new ExprNode(new AccessorNode($2, drv.cs->getVarType($2))));
+        unsigned slot = drv.cs->getVarSlot($2);
+        $$ = drv.cs->arena.create<ExprNode>(drv.cs, $1,
+                drv.cs->arena.create<ExprNode>(
+                    drv.cs->arena.create<AccessorNode>(
+                        $2, slot, drv.cs->getVarType(slot))));
     }
     | LPAREN expr RPAREN { $$ = $2; }
     ;
 
 literal
-    : INT_LITERAL { $$ = new LiteralNode($1); }
-    | CHAR_LITERAL { $$ = new LiteralNode($1); }
+    : INT_LITERAL { $$ = drv.cs->arena.create<LiteralNode>($1); }
+    | CHAR_LITERAL { $$ = drv.cs->arena.create<LiteralNode>($1); }
     ;
 
 accessor
-    : IDENTIFIER { $$ = new AccessorNode($1, drv.cs->getVarType($1)); }
+    : IDENTIFIER {
+        unsigned slot = drv.cs->getVarSlot($1);
+        $$ = drv.cs->arena.create<AccessorNode>(
+            $1, slot, drv.cs->getVarType(slot));
+      }
     | accessor LBRACKET expr RBRACKET {
-        $$ = new AccessorNode(
-            new ExprNode(BuiltinOperator::Plus, new ExprNode($1), $3)
+        $$ = drv.cs->arena.create<AccessorNode>(
+            drv.cs->arena.create<ExprNode>(drv.cs, BuiltinOperator::Plus,
+                drv.cs->arena.create<ExprNode>($1), $3)
         );
     }
-    | OP_STAR expr { $$ = new AccessorNode($2); } // TODO: fix shift-reduce conflict
+    | OP_STAR expr { $$ = drv.cs->arena.create<AccessorNode>($2); } // TODO: fix shift-reduce conflict
     ;
 
 %%
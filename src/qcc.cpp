@@ -1,34 +1,153 @@
+#include <cstdlib>
 #include <iostream>
+#include <memory>
+#include <set>
 #include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
 #include "parse/driver.hpp"
 #include "util.hpp"
 #include "ast/ast.hpp"
 #include "CompileState.hpp"
+#include "FnCache.hpp"
+#include "TimeTrace.hpp"
 
-int main(int argc, char *argv[]) {
-    /* SECTION: Parsing */
+// Generates every function of one file, replaying unchanged ones from the
+// cache if there is one. The cache doesn't keep IR, so -print-ir bypasses it.
+static void emitFunctions(CompileState &cs, Driver &drv,
+                          std::vector<FnOutput> &fnOutputs,
+                          unsigned numThreads, FnCache *cache) {
+    util::parallelFor(fnOutputs.size(), numThreads, [&](std::size_t i) {
+        FnDefNode *fnDef = drv.fnDefNodes[i];
+        if (!cache || cs.printIR) {
+            fnDef->emit(cs, fnOutputs[i]);
+            return;
+        }
+        std::string key = FnCache::key(fnDef, cs);
+        fnOutputs[i].stats.name = fnDef->identifier;
+        bool hit;
+        {
+            TimeScope timeScope(cs.trace, "CacheLookup", fnDef->identifier);
+            hit = cache->lookup(key, fnOutputs[i]);
+        }
+        if (!hit) {
+            fnDef->emit(cs, fnOutputs[i]);
+            cache->store(key, fnOutputs[i]);
+        }
+    });
+}
 
-    CompileState cs(std::cout);
-    Driver drv(argv[0], &cs);
-    int res = 0;
-    bool parsedSomeFiles = false;
+int main(int argc, char *argv[]) {
+    bool traceParsing = false;
+    bool traceScanning = false;
     bool debug = false;
+    bool memReport = false;
+    const char *outputPath = nullptr;
+    unsigned numThreads = 1;
+    const char *cacheDir = nullptr;
+    unsigned long cacheSizeMB = 512;
+    bool cacheStats = false;
+    const char *timeTracePath = nullptr;
+    bool timeReport = false;
+    bool stats = false;
+    unsigned peepholes = PeepholeOptimizer::AllPatterns;
+    unsigned optLevel = 1;
+    bool verifyIR = false;
+    bool printIR = false;
+    bool peepholeStats = false;
+    const char *statsJsonPath = nullptr;
+    std::vector<std::string> files;
     for (int i = 1; i < argc; i++) {
-        if (argv[i] == std::string("-p")) { drv.traceParsing = true; }
-        else if (argv[i] == std::string("-s")) { drv.traceScanning = true; }
+        if (argv[i] == std::string("-p")) { traceParsing = true; }
+        else if (argv[i] == std::string("-s")) { traceScanning = true; }
         else if (argv[i] == std::string("-d")) { debug = true; }
-        else {
-            int res = drv.parse(argv[i]);
-            parsedSomeFiles = true;
+        else if (argv[i] == std::string("-m")) { memReport = true; }
+        else if (argv[i] == std::string("-o") && i + 1 < argc) {
+            outputPath = argv[++i];
+        }
+        else if (argv[i] == std::string("-j") && i + 1 < argc) {
+            // -j 0 uses every core
+            numThreads = std::strtoul(argv[++i], nullptr, 10);
+            if (numThreads == 0) {
+                numThreads = std::thread::hardware_concurrency();
+            }
+        }
+        else if (argv[i] == std::string("-cache") && i + 1 < argc) {
+            cacheDir = argv[++i];
+        }
+        else if (argv[i] == std::string("-cache-size") && i + 1 < argc) {
+            cacheSizeMB = std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if (argv[i] == std::string("-cache-stats")) { cacheStats = true; }
+        else if (std::string(argv[i]).compare(0, 13, "-ftime-trace=") == 0) {
+            timeTracePath = argv[i] + 13;
+        }
+        else if (argv[i] == std::string("-ftime-report")) { timeReport = true; }
+        else if (argv[i] == std::string("-stats")) { stats = true; }
+        else if (std::string(argv[i]).compare(0, 2, "-O") == 0
+                 && argv[i][2] >= '0' && argv[i][2] <= '9'
+                 && argv[i][3] == '\0') {
+            optLevel = argv[i][2] - '0';
         }
+        else if (argv[i] == std::string("-verify-ir")) { verifyIR = true; }
+        else if (argv[i] == std::string("-print-ir")) { printIR = true; }
+        else if (argv[i] == std::string("-fno-peephole")) { peepholes = 0; }
+        else if (std::string(argv[i]).compare(0, 11, "-fpeephole=") == 0) {
+            if (!PeepholeOptimizer::parsePatterns(argv[i] + 11, peepholes)) {
+                std::cerr << "ERROR: Unknown peephole pattern in " << argv[i]
+                          << '\n';
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (argv[i] == std::string("-peephole-stats")) {
+            peepholeStats = true;
+        }
+        else if (std::string(argv[i]).compare(0, 12, "-stats-json=") == 0) {
+            statsJsonPath = argv[i] + 12;
+        }
+        else { files.push_back(argv[i]); }
+    }
+    if (files.empty()) { files.push_back("-"); }
+
+    std::unique_ptr<TimeTrace> trace;
+    if (timeTracePath || timeReport) { trace.reset(new TimeTrace()); }
+
+    /* SECTION: Parsing */
+
+    // Files are independent: each gets its own CompileState and Driver, and
+    // is parsed and compiled on whichever thread picks it up
+    std::vector<std::unique_ptr<CompileState>> states;
+    std::vector<std::unique_ptr<Driver>> drivers;
+    for (std::size_t i = 0; i < files.size(); i++) {
+        states.emplace_back(new CompileState());
+        drivers.emplace_back(new Driver(argv[0], states[i].get()));
+        drivers[i]->traceParsing = traceParsing;
+        drivers[i]->traceScanning = traceScanning;
+        states[i]->trace = trace.get();
+        states[i]->peepholes = peepholes;
+        states[i]->optLevel = optLevel;
+        states[i]->verifyIR = verifyIR;
+        states[i]->printIR = printIR;
+    }
+
+    std::vector<int> results(files.size());
+    {
+        TimeScope timeScope(trace.get(), "Frontend");
+        util::parallelFor(files.size(), numThreads, [&](std::size_t i) {
+            results[i] = drivers[i]->parse(files[i]);
+        });
+    }
+    for (std::size_t i = 0; i < files.size(); i++) {
+        if (results[i] != 0) { return results[i]; }
+        if (drivers[i]->res != 0) { return drivers[i]->res; }
     }
-    if (!parsedSomeFiles) { int res = drv.parse("-"); }
-    if (res != 0 ) { return res; }
-    if (drv.res != 0 ) { return drv.res; }
 
     if (debug) {
-        for (auto *fnDefNode : drv.fnDefNodes) {
-            std::cerr << *fnDefNode << '\n';
+        for (auto &drv : drivers) {
+            for (auto *fnDefNode : drv->fnDefNodes) {
+                std::cerr << *fnDefNode << '\n';
+            }
         }
     }
 
@@ -37,20 +156,111 @@ int main(int argc, char *argv[]) {
         std::cerr << "\n=== OUTPUT ===\n";
     }
 
-    std::ostream &os = cs.os;
-    IndentedStream ios(os, cs.indent);
+    std::unique_ptr<FnCache> cache;
+    if (cacheDir) {
+        cache.reset(new FnCache(cacheDir, cacheSizeMB * 1024 * 1024));
+    }
+
+    // With a single file, the threads go to its functions instead
+    const unsigned fnThreads = files.size() == 1 ? numThreads : 1;
+    std::vector<std::vector<FnOutput>> fnOutputs(files.size());
+    {
+        TimeScope timeScope(trace.get(), "Backend");
+        util::parallelFor(files.size(), numThreads, [&](std::size_t i) {
+            fnOutputs[i] =
+                std::vector<FnOutput>(drivers[i]->fnDefNodes.size());
+            emitFunctions(*states[i], *drivers[i], fnOutputs[i], fnThreads,
+                          cache.get());
+        });
+    }
+
+    if (printIR) {
+        for (auto &fileOutputs : fnOutputs) {
+            for (FnOutput &fnOutput : fileOutputs) {
+                std::cerr << fnOutput.ir;
+            }
+        }
+    }
+
+    // Merge in source order, so the output doesn't depend on scheduling
+    AsmWriter out;
+    std::set<BuiltinFn> usedBuiltinFns;
+    out.indent(states[0]->indent) << ".text\n";
+    for (auto &fileOutputs : fnOutputs) {
+        for (FnOutput &fnOutput : fileOutputs) {
+            out.append(std::move(fnOutput.out));
+            usedBuiltinFns.insert(fnOutput.usedBuiltinFns.begin(),
+                                  fnOutput.usedBuiltinFns.end());
+        }
+    }
+
+    {
+        TimeScope timeScope(trace.get(), "Builtins");
+        for (auto &builtin : usedBuiltinFns) {
+            out << BUILTIN_FN_DEFS.at(builtin);
+        }
+    }
+
+    {
+        TimeScope timeScope(trace.get(), "StaticData");
+        for (auto &fileOutputs : fnOutputs) {
+            for (FnOutput &fnOutput : fileOutputs) {
+                out.append(std::move(fnOutput.data));
+            }
+        }
+    }
 
-    ios << ".text\n";
+    bool written;
+    {
+        TimeScope timeScope(trace.get(), "WriteOutput",
+                            outputPath ? outputPath : "stdout");
+        written = outputPath ? out.writeToFile(outputPath)
+                             : out.writeTo(STDOUT_FILENO);
+    }
+    if (!written) {
+        std::cerr << "ERROR: Couldn't write output to "
+                  << (outputPath ? outputPath : "stdout") << '\n';
+        exit(EXIT_FAILURE);
+    }
 
-    for (auto *fnDefNode : drv.fnDefNodes) {
-        fnDefNode->emit(cs);
+    if (cache) {
+        cache->evict();
+        if (cacheStats) { cache->printStats(std::cerr); }
     }
 
-    for (auto &builtin : cs.usedBuiltinFns) {
-        os << BUILTIN_FN_DEFS.at(builtin);
+    if (memReport) {
+        std::size_t allocated = 0, reserved = 0, blocks = 0;
+        for (auto &cs : states) {
+            allocated += cs->arena.bytesAllocated();
+            reserved += cs->arena.bytesReserved();
+            blocks += cs->arena.numBlocks();
+        }
+        std::cerr << "Arena: " << allocated
+                  << " bytes allocated, " << reserved
+                  << " bytes reserved in " << blocks
+                  << " blocks\n";
+    }
+
+    if (stats || statsJsonPath || peepholeStats) {
+        std::vector<const FnStats *> fnStats;
+        for (auto &fileOutputs : fnOutputs) {
+            for (FnOutput &fnOutput : fileOutputs) {
+                fnStats.push_back(&fnOutput.stats);
+            }
+        }
+        if (stats) { printStats(std::cerr, fnStats); }
+        if (peepholeStats) { printPeepholeStats(std::cerr, fnStats); }
+        if (statsJsonPath && !writeStatsJson(statsJsonPath, fnStats)) {
+            std::cerr << "ERROR: Couldn't write stats to "
+                      << statsJsonPath << '\n';
+            exit(EXIT_FAILURE);
+        }
     }
 
-    for (auto *staticData : cs.staticData) {
-        staticData->emit(cs);
+    if (timeReport) { trace->printReport(std::cerr); }
+    if (timeTracePath && !trace->writeChromeTrace(timeTracePath)) {
+        std::cerr << "ERROR: Couldn't write time trace to "
+                  << timeTracePath << '\n';
+        exit(EXIT_FAILURE);
     }
 }
@@ -1,43 +1,356 @@
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <streambuf>
 #include <sstream>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "util.hpp"
 
 IndentedStreamBuffer::IndentedStreamBuffer(
         std::streambuf* buf, int indentWidth
-    ) : buf(buf), indentWidth(indentWidth), shouldIndent(true) {}
+    ) : buf(buf), indentation(indentWidth, ' '), shouldIndent(true) {
+    setp(buffer, buffer + BUFFER_SIZE);
+}
 
-int IndentedStreamBuffer::overflow(int c) {
-    if (c == '\n') {
-        shouldIndent = true;
-    } else if (shouldIndent) {
-        for (int i = 0; i < indentWidth; ++i) {
-            if (buf->sputc(' ') == std::char_traits<char>::eof()) {
-                return std::char_traits<char>::eof();
-            }
+IndentedStreamBuffer::~IndentedStreamBuffer() {
+    sync();
+}
+
+bool IndentedStreamBuffer::flushBuffer() {
+    const char *begin = pbase();
+    const char *end = pptr();
+    while (begin != end) {
+        if (shouldIndent && *begin != '\n') {
+            std::streamsize len = indentation.size();
+            if (buf->sputn(indentation.data(), len) != len) { return false; }
+            shouldIndent = false;
         }
-        shouldIndent = false;
+
+        const char *newline = (const char *)std::memchr(begin, '\n', end - begin);
+        const char *lineEnd = newline ? newline + 1 : end;
+        if (buf->sputn(begin, lineEnd - begin) != lineEnd - begin) {
+            return false;
+        }
+        shouldIndent = newline != nullptr;
+        begin = lineEnd;
+    }
+    setp(buffer, buffer + BUFFER_SIZE);
+    return true;
+}
+
+int IndentedStreamBuffer::overflow(int c) {
+    if (!flushBuffer()) {
+        return std::char_traits<char>::eof();
+    }
+    if (c != std::char_traits<char>::eof()) {
+        *pptr() = c;
+        pbump(1);
     }
-    return buf->sputc(c);
+    return std::char_traits<char>::not_eof(c);
+}
+
+int IndentedStreamBuffer::sync() {
+    if (!flushBuffer()) { return -1; }
+    return buf->pubsync();
 }
 
 
+// Flushed after every output operation, so that text written directly to
+// the wrapped stream in between lands in the right place
 IndentedStream::IndentedStream(std::ostream& os, int indentWidth)
-    : std::ostream(&buffer), buffer(os.rdbuf(), indentWidth) {}
+    : std::ostream(&buffer), buffer(os.rdbuf(), indentWidth) {
+    setf(std::ios::unitbuf);
+}
 
-unsigned long util::log2(unsigned long size) {
-    switch (size) {
-        case 1: return 0;
-        case 2: return 1;
-        case 4: return 2;
-        case 8: return 3;
-        case 16: return 4;
-        case 32: return 5;
-        case 64: return 6;
-        case 128: return 7;
-        case 256: return 8;
+AsmWriter::AsmWriter(std::size_t chunkSize) : chunkSize(chunkSize) {}
+
+void AsmWriter::newChunk(std::size_t minSize) {
+    chunks.emplace_back();
+    chunks.back().reserve(minSize > chunkSize ? minSize : chunkSize);
+}
+
+void AsmWriter::write(const char *data, std::size_t len) {
+    if (chunks.empty()
+            || chunks.back().size() + len > chunks.back().capacity()) {
+        newChunk(len);
+    }
+    chunks.back().append(data, len);
+    totalSize += len;
+}
+
+AsmWriter &AsmWriter::operator<<(const std::string &str) {
+    write(str.data(), str.size());
+    return *this;
+}
+
+AsmWriter &AsmWriter::operator<<(const char *str) {
+    write(str, std::strlen(str));
+    return *this;
+}
+
+AsmWriter &AsmWriter::operator<<(char c) {
+    write(&c, 1);
+    return *this;
+}
+
+AsmWriter &AsmWriter::operator<<(long l) {
+    if (l < 0) {
+        *this << '-';
+        return *this << (unsigned long)0 - (unsigned long)l;
+    }
+    return *this << (unsigned long)l;
+}
+
+AsmWriter &AsmWriter::operator<<(unsigned long l) {
+    char digits[20];
+    int i = sizeof(digits);
+    do {
+        digits[--i] = '0' + l % 10;
+        l /= 10;
+    } while (l > 0);
+    write(digits + i, sizeof(digits) - i);
+    return *this;
+}
+
+AsmWriter &AsmWriter::operator<<(int i) {
+    return *this << (long)i;
+}
+
+AsmWriter &AsmWriter::operator<<(unsigned u) {
+    return *this << (unsigned long)u;
+}
+
+AsmWriter &AsmWriter::indent(unsigned width) {
+    static const std::string spaces(64, ' ');
+    for (; width > spaces.size(); width -= spaces.size()) {
+        write(spaces.data(), spaces.size());
+    }
+    write(spaces.data(), width);
+    return *this;
+}
+
+std::string AsmWriter::str() const {
+    std::string result;
+    result.reserve(totalSize);
+    for (const std::string &chunk : chunks) {
+        result += chunk;
+    }
+    return result;
+}
+
+void AsmWriter::append(AsmWriter &&other) {
+    for (std::string &chunk : other.chunks) {
+        chunks.push_back(std::move(chunk));
+    }
+    totalSize += other.totalSize;
+    other.chunks.clear();
+    other.totalSize = 0;
+}
+
+bool AsmWriter::writeTo(int fd) const {
+    for (const std::string &chunk : chunks) {
+        const char *data = chunk.data();
+        std::size_t left = chunk.size();
+        while (left > 0) {
+            ssize_t written = ::write(fd, data, left);
+            if (written < 0 && errno == EINTR) { continue; }
+            if (written <= 0) { return false; }
+            data += written;
+            left -= written;
+        }
+    }
+    return true;
+}
+
+// Sizes the file up front and copies the chunks into a shared mapping. Falls
+// back to write(2) for outputs that can't be mapped (pipes, devices).
+bool AsmWriter::writeToFile(const char *path) const {
+    int fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) { return false; }
+
+    void *map = MAP_FAILED;
+    if (totalSize > 0 && ::ftruncate(fd, totalSize) == 0) {
+        map = ::mmap(nullptr, totalSize, PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (map == MAP_FAILED) {
+        bool ok = writeTo(fd);
+        return ::close(fd) == 0 && ok;
+    }
+
+    char *dst = static_cast<char *>(map);
+    for (const std::string &chunk : chunks) {
+        std::memcpy(dst, chunk.data(), chunk.size());
+        dst += chunk.size();
     }
+    bool ok = ::munmap(map, totalSize) == 0;
+    return ::close(fd) == 0 && ok;
+}
+
+bool StringView::operator==(const StringView &other) const {
+    return size == other.size
+        && (size == 0 || std::memcmp(data, other.data, size) == 0);
+}
+
+// FNV-1a
+std::size_t StringViewHash::operator()(const StringView &view) const {
+    std::size_t hash = 14695981039346656037ul;
+    for (std::size_t i = 0; i < view.size; i++) {
+        hash ^= (unsigned char)view.data[i];
+        hash *= 1099511628211ul;
+    }
+    return hash;
+}
+
+SourceBuffer::~SourceBuffer() {
+    close();
+}
+
+bool SourceBuffer::open(const std::string &path) {
+    close();
+    if (path.empty() || path == "-") {
+        return readAll(STDIN_FILENO);
+    }
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) { return false; }
+
+    struct stat st;
+    bool ok = ::fstat(fd, &st) == 0;
+    if (ok) {
+        ok = S_ISREG(st.st_mode) ? map(fd, st.st_size) : readAll(fd);
+    }
+    int savedErrno = errno;
+    ::close(fd);
+    errno = savedErrno;
+    return ok;
+}
 
+void SourceBuffer::close() {
+    if (mappedLength > 0) {
+        ::munmap(buffer, mappedLength);
+    }
+    buffer = nullptr;
+    length = 0;
+    mappedLength = 0;
+    owned.clear();
+}
+
+bool SourceBuffer::readAll(int fd) {
+    owned.resize(64 * 1024);
+    std::size_t used = 0;
+    while (true) {
+        if (owned.size() - used <= 2) {
+            owned.resize(owned.size() * 2);
+        }
+        ssize_t n = ::read(fd, owned.data() + used, owned.size() - used - 2);
+        if (n < 0 && errno == EINTR) { continue; }
+        if (n < 0) { return false; }
+        if (n == 0) { break; }
+        used += n;
+    }
+    owned[used] = '\0';
+    owned[used + 1] = '\0';
+    buffer = owned.data();
+    length = used;
+    return true;
+}
+
+// Reserves zeroed anonymous memory one byte pair past the end of the file,
+// then maps the file over its start. The tail of the last file page and any
+// following anonymous page read as zero, so the NUL terminators are free.
+bool SourceBuffer::map(int fd, std::size_t fileLength) {
+    const std::size_t pageSize = ::sysconf(_SC_PAGESIZE);
+    const std::size_t total = (fileLength + 2 + pageSize - 1)
+                              / pageSize * pageSize;
+
+    void *base = ::mmap(nullptr, total, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) { return false; }
+
+    if (fileLength > 0) {
+        void *file = ::mmap(base, fileLength, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_FIXED, fd, 0);
+        if (file == MAP_FAILED) {
+            int savedErrno = errno;
+            ::munmap(base, total);
+            errno = savedErrno;
+            return false;
+        }
+    }
+
+    buffer = static_cast<char *>(base);
+    length = fileLength;
+    mappedLength = total;
+    return true;
+}
+
+Arena::Arena(std::size_t blockSize) : blockSize(blockSize) {}
+
+Arena::~Arena() {
+    release();
+}
+
+void *Arena::allocate(std::size_t size, std::size_t align) {
+    std::uintptr_t p = reinterpret_cast<std::uintptr_t>(ptr);
+    std::uintptr_t aligned = (p + align - 1) & ~(std::uintptr_t)(align - 1);
+    if (!current || aligned + size > reinterpret_cast<std::uintptr_t>(end)) {
+        newBlock(size + align);
+        p = reinterpret_cast<std::uintptr_t>(ptr);
+        aligned = (p + align - 1) & ~(std::uintptr_t)(align - 1);
+    }
+    ptr = reinterpret_cast<char *>(aligned + size);
+    allocated += size;
+    return reinterpret_cast<void *>(aligned);
+}
+
+void Arena::newBlock(std::size_t minSize) {
+    std::size_t size = sizeof(Block) + (minSize > blockSize ? minSize : blockSize);
+    Block *block = static_cast<Block *>(std::malloc(size));
+    if (!block) {
+        std::cerr << "ERROR: Out of memory\n";
+        exit(EXIT_FAILURE);
+    }
+    block->prev = current;
+    block->size = size;
+    current = block;
+    ptr = reinterpret_cast<char *>(block + 1);
+    end = reinterpret_cast<char *>(block) + size;
+    reserved += size;
+    blocks++;
+}
+
+void Arena::addDestructor(void *obj, void (*destroy)(void *)) {
+    Destructor *d = static_cast<Destructor *>(
+        allocate(sizeof(Destructor), alignof(Destructor)));
+    d->destroy = destroy;
+    d->obj = obj;
+    d->prev = destructors;
+    destructors = d;
+}
+
+void Arena::release() {
+    for (Destructor *d = destructors; d; d = d->prev) {
+        d->destroy(d->obj);
+    }
+    destructors = nullptr;
+
+    while (current) {
+        Block *prev = current->prev;
+        std::free(current);
+        current = prev;
+    }
+    ptr = end = nullptr;
+    allocated = reserved = blocks = 0;
+}
+
+unsigned long util::log2(unsigned long size) {
     unsigned long i = 0;
     while (size > 1) {
         size = size >> 1;
@@ -45,3 +358,26 @@ unsigned long util::log2(unsigned long size) {
     }
     return i;
 }
+
+bool util::isPowerOf2(unsigned long value) {
+    return value != 0 && (value & (value - 1)) == 0;
+}
+
+void util::parallelFor(std::size_t n, unsigned numThreads,
+                       const std::function<void(std::size_t)> &fn) {
+    std::atomic<std::size_t> next(0);
+    auto worker = [&]() {
+        for (std::size_t i = next++; i < n; i = next++) {
+            fn(i);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned t = 1; t < numThreads && t < n; t++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+}
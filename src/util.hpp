@@ -1,19 +1,40 @@
 #pragma once
 
+#include <cstddef>
+#include <cstring>
+#include <functional>
 #include <iostream>
+#include <new>
 #include <streambuf>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
+/*
+  Prefixes every non-empty line with indentWidth spaces. Output is collected
+  in a put area and forwarded a line at a time, instead of one overflow()
+  call per character. sync() flushes down to the wrapped buffer, so nested
+  streams stay ordered.
+*/
 class IndentedStreamBuffer : public std::streambuf {
 public:
     explicit IndentedStreamBuffer(std::streambuf* buf, int indentWidth = 2);
+    ~IndentedStreamBuffer();
 
 protected:
     virtual int overflow(int c) override;
+    virtual int sync() override;
 
 private:
+    static const int BUFFER_SIZE = 4096;
+
     std::streambuf* buf;
-    int indentWidth;
+    std::string indentation;
     bool shouldIndent;
+    char buffer[BUFFER_SIZE];
+
+    bool flushBuffer();
 };
 
 class IndentedStream : public std::ostream {
@@ -24,6 +45,157 @@ private:
     IndentedStreamBuffer buffer;
 };
 
+/*
+  Append-only sink for generated assembly. Text is copied once into chunks
+  that never move, and written out in a single pass at the end: straight to
+  a file descriptor, or into an mmap'd output file of the final size.
+*/
+class AsmWriter {
+public:
+    explicit AsmWriter(std::size_t chunkSize = 64 * 1024);
+
+    void write(const char *data, std::size_t len);
+    AsmWriter &operator<<(const std::string &str);
+    AsmWriter &operator<<(const char *str);
+    AsmWriter &operator<<(char c);
+    AsmWriter &operator<<(long l);
+    AsmWriter &operator<<(unsigned long l);
+    AsmWriter &operator<<(int i);
+    AsmWriter &operator<<(unsigned u);
+
+    std::size_t size() const { return totalSize; }
+    std::string str() const;
+    AsmWriter &indent(unsigned width);
+    // Moves other's chunks onto the end of this writer without copying
+    void append(AsmWriter &&other);
+
+    bool writeTo(int fd) const;
+    bool writeToFile(const char *path) const;
+
+private:
+    std::vector<std::string> chunks;
+    std::size_t chunkSize;
+    std::size_t totalSize = 0;
+
+    void newChunk(std::size_t minSize);
+};
+
+/*
+  Bump allocator that owns every object created during a compilation.
+  Objects are never freed individually; the whole arena is released at once,
+  running the destructors of non-trivial objects in reverse creation order.
+*/
+class Arena {
+public:
+    explicit Arena(std::size_t blockSize = 64 * 1024);
+    ~Arena();
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    void *allocate(std::size_t size,
+                   std::size_t align = alignof(std::max_align_t));
+
+    template <typename T, typename... Args>
+    T *create(Args &&...args) {
+        void *mem = allocate(sizeof(T), alignof(T));
+        T *obj = new (mem) T(std::forward<Args>(args)...);
+        if (!std::is_trivially_destructible<T>::value) {
+            addDestructor(obj, [](void *p) { static_cast<T *>(p)->~T(); });
+        }
+        return obj;
+    }
+
+    void release();
+
+    std::size_t bytesAllocated() const { return allocated; }
+    std::size_t bytesReserved() const { return reserved; }
+    std::size_t numBlocks() const { return blocks; }
+
+private:
+    struct Block {
+        Block *prev;
+        std::size_t size;
+    };
+    struct Destructor {
+        void (*destroy)(void *);
+        void *obj;
+        Destructor *prev;
+    };
+
+    std::size_t blockSize;
+    Block *current = nullptr;
+    char *ptr = nullptr;
+    char *end = nullptr;
+    Destructor *destructors = nullptr;
+
+    std::size_t allocated = 0;
+    std::size_t reserved = 0;
+    std::size_t blocks = 0;
+
+    void newBlock(std::size_t minSize);
+    void addDestructor(void *obj, void (*destroy)(void *));
+};
+
+/*
+  Non-owning view of a run of characters, e.g. a token inside the scanner's
+  input buffer. Only valid as long as the underlying buffer is.
+*/
+struct StringView {
+    const char *data = nullptr;
+    std::size_t size = 0;
+
+    StringView() = default;
+    StringView(const char *data, std::size_t size) : data(data), size(size) {}
+    StringView(const char *str) : data(str), size(std::strlen(str)) {}
+    StringView(const std::string &str) : data(str.data()), size(str.size()) {}
+
+    std::string str() const { return std::string(data, size); }
+    bool operator==(const StringView &other) const;
+};
+
+struct StringViewHash {
+    std::size_t operator()(const StringView &view) const;
+};
+
+/*
+  A whole source file in memory, followed by the two NUL bytes that flex's
+  yy_scan_buffer needs. Regular files are mmap'd copy-on-write, since flex
+  writes into the buffer while scanning; anything else (stdin, pipes) is
+  read once into an owned buffer.
+*/
+class SourceBuffer {
+public:
+    SourceBuffer() = default;
+    ~SourceBuffer();
+    SourceBuffer(const SourceBuffer &) = delete;
+    SourceBuffer &operator=(const SourceBuffer &) = delete;
+
+    // "-" or an empty path reads stdin. Returns false and sets errno on
+    // failure.
+    bool open(const std::string &path);
+    void close();
+
+    char *data() { return buffer; }
+    // Includes the two trailing NUL bytes
+    std::size_t size() const { return length + 2; }
+
+private:
+    char *buffer = nullptr;
+    std::size_t length = 0;
+    std::size_t mappedLength = 0;  // 0 if buffer points into owned
+    std::vector<char> owned;
+
+    bool readAll(int fd);
+    bool map(int fd, std::size_t fileLength);
+};
+
 namespace util {
+    // Rounded down, and 0 for 0
     unsigned long log2(unsigned long size);
+    bool isPowerOf2(unsigned long value);
+
+    // Calls fn(0) .. fn(n - 1), handing indices out to up to numThreads
+    // threads (the caller included) as they become free
+    void parallelFor(std::size_t n, unsigned numThreads,
+                     const std::function<void(std::size_t)> &fn);
 }